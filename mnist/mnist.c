@@ -15,7 +15,10 @@
  * If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <sys/types.h>
 #include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
@@ -23,15 +26,65 @@
 #include "../src/g.h"
 
 #define BATCH  8
+#define SCORE  64 /* test samples per g_activate_batch() */
 #define EPOCHS 4
 #define REAL_T float
 
+#ifndef PROFILE
+#define PROFILE G_PROFILE_PORTABLE /* or G_PROFILE_NATIVE, G_PROFILE_PGO */
+#endif
+
+#ifndef INTERPRET
+#define INTERPRET 0 /* 1: built-in kernels, no JIT */
+#endif
+
+#ifndef THREADS
+#define THREADS 0 /* >0: g_train_parallel() on this many threads */
+#endif
+
+#ifndef HOGWILD
+#define HOGWILD 0 /* 1: g_train_hogwild() on THREADS threads instead */
+#endif
+
+#ifndef STALE
+#define STALE 0 /* 1: .schedule stale, updates overlap the next batch */
+#endif
+
+#ifndef PIPELINE
+#define PIPELINE 0 /* >0: test by g_activate_pipeline() on this many stages */
+#endif
+
+#ifndef RANKS
+#define RANKS 1 /* >1: g_train_ring() across this many processes */
+#endif
+
+#ifndef LOADER
+#define LOADER 0 /* >0: serial, batches prepared by this many threads */
+#endif
+
+#ifndef PIXELS
+#define PIXELS 1 /* 1: raw pixels in, .input uint8 scale(1/255) */
+#endif
+
+#if PIXELS
+#define INPUT ".input 28 * 28 uint8 scale(1/255)"
+#else
+#define INPUT ".input 28 * 28"
+#endif
+
+#define CHUNK (HOGWILD ? SCORE : BATCH) /* training samples per call */
+#define ONEHOT ((1 < RANKS) || HOGWILD || THREADS) /* else g_train_labels() */
+
 #define MKSTRING(x) #x
 #define TOSTRING(x) MKSTRING(x)
 #define UL(x)       ((unsigned long)(x))
 
 typedef REAL_T real_t;
 
+static int rank;      /* of this process, 0 .. RANKS - 1 */
+static g_ring_t ring; /* RANKS > 1 */
+static g_loader_t loader; /* LOADER > 0 */
+
 static uint64_t
 usec(void)
 {
@@ -41,19 +94,6 @@ usec(void)
 	return (uint64_t)t.tv_usec + (uint64_t)t.tv_sec * 1000000;
 }
 
-static int32_t
-swap(int32_t x)
-{
-	union { int32_t i; char b[4]; } in, out;
-
-	in.i = x;
-	out.b[0] = in.b[3];
-	out.b[1] = in.b[2];
-	out.b[2] = in.b[1];
-	out.b[3] = in.b[0];
-	return out.i;
-}
-
 static int
 argmax(const real_t *a, int n)
 {
@@ -80,15 +120,21 @@ train_and_test(g_t g,
 	       int test_n)
 {
 	const uint8_t *labels, *images;
+	const void *in;
 	int i, j, k, m, error;
 	real_t *x, *y, *z;
+	int32_t *c;
 	uint64_t t[3];
 
-	x = (real_t *)malloc(BATCH * 28 * 28 * sizeof (x[0]));
-	y = (real_t *)malloc(BATCH * 10 * sizeof (y[0]));
-	if (!x || !y) {
+	x = (real_t *)malloc(SCORE * 28 * 28 * sizeof (x[0]));
+	y = (real_t *)malloc(CHUNK * 10 * sizeof (y[0]));
+	z = (real_t *)malloc(SCORE * 10 * sizeof (z[0]));
+	c = (int32_t *)malloc(CHUNK * sizeof (c[0]));
+	if (!x || !y || !z || !c) {
 		free(x);
 		free(y);
+		free(z);
+		free(c);
 		fprintf(stderr, "out of memory\n");
 		return -1;
 	}
@@ -96,20 +142,44 @@ train_and_test(g_t g,
 	/* train */
 
 	t[0] = usec();
-	m = train_n / BATCH;
+	m = train_n / CHUNK / RANKS * RANKS;
 	labels = train_y;
 	images = train_x;
 	for (i=0; i<m; ++i) {
-		for (j=0; j<BATCH; ++j) {
-			for (k=0; k<(28*28); ++k) {
-				x[j * (28*28) + k] = (*images++) / 255.0;
+		if (LOADER) {
+			g_loader_train(loader);
+			printf("\r%06d/%06d", i, m);
+			fflush(stdout);
+			continue;
+		}
+		if ((i % RANKS) != rank) {
+			labels += CHUNK;
+			images += CHUNK * (28*28);
+			continue;
+		}
+		in = PIXELS ? (const void *)images : (const void *)x;
+		for (j=0; j<CHUNK; ++j) {
+			for (k=0; !PIXELS && (k<(28*28)); ++k) {
+				x[j * (28*28) + k] = images[k] / 255.0;
 			}
-			for (k=0; k<10; ++k) {
-				y[j * 10 + k] = 0.0;
+			images += 28*28;
+			for (k=0; ONEHOT && (k<10); ++k) {
+				y[j * 10 + k] = (k == *labels) ? 1.0 : 0.0;
 			}
-			y[j * 10 + (*labels++)] = 1.0;
+			c[j] = *labels++;
+		}
+		if (1 < RANKS) {
+			g_train_ring(ring, g, in, y, CHUNK, THREADS);
+		}
+		else if (HOGWILD) {
+			g_train_hogwild(g, in, y, CHUNK, THREADS);
+		}
+		else if (THREADS) {
+			g_train_parallel(g, in, y, BATCH, THREADS);
+		}
+		else {
+			g_train_labels(g, in, c);
 		}
-		g_train(g, x, y);
 		printf("\r%06d/%06d", i, m);
 		fflush(stdout);
 	}
@@ -122,13 +192,23 @@ train_and_test(g_t g,
 	error = 0;
 	labels = test_y;
 	images = test_x;
-	for (i=0; i<test_n; ++i) {
-		for (k=0; k<(28*28); ++k) {
-			x[k] = (*images++) / 255.0;
+	for (i=0; i<test_n; i+=m) {
+		m = (SCORE < (test_n - i)) ? SCORE : (test_n - i);
+		in = PIXELS ? (const void *)images : (const void *)x;
+		for (k=0; !PIXELS && (k<(m*28*28)); ++k) {
+			x[k] = images[k] / 255.0;
 		}
-		z = g_activate(g, x);
-		if (argmax(z, 10) != (int)(*labels++)) {
-			error++;
+		images += m * 28*28;
+		if (PIPELINE) {
+			g_activate_pipeline(g, in, m, z, PIPELINE);
+		}
+		else {
+			g_activate_batch(g, in, m, z);
+		}
+		for (j=0; j<m; ++j) {
+			if (argmax(z + j * 10, 10) != (int)(*labels++)) {
+				error++;
+			}
 		}
 		printf("\r%06d/%06d", i, test_n);
 		fflush(stdout);
@@ -144,137 +224,172 @@ train_and_test(g_t g,
 
 	free(x);
 	free(y);
+	free(z);
+	free(c);
 	return 0;
 }
 
-static uint8_t *
-load_labels(const char *pathname, int *n)
+/* an IDX file of uint8 with dims dimensions, past the first all 28 */
+
+static g_data_t
+load(const char *pathname, int dims)
 {
-	int32_t meta[2];
-	uint8_t *data;
-	FILE *file;
+	g_data_t data;
+	int i;
 
-	file = fopen(pathname, "r");
-	if (!file) {
-		fprintf(stderr, "unable to open file\n");
-		return 0;
-	}
-	if (sizeof (meta) != fread(meta, 1, sizeof (meta), file)) {
-		fclose(file);
-		fprintf(stderr, "unable to read file\n");
-		return 0;
-	}
-	if ((0x1080000 != meta[0]) || (0 >= swap(meta[1]))) {
-		fclose(file);
-		fprintf(stderr, "invalid file\n");
-		return 0;
-	}
-	(*n) = swap(meta[1]);
-	meta[1] = (*n);
-	data = (uint8_t *)malloc(meta[1]);
+	data = g_data_open(pathname);
 	if (!data) {
-		fclose(file);
-		fprintf(stderr, "out of memory\n");
+		fprintf(stderr, "unable to open %s\n", pathname);
 		return 0;
 	}
-	if ((size_t)meta[1] != fread(data, 1, meta[1], file)) {
-		free(data);
-		fclose(file);
-		fprintf(stderr, "unable to read file\n");
+	for (i=1; i<dims; ++i) {
+		if (28 != g_data_dim(data, i)) {
+			break;
+		}
+	}
+	if ((G_DATA_UINT8 != g_data_type(data)) ||
+	    (i < dims) ||
+	    g_data_dim(data, dims)) {
+		g_data_close(data);
+		fprintf(stderr, "invalid file %s\n", pathname);
 		return 0;
 	}
-	fclose(file);
 	return data;
 }
 
-static uint8_t *
-load_images(const char *pathname, int *n)
+static void
+unload(g_data_t *data)
 {
-	int32_t meta[4];
-	uint8_t *data;
-	FILE *file;
+	int i;
 
-	file = fopen(pathname, "r");
-	if (!file) {
-		fprintf(stderr, "unable to open file\n");
-		return 0;
-	}
-	if (sizeof (meta) != fread(meta, 1, sizeof (meta), file)) {
-		fclose(file);
-		fprintf(stderr, "unable to read file\n");
-		return 0;
-	}
-	if ((0x3080000 != meta[0]) ||
-	    (0  >= swap(meta[1])) ||
-	    (28 != swap(meta[2])) ||
-	    (28 != swap(meta[3]))) {
-		fclose(file);
-		fprintf(stderr, "invalid file\n");
-		return 0;
-	}
-	(*n) = swap(meta[1]);
-	meta[1] = (*n) * 28 * 28;
-	data = (uint8_t *)malloc(meta[1]);
-	if (!data) {
-		fclose(file);
-		fprintf(stderr, "out of memory\n");
-		return 0;
+	for (i=0; i<4; ++i) {
+		g_data_close(data[i]);
 	}
-	if ((size_t)meta[1] != fread(data, 1, meta[1], file)) {
-		free(data);
-		fclose(file);
-		fprintf(stderr, "unable to read file\n");
-		return 0;
+}
+
+static void
+warmup(const uint8_t *labels,
+       const uint8_t *images,
+       real_t *x,
+       real_t *y)
+{
+	int j, k;
+
+	for (j=0; j<BATCH; ++j) {
+		for (k=0; k<(28*28); ++k) {
+			x[j * (28*28) + k] = (*images++) / 255.0;
+		}
+		for (k=0; k<10; ++k) {
+			y[j * 10 + k] = 0.0;
+		}
+		y[j * 10 + (*labels++)] = 1.0;
 	}
-	fclose(file);
-	return data;
 }
 
 int
 main()
 {
-	int train_y_n, train_x_n, test_y_n, test_x_n;
-	uint8_t *train_y, *train_x, *test_y, *test_x;
+	const uint8_t *train_y, *train_x, *test_y, *test_x;
+	real_t x[BATCH * 28 * 28], y[BATCH * 10];
+	struct g_options options;
+	g_data_t data[4];
+	uint64_t t;
 	int i, e;
 	g_t g;
 
+	/* map train/test data, samples are read in place */
+
+	e = 0;
+	data[0] = load("data/train-labels", 1);
+	data[1] = load("data/train-images", 3);
+	data[2] = load("data/test-labels", 1);
+	data[3] = load("data/test-images", 3);
+	if (!data[0] ||
+	    !data[1] ||
+	    !data[2] ||
+	    !data[3] ||
+	    (g_data_count(data[0]) != g_data_count(data[1])) ||
+	    (g_data_count(data[2]) != g_data_count(data[3]))) {
+		unload(data);
+		fprintf(stderr, "failed to load valid train/test data\n");
+		return -1;
+	}
+	train_y = (const uint8_t *)g_data_sample(data[0], 0);
+	train_x = (const uint8_t *)g_data_sample(data[1], 0);
+	test_y = (const uint8_t *)g_data_sample(data[2], 0);
+	test_x = (const uint8_t *)g_data_sample(data[3], 0);
+
+	/* ranks 1 .. RANKS - 1 are children, only rank 0 reports */
+
+	for (i=1; i<RANKS; ++i) {
+		if (!fork()) {
+			rank = i;
+			if (!freopen("/dev/null", "w", stdout)) {
+				return -1;
+			}
+			break;
+		}
+	}
+
 	/* open ANN */
 
+	memset(&options, 0, sizeof (options));
+	options.profile = PROFILE;
+	options.warmup_x = PIXELS ? (const void *)train_x : (const void *)x;
+	options.warmup_y = y;
+	options.warmup_rounds = 100;
+	options.interpret = INTERPRET;
+	warmup(train_y, train_x, x, y);
 	g_debug(1);
-	g = g_open(".optimizer sgd 0.1",
-		   ".precision " TOSTRING(REAL_T),
-		   ".costfnc cross_entropy",
-		   ".batch " TOSTRING(BATCH),
-		   ".input 28 * 28",
-		   ".output 10 softmax",
-		   ".hidden 100 relu",
-		   ".hidden 100 relu",
-		   0);
+	t = usec();
+	g = g_open_ex(&options,
+		      ".optimizer sgd 0.1",
+		      ".precision " TOSTRING(REAL_T),
+		      ".costfnc cross_entropy",
+		      ".batch " TOSTRING(BATCH),
+		      INPUT,
+		      ".output 10 softmax",
+		      ".hidden 100 relu",
+		      ".hidden 100 relu",
+		      STALE ? ".schedule stale" : ".schedule serial",
+		      0);
+	t = usec() - t;
 	if (!g) {
+		unload(data);
 		fprintf(stderr, "g_open error\n");
 		return -1;
 	}
+	if (1 < RANKS) {
+		ring = g_ring_open("mnist.ring", rank, RANKS, 0);
+		if (!ring || g_ring_broadcast(ring, g)) {
+			g_ring_close(ring);
+			g_close(g);
+			unload(data);
+			fprintf(stderr, "g_ring error\n");
+			return -1;
+		}
+	}
+	if (LOADER) {
+		loader = g_loader_open(g,
+				       data[1],
+				       data[0],
+				       1.0 / 255,
+				       LOADER,
+				       0,
+				       1);
+		if (!loader) {
+			g_close(g);
+			unload(data);
+			fprintf(stderr, "g_loader error\n");
+			return -1;
+		}
+	}
 	printf("version: %d\n", g_version());
+	printf("profile: %s\n", INTERPRET ? "interpret" : TOSTRING(PROFILE));
+	printf("open   : %.2f sec\n", t * 1e-6);
 	printf("size   : %lu\n", UL(g_memory_size(g)));
 	printf("hard   : %lu\n", UL(g_memory_hard(g)));
 
-	/* load train/test data */
-
-	e = 0;
-	train_y = load_labels("data/train-labels", &train_y_n);
-	train_x = load_images("data/train-images", &train_x_n);
-	test_y = load_labels("data/test-labels", &test_y_n);
-	test_x = load_images("data/test-images", &test_x_n);
-	if (!train_y ||
-	    !train_x ||
-	    !test_y ||
-	    !test_x ||
-	    (train_y_n != train_x_n) ||
-	    (test_y_n != test_x_n)) {
-		e = -1;
-		fprintf(stderr, "failed to load valid train/test data\n");
-	}
-
 	/* train and test */
 	srand(10);
 	for (i=0; i<EPOCHS; ++i) {
@@ -285,8 +400,8 @@ main()
 					   train_x,
 					   test_y,
 					   test_x,
-					   train_y_n,
-					   test_y_n)) {
+					   (int)g_data_count(data[0]),
+					   (int)g_data_count(data[2]))) {
 				e = -1;
 				fprintf(stderr, "failed to train/test\n");
 			}
@@ -295,10 +410,12 @@ main()
 
 	/* close */
 
+	g_loader_close(loader);
+	g_ring_close(ring);
 	g_close(g);
-	free(train_y);
-	free(train_x);
-	free(test_y);
-	free(test_x);
+	unload(data);
+	for (i=1; !rank && (i<RANKS); ++i) {
+		wait(0);
+	}
 	return e;
 }
@@ -15,30 +15,153 @@
  * If not, see <https://www.gnu.org/licenses/>.
  */
 
-#include "g_emitc.h"
+#include <sys/types.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "g_data.h"
+#include "g_exec.h"
+#include "g_memory.h"
+#include "g_pool.h"
+#include "g_ring.h"
+#include "g_tune.h"
 #include "g_vcm.h"
 #include "g.h"
 
 #define SIG 1298343576
+#define SIG_CONTEXT 1298343577
+#define SIG_RING    1298343578
+#define SIG_DATA    1298343579
+#define SIG_LOADER  1298343580
 #define MAX_LAYERS  10
+#define SLICES      32 /* g_train_parallel, independent of the threads */
+#define SPIN      4096 /* polls before sleeping, as in g_pool.c */
 
-typedef int    (*version_fnc_t)     (void);
-typedef size_t (*memory_size_fnc_t) (void);
-typedef size_t (*memory_hard_fnc_t) (void);
-typedef void   (*initialize_fnc_t)  (void *);
-typedef void  *(*activate_fnc_t)    (void *, const void *);
-typedef void   (*train_fnc_t)       (void *, const void *, const void *);
+typedef int    (*version_fnc_t)        (void);
+typedef size_t (*memory_size_fnc_t)    (void);
+typedef size_t (*memory_hard_fnc_t)    (void);
+typedef size_t (*memory_context_fnc_t) (void);
+typedef size_t (*memory_unit_fnc_t)    (void);
+typedef size_t (*input_unit_fnc_t)     (void);
+typedef int    (*batch_fnc_t)          (void);
+typedef int    (*schedule_fnc_t)       (void);
+typedef void   (*initialize_fnc_t)     (void *);
+typedef void  *(*activate_fnc_t)       (void *, const void *);
+typedef void   (*activate_into_fnc_t)  (void *, const void *, void *);
+typedef size_t (*memory_batch_fnc_t)   (void);
+typedef void   (*activate_batch_fnc_t) (const void *,
+					void *,
+					const void *,
+					size_t,
+					void *);
+typedef void  *(*activate_ctx_fnc_t)   (const void *, void *, const void *);
+typedef void  *(*activate_layer_fnc_t) (const void *,
+					void *,
+					const void *,
+					int);
+typedef size_t (*layer_size_fnc_t)     (int);
+typedef void   (*export_fnc_t)         (const void *, void *);
+typedef void   (*import_fnc_t)         (void *, const void *);
+typedef void   (*train_fnc_t)          (void *, const void *, const void *);
+typedef void   (*train_gather_fnc_t)   (void *,
+					const void *,
+					const void *,
+					const void *,
+					size_t,
+					size_t);
+typedef void   (*train_shard_fnc_t)    (const void *,
+					void *,
+					const void *,
+					const void *,
+					size_t,
+					size_t);
+typedef void   (*reduce_fnc_t)         (void *, const void *, int, int);
+typedef void   (*update_fnc_t)         (void *,
+					const void *,
+					const void *,
+					size_t);
+typedef void   (*train_hogwild_fnc_t)  (void *,
+					void *,
+					const void *,
+					const void *,
+					size_t,
+					size_t);
+typedef void   (*thread_pool_fnc_t)    (void (*)(void *, g__pool_fnc_t, void *),
+					void *);
+
+struct g_context {
+	void *memory; /* activations only */
+	size_t size;
+	unsigned sig;
+	struct g *g;
+};
+
+struct g_ring {
+	g__ring_t ring;
+	unsigned sig;
+	int size;
+	int compress;
+};
+
+struct g_data {
+	g__data_t data;
+	unsigned sig;
+};
 
 struct g {
 	void *memory;
 	unsigned sig;
 	g__vcm_t vcm;
+	g__exec_t exec;
+	g__pool_t pool;
 	version_fnc_t version;
 	memory_size_fnc_t memory_size;
 	memory_hard_fnc_t memory_hard;
+	memory_context_fnc_t memory_context;
+	memory_batch_fnc_t memory_batch;
+	memory_unit_fnc_t memory_unit;
+	input_unit_fnc_t input_unit;
+	batch_fnc_t batch;
+	schedule_fnc_t schedule;
 	initialize_fnc_t initialize;
 	activate_fnc_t activate;
+	activate_into_fnc_t activate_into;
+	activate_batch_fnc_t activate_batch;
+	activate_ctx_fnc_t activate_ctx;
+	activate_layer_fnc_t activate_layer;
+	layer_size_fnc_t layer_size;
+	export_fnc_t export_;
+	import_fnc_t import_;
 	train_fnc_t train;
+	train_fnc_t train_labels;
+	train_gather_fnc_t train_gather;
+	train_shard_fnc_t train_shard;
+	train_shard_fnc_t train_shard_labels;
+	reduce_fnc_t reduce;
+	update_fnc_t update;
+	train_hogwild_fnc_t train_hogwild;
+	struct g_options options;
+	char prefix[32]; /* of the module symbols */
+	char *slices; /* g_train_parallel, SLICES non-hard parts */
+	char *scratch; /* g_activate_batch, from its first call on */
+	struct {
+		pthread_mutex_t mutex; /* reopening the pool */
+		g__pool_t pool; /* lanes and pipeline stages, n threads */
+		int n;
+	} team;
+	struct {
+		void *memory; /* next weights, swapped with memory */
+		char *grads; /* two non-hard parts, one per batch in flight */
+		int pending; /* grads of the last batch not applied yet */
+		int k; /* part of grads the next batch trains into */
+		char *samples; /* one batch of x then y, see train_gather */
+	} stale;
+	struct {
+		int running;
+		int done; /* activate/train now in vcm below */
+		char *pathname; /* C file, kept until the background build */
+		g__vcm_t vcm;
+		pthread_t thread;
+	} tier;
 };
 
 static int
@@ -51,7 +174,7 @@ populate(const char *pathname,
 	 const char *batch,
 	 const char *input,
 	 const char *output,
-	 const char *layers[])
+	 const char *const *layers)
 {
 	FILE *file;
 	int i;
@@ -93,6 +216,484 @@ populate(const char *pathname,
 	return 0;
 }
 
+static struct g__ann *
+front(const char *pathname,
+      const char *module,
+      const char *prefix,
+      const char *optimizer,
+      const char *precision,
+      const char *costfnc,
+      const char *batch,
+      const char *input,
+      const char *output,
+      const char *const *layers)
+{
+	const struct g__ir *ir;
+	struct g__ann *ann;
+
+	if (populate(pathname,
+		     module,
+		     prefix,
+		     optimizer,
+		     precision,
+		     costfnc,
+		     batch,
+		     input,
+		     output,
+		     layers)) {
+		G__DEBUG(0);
+		return 0;
+	}
+	ir = g__ir_parse(pathname, g__debug_enabled);
+	g__unlink(pathname);
+	if (!ir) {
+		G__DEBUG(0);
+		return 0;
+	}
+	ann = g__ann_open(ir);
+	g__ir_destroy(ir);
+	if (!ann) {
+		G__DEBUG(0);
+		return 0;
+	}
+	return ann;
+}
+
+static const char *
+tmpdir(void)
+{
+	const char *tmp;
+
+	tmp = getenv("TMPDIR");
+	tmp = tmp ? tmp : getenv("TMP");
+	tmp = tmp ? tmp : getenv("TEMP");
+	tmp = tmp ? tmp : ".";
+	return tmp;
+}
+
+static long
+lookup(g__vcm_t vcm, const char *prefix, const char *name)
+{
+	char symbol[256];
+
+	g__sprintf(symbol, sizeof (symbol), "%s%s", prefix, name);
+	return g__vcm_lookup(vcm, symbol);
+}
+
+static void
+hand_pool(g__vcm_t vcm, const char *prefix, g__pool_t pool)
+{
+	thread_pool_fnc_t thread_pool;
+
+	if (pool) {
+		thread_pool = (thread_pool_fnc_t)
+			lookup(vcm, prefix, "_thread_pool");
+		assert( thread_pool );
+		thread_pool(g__pool_run, pool);
+	}
+}
+
+/*
+ * Model memory, from the caller's allocator if options name one and else
+ * 64-byte aligned with the G_MEMORY_* placement asked for, zeroed.
+ */
+
+static void *
+model_alloc(const struct g *g, size_t n)
+{
+	void *memory;
+	int flags;
+
+	if (g->options.allocate) {
+		memory = g->options.allocate(g->options.allocator, n);
+		if (!memory) {
+			G__DEBUG(G__ERR_MEMORY);
+			return 0;
+		}
+		if ((size_t)memory % 64) {
+			if (g->options.release) {
+				g->options.release(g->options.allocator,
+						   memory,
+						   n);
+			}
+			G__DEBUG(G__ERR_ARGUMENT);
+			return 0;
+		}
+		memset(memory, 0, n);
+		return memory;
+	}
+	flags = 0;
+	flags |= (G_MEMORY_HUGE & g->options.memory) ? G__MEMORY_HUGE : 0;
+	flags |= (G_MEMORY_LOCK & g->options.memory) ? G__MEMORY_LOCK : 0;
+	memory = g__memory_alloc(n, flags);
+	if (!memory) {
+		G__DEBUG(0);
+		return 0;
+	}
+	return memory;
+}
+
+static void
+model_free(const struct g *g, void *memory, size_t n)
+{
+	int flags;
+
+	if (!memory) {
+		return;
+	}
+	if (g->options.allocate) {
+		if (g->options.release) {
+			g->options.release(g->options.allocator, memory, n);
+		}
+		return;
+	}
+	flags = 0;
+	flags |= (G_MEMORY_HUGE & g->options.memory) ? G__MEMORY_HUGE : 0;
+	flags |= (G_MEMORY_LOCK & g->options.memory) ? G__MEMORY_LOCK : 0;
+	g__memory_free(memory, n, flags);
+}
+
+/* initialize: 0 if the caller fills the model memory itself */
+
+static int
+connect(struct g *g, const char *prefix, int initialize)
+{
+	/* jit connect */
+
+	g__sprintf(g->prefix, sizeof (g->prefix), "%s", prefix);
+	g->version = (version_fnc_t)
+		lookup(g->vcm, prefix, "_version");
+	g->memory_size = (memory_size_fnc_t)
+		lookup(g->vcm, prefix, "_memory_size");
+	g->memory_hard = (memory_hard_fnc_t)
+		lookup(g->vcm, prefix, "_memory_hard");
+	g->memory_context = (memory_context_fnc_t)
+		lookup(g->vcm, prefix, "_memory_context");
+	g->memory_batch = (memory_batch_fnc_t)
+		lookup(g->vcm, prefix, "_memory_batch");
+	g->memory_unit = (memory_unit_fnc_t)
+		lookup(g->vcm, prefix, "_memory_unit");
+	g->input_unit = (input_unit_fnc_t)
+		lookup(g->vcm, prefix, "_input_unit");
+	g->batch = (batch_fnc_t)
+		lookup(g->vcm, prefix, "_batch");
+	g->schedule = (schedule_fnc_t)
+		lookup(g->vcm, prefix, "_schedule");
+	g->initialize = (initialize_fnc_t)
+		lookup(g->vcm, prefix, "_initialize");
+	g->activate = (activate_fnc_t)
+		lookup(g->vcm, prefix, "_activate");
+	g->activate_into = (activate_into_fnc_t)
+		lookup(g->vcm, prefix, "_activate_into");
+	g->activate_batch = (activate_batch_fnc_t)
+		lookup(g->vcm, prefix, "_activate_batch");
+	g->activate_ctx = (activate_ctx_fnc_t)
+		lookup(g->vcm, prefix, "_activate_ctx");
+	g->activate_layer = (activate_layer_fnc_t)
+		lookup(g->vcm, prefix, "_activate_layer");
+	g->layer_size = (layer_size_fnc_t)
+		lookup(g->vcm, prefix, "_layer_size");
+	g->export_ = (export_fnc_t)
+		lookup(g->vcm, prefix, "_export");
+	g->import_ = (import_fnc_t)
+		lookup(g->vcm, prefix, "_import");
+	g->train = (train_fnc_t)
+		lookup(g->vcm, prefix, "_train");
+	g->train_labels = (train_fnc_t)
+		lookup(g->vcm, prefix, "_train_labels");
+	g->train_gather = (train_gather_fnc_t)
+		lookup(g->vcm, prefix, "_train_gather");
+	g->train_shard = (train_shard_fnc_t)
+		lookup(g->vcm, prefix, "_train_shard");
+	g->train_shard_labels = (train_shard_fnc_t)
+		lookup(g->vcm, prefix, "_train_shard_labels");
+	g->reduce = (reduce_fnc_t)
+		lookup(g->vcm, prefix, "_reduce");
+	g->update = (update_fnc_t)
+		lookup(g->vcm, prefix, "_update");
+	g->train_hogwild = (train_hogwild_fnc_t)
+		lookup(g->vcm, prefix, "_train_hogwild");
+	assert( g->version &&
+		g->memory_size &&
+		g->memory_hard &&
+		g->memory_context &&
+		g->memory_batch &&
+		g->memory_unit &&
+		g->input_unit &&
+		g->batch &&
+		g->schedule &&
+		g->initialize &&
+		g->activate &&
+		g->activate_into &&
+		g->activate_batch &&
+		g->activate_ctx &&
+		g->activate_layer &&
+		g->layer_size &&
+		g->export_ &&
+		g->import_ &&
+		g->train &&
+		g->train_labels &&
+		g->train_gather &&
+		g->train_shard &&
+		g->train_shard_labels &&
+		g->reduce &&
+		g->update &&
+		g->train_hogwild );
+	assert( G__VERSION == g->version() );
+	hand_pool(g->vcm, prefix, g->pool);
+
+	/* allocate ANN memory */
+
+	g->memory = model_alloc(g, g->memory_size());
+	if (!g->memory) {
+		G__DEBUG(0);
+		return -1;
+	}
+	if (initialize) {
+		g->initialize(g->memory);
+	}
+	return 0;
+}
+
+static void
+unlink_module(char *pathname)
+{
+	size_t n;
+
+	/* pathname ends in .c, the matching .h is next to it */
+
+	n = g__strlen(pathname);
+	g__unlink(pathname);
+	pathname[n - 1] = 'h';
+	g__unlink(pathname);
+	pathname[n - 1] = 'c';
+}
+
+static void
+warmup(g__vcm_t vcm, const struct g_options *options)
+{
+	memory_size_fnc_t memory_size;
+	memory_hard_fnc_t memory_hard;
+	memory_unit_fnc_t memory_unit;
+	activate_fnc_t activate;
+	train_fnc_t train;
+	void *memory;
+	int i;
+
+	memory_size = (memory_size_fnc_t)(long)
+		g__vcm_lookup(vcm, "_memory_size");
+	memory_hard = (memory_hard_fnc_t)(long)
+		g__vcm_lookup(vcm, "_memory_hard");
+	memory_unit = (memory_unit_fnc_t)(long)
+		g__vcm_lookup(vcm, "_memory_unit");
+	activate = (activate_fnc_t)(long)
+		g__vcm_lookup(vcm, "_activate");
+	train = (train_fnc_t)(long)
+		g__vcm_lookup(vcm, "_train");
+	assert( memory_size && memory_hard && memory_unit );
+	assert( activate && train );
+	memory = g__malloc(memory_size());
+	if (!memory) {
+		G__DEBUG(0);
+		return;
+	}
+
+	/* weights of a private generator, not initialize() and its rand() */
+
+	memset(memory, 0, memory_size());
+	g__tune_fill(memory,
+		     memory_hard() / memory_unit(),
+		     (sizeof (double) == memory_unit()) ?
+		     G__ANN_PRECISION_DOUBLE :
+		     G__ANN_PRECISION_FLOAT,
+		     0.01);
+	for (i=0; i<G__MAX(1, options->warmup_rounds); ++i) {
+		if (options->warmup_y) {
+			train(memory, options->warmup_x, options->warmup_y);
+		}
+		activate(memory, options->warmup_x);
+	}
+	G__FREE(memory);
+}
+
+static g__vcm_t
+build(const struct g_options *options, const char *pathname)
+{
+	g__vcm_t vcm;
+
+	if (G_PROFILE_NATIVE == options->profile) {
+		return g__vcm_open(pathname, G__VCM_LEVEL_NATIVE);
+	}
+	if ((G_PROFILE_PGO == options->profile) && options->warmup_x) {
+		vcm = g__vcm_open(pathname, G__VCM_LEVEL_PGO_GENERATE);
+		if (vcm) {
+			warmup(vcm, options);
+			g__vcm_close(vcm);
+			vcm = g__vcm_open(pathname, G__VCM_LEVEL_PGO_USE);
+			if (vcm) {
+				return vcm;
+			}
+		}
+		G__DEBUG(0); /* fall back to the portable profile */
+	}
+	return g__vcm_open(pathname, G__VCM_LEVEL_PORTABLE);
+}
+
+static int
+tune(const struct g *g,
+     const struct g__ann *ann,
+     const char *tmp,
+     const char *pathname,
+     uint64_t topology,
+     struct g__emitc_strategy *strategy)
+{
+	const char *tunedb;
+	uint64_t key;
+	char *s;
+	size_t n;
+	int level;
+
+	if (!g->options.autotune) {
+		return 0;
+	}
+	level = (G_PROFILE_NATIVE == g->options.profile) ?
+		G__VCM_LEVEL_NATIVE :
+		G__VCM_LEVEL_PORTABLE;
+	topology = g__tune_hash(topology,
+				(G__VCM_LEVEL_NATIVE == level) ?
+				"native" :
+				"portable");
+	key = g__tune_key(topology);
+	tunedb = g->options.tunedb ? g->options.tunedb : getenv("G_TUNEDB");
+	n = g__strlen(tmp) + 32;
+	s = g__malloc(n);
+	if (!s) {
+		G__DEBUG(0);
+		return -1;
+	}
+	g__sprintf(s, n, "%s/gravity.tune", tmp);
+	tunedb = g__strlen(tunedb) ? tunedb : s;
+	if (g__tune_load(tunedb, key, strategy)) {
+		if (g__tune_search(ann, tmp, pathname, level, strategy)) {
+			G__FREE(s);
+			G__DEBUG(0);
+			return -1;
+		}
+		g__tune_store(tunedb, key, strategy);
+	}
+	G__FREE(s);
+	return 0;
+}
+
+static g_t
+interpret(struct g *g, struct g__ann *ann)
+{
+	g->exec = g__exec_open(ann);
+	if (!g->exec) {
+		g_close(g);
+		G__DEBUG(0);
+		return 0;
+	}
+	g->memory = model_alloc(g, g__exec_memory_size(g->exec));
+	if (!g->memory) {
+		g_close(g);
+		G__DEBUG(0);
+		return 0;
+	}
+	g__exec_initialize(g->exec, g->memory);
+	return g;
+}
+
+static void *
+tier_up(void *arg)
+{
+	activate_batch_fnc_t activate_batch;
+	activate_layer_fnc_t activate_layer;
+	activate_ctx_fnc_t activate_ctx;
+	train_shard_fnc_t train_shard_labels;
+	train_shard_fnc_t train_shard;
+	train_gather_fnc_t train_gather;
+	activate_into_fnc_t activate_into;
+	activate_fnc_t activate;
+	reduce_fnc_t reduce;
+	train_hogwild_fnc_t train_hogwild;
+	update_fnc_t update;
+	train_fnc_t train_labels;
+	train_fnc_t train;
+	struct g *g;
+
+	g = (struct g *)arg;
+	g->tier.vcm = build(&g->options, g->tier.pathname);
+	unlink_module(g->tier.pathname);
+	if (!g->tier.vcm) {
+		G__DEBUG(0);
+		return 0;
+	}
+	activate = (activate_fnc_t)(long)
+		g__vcm_lookup(g->tier.vcm, "_activate");
+	activate_into = (activate_into_fnc_t)(long)
+		g__vcm_lookup(g->tier.vcm, "_activate_into");
+	activate_batch = (activate_batch_fnc_t)(long)
+		g__vcm_lookup(g->tier.vcm, "_activate_batch");
+	activate_ctx = (activate_ctx_fnc_t)(long)
+		g__vcm_lookup(g->tier.vcm, "_activate_ctx");
+	activate_layer = (activate_layer_fnc_t)(long)
+		g__vcm_lookup(g->tier.vcm, "_activate_layer");
+	train = (train_fnc_t)(long)
+		g__vcm_lookup(g->tier.vcm, "_train");
+	train_labels = (train_fnc_t)(long)
+		g__vcm_lookup(g->tier.vcm, "_train_labels");
+	train_gather = (train_gather_fnc_t)(long)
+		g__vcm_lookup(g->tier.vcm, "_train_gather");
+	train_shard = (train_shard_fnc_t)(long)
+		g__vcm_lookup(g->tier.vcm, "_train_shard");
+	train_shard_labels = (train_shard_fnc_t)(long)
+		g__vcm_lookup(g->tier.vcm, "_train_shard_labels");
+	reduce = (reduce_fnc_t)(long)
+		g__vcm_lookup(g->tier.vcm, "_reduce");
+	update = (update_fnc_t)(long)
+		g__vcm_lookup(g->tier.vcm, "_update");
+	train_hogwild = (train_hogwild_fnc_t)(long)
+		g__vcm_lookup(g->tier.vcm, "_train_hogwild");
+	assert( activate &&
+		activate_into &&
+		activate_batch &&
+		activate_ctx &&
+		activate_layer &&
+		train &&
+		train_labels &&
+		train_gather &&
+		train_shard &&
+		train_shard_labels &&
+		reduce &&
+		update &&
+		train_hogwild );
+	hand_pool(g->tier.vcm, g->prefix, g->pool);
+
+	/*
+	 * Both tiers share one memory layout, so callers may switch code
+	 * between (or even during) calls without any state migration.
+	 */
+
+	__atomic_store_n(&g->activate, activate, __ATOMIC_RELEASE);
+	__atomic_store_n(&g->activate_into, activate_into, __ATOMIC_RELEASE);
+	__atomic_store_n(&g->activate_batch, activate_batch, __ATOMIC_RELEASE);
+	__atomic_store_n(&g->activate_ctx, activate_ctx, __ATOMIC_RELEASE);
+	__atomic_store_n(&g->activate_layer, activate_layer, __ATOMIC_RELEASE);
+	__atomic_store_n(&g->train_shard, train_shard, __ATOMIC_RELEASE);
+	__atomic_store_n(&g->train_shard_labels,
+			 train_shard_labels,
+			 __ATOMIC_RELEASE);
+	__atomic_store_n(&g->reduce, reduce, __ATOMIC_RELEASE);
+	__atomic_store_n(&g->update, update, __ATOMIC_RELEASE);
+	__atomic_store_n(&g->train_hogwild, train_hogwild, __ATOMIC_RELEASE);
+	__atomic_store_n(&g->tier.done, 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&g->train_labels, train_labels, __ATOMIC_RELEASE);
+	__atomic_store_n(&g->train_gather, train_gather, __ATOMIC_RELEASE);
+	__atomic_store_n(&g->train, train, __ATOMIC_RELEASE);
+	return 0;
+}
+
 int
 g_version(void)
 {
@@ -102,36 +703,35 @@ g_version(void)
 void
 g_debug(int enabled)
 {
-	yyerroron = 0;
-	g__debug_enabled = 0;
-	if (enabled) {
-		yyerroron = 1;
-		g__debug_enabled = 1;
-	}
+	g__debug_enabled = enabled ? 1 : 0;
 }
 
-g_t
-g_open(const char *optimizer,
-       const char *precision,
-       const char *costfnc,
-       const char *batch,
-       const char *input,
-       const char *output,
-       /* hidden */ ...)
+static g_t
+open_(const struct g_options *options,
+      const char *optimizer,
+      const char *precision,
+      const char *costfnc,
+      const char *batch,
+      const char *input,
+      const char *output,
+      va_list va)
 {
 	const char *tmp, module[256], *layers[1+MAX_LAYERS];
-	const struct g__ir *ir;
+	struct g__emitc_strategy strategy;
 	struct g__ann *ann;
+	uint64_t topology;
+	static unsigned sequence;
+	unsigned tag;
+	long cores;
+	int i;
 	struct g *g;
-	va_list va;
-	int tag, i;
 	size_t n;
 	char *s;
 
 	/* check arguments */
 
 	i = 0;
-	tag = rand();
+	tag = __atomic_add_fetch(&sequence, 1, __ATOMIC_RELAXED);
 	memset(layers, 0, sizeof (layers));
 	if (!g__strlen(optimizer) ||
 	    !g__strlen(precision) ||
@@ -142,21 +742,27 @@ g_open(const char *optimizer,
 		G__DEBUG(G__ERR_ARGUMENT);
 		return 0;
 	}
-	va_start(va, output);
 	do {
 		layers[i] = va_arg(va, const char *);
 		if (MAX_LAYERS <= i) {
-			va_end(va);
 			G__DEBUG(G__ERR_ARGUMENT);
 			return 0;
 		}
 	}
 	while (layers[i++]);
-	va_end(va);
 	if (!layers[0]) {
 		G__DEBUG(G__ERR_ARGUMENT);
 		return 0;
 	}
+	topology = g__tune_hash(G__TUNE_SEED, optimizer);
+	topology = g__tune_hash(topology, precision);
+	topology = g__tune_hash(topology, costfnc);
+	topology = g__tune_hash(topology, batch);
+	topology = g__tune_hash(topology, input);
+	topology = g__tune_hash(topology, output);
+	for (i=0; layers[i]; ++i) {
+		topology = g__tune_hash(topology, layers[i]);
+	}
 
 	/* initialize */
 
@@ -167,52 +773,75 @@ g_open(const char *optimizer,
 	}
 	memset(g, 0, sizeof (struct g));
 	g->sig = SIG;
+	pthread_mutex_init(&g->team.mutex, 0);
+	if (options) {
+		g->options = (*options);
+	}
 
 	/* populate */
 
-	tmp = getenv("TMPDIR");
-	tmp = tmp ? tmp : getenv("TMP");
-	tmp = tmp ? tmp : getenv("TEMP");
-	tmp = tmp ? tmp : ".";
-	n = g__strlen(tmp) + 32;
+	tmp = tmpdir();
+	n = g__strlen(tmp) + 48;
 	s = g__malloc(n);
 	if (!s) {
 		g_close(g);
 		G__DEBUG(0);
 		return 0;
 	}
-	g__sprintf(s, n, "%s/_%x_.g", tmp, tag);
-	g__sprintf((char *)module, sizeof (module), ".module \"_%x_\"", tag);
-	if (populate(s,
-		     module,
-		     ".prefix \"\"",
-		     optimizer,
-		     precision,
-		     costfnc,
-		     batch,
-		     input,
-		     output,
-		     layers)) {
+
+	/*
+	 * pid and a process wide sequence keep concurrent opens (threads or
+	 * processes sharing TMPDIR) apart
+	 */
+
+	g__sprintf(s, n, "%s/_%x_%x_.g", tmp, (unsigned)getpid(), tag);
+	g__sprintf((char *)module,
+		   sizeof (module),
+		   ".module \"_%x_%x_\"",
+		   (unsigned)getpid(),
+		   tag);
+
+	/* g compile */
+
+	ann = front(s,
+		    module,
+		    ".prefix \"\"",
+		    optimizer,
+		    precision,
+		    costfnc,
+		    batch,
+		    input,
+		    output,
+		    layers);
+	if (!ann) {
 		g_close(g);
 		G__FREE(s);
 		G__DEBUG(0);
 		return 0;
 	}
-
-	/* g compile */
-
-	ir = g__ir_parse(s);
-	g__unlink(s);
-	if (!ir) {
+	if (g->options.interpret) {
+		G__FREE(s);
+		return interpret(g, ann);
+	}
+	memset(&strategy, 0, sizeof (strategy));
+	g__sprintf(s, n, "%s/_%x_%x_.c", tmp, (unsigned)getpid(), tag);
+	cores = sysconf(_SC_NPROCESSORS_ONLN);
+	g->options.threads = (int)G__MIN(g->options.threads, G__MAX(1, cores));
+	if (1 < g->options.threads) {
+		g->pool = g__pool_open(g->options.threads);
+	}
+	if (tune(g, ann, tmp, s, topology, &strategy)) {
+		g__ann_close(ann);
+		unlink_module(s);
 		g_close(g);
 		G__FREE(s);
 		G__DEBUG(0);
 		return 0;
 	}
-	ann = g__ann_open(ir);
-	g__ir_destroy();
-	if (!ann || g__emitc(ann, tmp)) {
+	strategy.threads = g->pool ? g->options.threads : 0;
+	if (g__emitc(ann, tmp, &strategy)) {
 		g__ann_close(ann);
+		unlink_module(s);
 		g_close(g);
 		G__FREE(s);
 		G__DEBUG(0);
@@ -222,71 +851,371 @@ g_open(const char *optimizer,
 
 	/* c compile */
 
-	g__sprintf(s, n, "%s/_%x_.c", tmp, tag);
-	g->vcm = g__vcm_open(s);
-	g__unlink(s);
-	g__sprintf(s, n, "%s/_%x_.h", tmp, tag);
-	g__unlink(s);
-	G__FREE(s);
-	if (!g->vcm) {
+	if (g->options.tiered) {
+		g->vcm = g__vcm_open(s, G__VCM_LEVEL_FAST);
+		g->tier.pathname = s;
+		s = 0;
+	}
+	else {
+		g->vcm = build(&g->options, s);
+		unlink_module(s);
+		G__FREE(s);
+	}
+	if (!g->vcm || connect(g, "", 1)) {
 		g_close(g);
 		G__DEBUG(0);
 		return 0;
 	}
 
-	/* jit connect */
-
-	g->version = (version_fnc_t)(long)
-		g__vcm_lookup(g->vcm, "_version");
-	g->memory_size = (memory_size_fnc_t)(long)
-		g__vcm_lookup(g->vcm, "_memory_size");
-	g->memory_hard = (memory_hard_fnc_t)(long)
-		g__vcm_lookup(g->vcm, "_memory_hard");
-	g->initialize = (initialize_fnc_t)(long)
-		g__vcm_lookup(g->vcm, "_initialize");
-	g->activate = (activate_fnc_t)(long)
-		g__vcm_lookup(g->vcm, "_activate");
-	g->train = (train_fnc_t)(long)
-		g__vcm_lookup(g->vcm, "_train");
-	assert( g->version &&
-		g->memory_size &&
-		g->memory_hard &&
-		g->initialize &&
-		g->activate &&
-		g->train );
-	assert( G__VERSION == g->version() );
-
-	/* allocate ANN memory */
+	/* background build, hot-swapped in once ready */
 
-	g->memory = g__malloc(g->memory_size());
-	if (!g->memory) {
-		g_close(g);
-		G__DEBUG(0);
-		return 0;
+	if (g->tier.pathname) {
+		if (pthread_create(&g->tier.thread, 0, tier_up, g)) {
+			G__DEBUG(G__ERR_SYSTEM);
+			unlink_module(g->tier.pathname);
+		}
+		else {
+			g->tier.running = 1;
+		}
 	}
-	memset(g->memory, 0, g->memory_size());
-	g->initialize(g->memory);
 	return g;
 }
 
-void
-g_close(g_t g)
+g_t
+g_open(const char *optimizer,
+       const char *precision,
+       const char *costfnc,
+       const char *batch,
+       const char *input,
+       const char *output,
+       /* hidden */ ...)
 {
-	if (g && (SIG == g->sig)) {
-		g__vcm_close(g->vcm);
-		G__FREE(g->memory);
-		memset(g, 0, sizeof (struct g));
-		G__FREE(g);
-	}
-}
+	va_list va;
+	g_t g;
 
-size_t
-g_memory_size(g_t g)
+	va_start(va, output);
+	g = open_(0, optimizer, precision, costfnc, batch, input, output, va);
+	va_end(va);
+	return g;
+}
+
+g_t
+g_open_ex(const struct g_options *options,
+	  const char *optimizer,
+	  const char *precision,
+	  const char *costfnc,
+	  const char *batch,
+	  const char *input,
+	  const char *output,
+	  /* hidden */ ...)
+{
+	va_list va;
+	g_t g;
+
+	va_start(va, output);
+	g = open_(options,
+		  optimizer,
+		  precision,
+		  costfnc,
+		  batch,
+		  input,
+		  output,
+		  va);
+	va_end(va);
+	return g;
+}
+
+struct shard {
+	const struct g_spec *specs;
+	g_t *g;
+	int first;
+	int n;
+	int error;
+	pthread_t thread;
+};
+
+static void *
+shard(void *arg)
+{
+	const char *tmp, *layers[1+MAX_LAYERS];
+	char module[64], prefix[64];
+	const struct g_spec *spec;
+	static unsigned sequence;
+	struct g__ann **ann;
+	struct shard *job;
+	g__vcm_t vcm;
+	unsigned tag;
+	size_t n;
+	char *s;
+	int i, j;
+
+	job = (struct shard *)arg;
+	job->error = -1;
+	tag = __atomic_add_fetch(&sequence, 1, __ATOMIC_RELAXED);
+	tmp = tmpdir();
+	n = g__strlen(tmp) + 48;
+	s = g__malloc(n);
+	ann = g__malloc(job->n * sizeof (ann[0]));
+	if (!s || !ann) {
+		G__FREE(s);
+		G__FREE(ann);
+		G__DEBUG(0);
+		return 0;
+	}
+	memset(ann, 0, job->n * sizeof (ann[0]));
+
+	/* g compile, one module for the shard, one prefix per model */
+
+	g__sprintf(s, n, "%s/_%x_m%x_.g", tmp, (unsigned)getpid(), tag);
+	g__sprintf(module,
+		   sizeof (module),
+		   ".module \"_%x_m%x_\"",
+		   (unsigned)getpid(),
+		   tag);
+	for (i=0; i<job->n; ++i) {
+		spec = &job->specs[job->first + i];
+		memset(layers, 0, sizeof (layers));
+		for (j=0; spec->hidden && spec->hidden[j]; ++j) {
+			if (MAX_LAYERS <= j) {
+				break;
+			}
+			layers[j] = spec->hidden[j];
+		}
+		if (!layers[0] || (MAX_LAYERS <= j) ||
+		    !g__strlen(spec->optimizer) ||
+		    !g__strlen(spec->precision) ||
+		    !g__strlen(spec->costfnc) ||
+		    !g__strlen(spec->batch) ||
+		    !g__strlen(spec->input) ||
+		    !g__strlen(spec->output)) {
+			G__DEBUG(G__ERR_ARGUMENT);
+			break;
+		}
+		g__sprintf(prefix,
+			   sizeof (prefix),
+			   ".prefix \"m%d\"",
+			   job->first + i);
+		ann[i] = front(s,
+			       module,
+			       prefix,
+			       spec->optimizer,
+			       spec->precision,
+			       spec->costfnc,
+			       spec->batch,
+			       spec->input,
+			       spec->output,
+			       layers);
+		if (!ann[i]) {
+			G__DEBUG(0);
+			break;
+		}
+	}
+	g__sprintf(s, n, "%s/_%x_m%x_.c", tmp, (unsigned)getpid(), tag);
+	vcm = 0;
+	if ((i == job->n) &&
+	    !g__emitc_many((const struct g__ann *const *)ann, i, tmp, 0)) {
+
+		/* c compile */
+
+		vcm = g__vcm_open(s, G__VCM_LEVEL_PORTABLE);
+	}
+	unlink_module(s);
+	for (i=0; i<job->n; ++i) {
+		g__ann_close(ann[i]);
+	}
+	G__FREE(ann);
+	G__FREE(s);
+	if (!vcm) {
+		G__DEBUG(0);
+		return 0;
+	}
+
+	/* handles */
+
+	for (i=0; i<job->n; ++i) {
+		struct g *g;
+
+		g = g__malloc(sizeof (struct g));
+		if (!g) {
+			break;
+		}
+		memset(g, 0, sizeof (struct g));
+		g->sig = SIG;
+		pthread_mutex_init(&g->team.mutex, 0);
+		g->vcm = g__vcm_retain(vcm);
+		job->g[job->first + i] = g;
+		g__sprintf(prefix, sizeof (prefix), "m%d", job->first + i);
+		if (connect(g, prefix, 1)) {
+			break;
+		}
+	}
+	g__vcm_close(vcm);
+	if (i < job->n) {
+		G__DEBUG(0);
+		return 0;
+	}
+	job->error = 0;
+	return 0;
+}
+
+int
+g_open_many(const struct g_spec *specs, int n, g_t *g)
+{
+	struct shard *shards;
+	long cores;
+	int i, k, m, e;
+
+	if (!specs || (0 >= n) || !g) {
+		G__DEBUG(G__ERR_ARGUMENT);
+		return -1;
+	}
+	memset(g, 0, n * sizeof (g[0]));
+	cores = sysconf(_SC_NPROCESSORS_ONLN);
+	k = (int)G__MIN(n, G__MAX(1, cores));
+	shards = g__malloc(k * sizeof (shards[0]));
+	if (!shards) {
+		G__DEBUG(0);
+		return -1;
+	}
+	memset(shards, 0, k * sizeof (shards[0]));
+
+	/*
+	 * Contiguous shards of (nearly) equal size, each compiled once by its
+	 * own thread, the first in the calling thread.
+	 */
+
+	for (i=0; i<k; ++i) {
+		shards[i].specs = specs;
+		shards[i].g = g;
+		shards[i].first = (int)((long)n * i / k);
+		shards[i].n = (int)((long)n * (i + 1) / k) - shards[i].first;
+		shards[i].error = -1;
+	}
+	for (m=1; m<k; ++m) {
+		if (pthread_create(&shards[m].thread, 0, shard, &shards[m])) {
+			G__DEBUG(G__ERR_SYSTEM);
+			break;
+		}
+	}
+	shard(&shards[0]);
+	for (i=1; i<m; ++i) {
+		pthread_join(shards[i].thread, 0);
+	}
+	for (e=0, i=0; i<k; ++i) {
+		e |= shards[i].error;
+	}
+	G__FREE(shards);
+	if (e) {
+		for (i=0; i<n; ++i) {
+			g_close(g[i]);
+			g[i] = 0;
+		}
+		G__DEBUG(0);
+		return -1;
+	}
+	return 0;
+}
+
+g_t
+g_clone(g_t g_, int copy)
+{
+	g__vcm_t vcm;
+	struct g *g;
+
+	if (!g_ || (SIG != g_->sig)) {
+		G__DEBUG(G__ERR_ARGUMENT);
+		return 0;
+	}
+	g = g__malloc(sizeof (struct g));
+	if (!g) {
+		G__DEBUG(0);
+		return 0;
+	}
+	memset(g, 0, sizeof (struct g));
+	g->sig = SIG;
+	pthread_mutex_init(&g->team.mutex, 0);
+	g->options = g_->options;
+	g->options.tiered = 0;
+	g->pool = g_->pool ? g__pool_retain(g_->pool) : 0;
+
+	/* same code, the best tier available right now */
+
+	if (g_->exec) {
+		g->exec = g__exec_retain(g_->exec);
+		g->memory = model_alloc(g, g__exec_memory_size(g->exec));
+		if (!g->memory) {
+			g_close(g);
+			G__DEBUG(0);
+			return 0;
+		}
+		if (!copy) {
+			g__exec_initialize(g->exec, g->memory);
+		}
+	}
+	else {
+		vcm = __atomic_load_n(&g_->tier.done, __ATOMIC_ACQUIRE) ?
+			g_->tier.vcm :
+			g_->vcm;
+		g->vcm = g__vcm_retain(vcm);
+		if (connect(g, g_->prefix, !copy)) {
+			g_close(g);
+			G__DEBUG(0);
+			return 0;
+		}
+	}
+	if (copy) {
+		memcpy(g->memory, g_->memory, g_memory_size(g));
+	}
+	return g;
+}
+
+void
+g_close(g_t g)
+{
+	size_t n, size;
+
+	if (g && (SIG == g->sig)) {
+		if (g->tier.running) {
+			pthread_join(g->tier.thread, 0);
+		}
+		else if (g->tier.pathname) {
+			unlink_module(g->tier.pathname);
+		}
+
+		/* a model memory exists only once its size can be told */
+
+		n = g->memory ? g_memory_size(g) : 0;
+		size = n ? (n - g_memory_hard(g) + 63) / 64 * 64 : 0;
+		if (g->scratch) {
+			g__memory_free(g->scratch, g->memory_batch(), 0);
+		}
+		g__memory_free(g->slices, SLICES * size, 0);
+		g__memory_free(g->stale.grads, 2 * size, 0);
+		model_free(g, g->stale.memory, n);
+		model_free(g, g->memory, n);
+		G__FREE(g->tier.pathname);
+		g__vcm_close(g->tier.vcm);
+		g__vcm_close(g->vcm);
+		g__exec_close(g->exec);
+		g__pool_close(g->pool);
+		g__pool_close(g->team.pool);
+		pthread_mutex_destroy(&g->team.mutex);
+		G__FREE(g->stale.samples);
+		memset(g, 0, sizeof (struct g));
+		G__FREE(g);
+	}
+}
+
+size_t
+g_memory_size(g_t g)
 {
 	if (!g || (SIG != g->sig)) {
 		G__DEBUG(G__ERR_ARGUMENT);
 		return 0;
 	}
+	if (g->exec) {
+		return g__exec_memory_size(g->exec);
+	}
 	return g->memory_size();
 }
 
@@ -297,9 +1226,66 @@ g_memory_hard(g_t g)
 		G__DEBUG(G__ERR_ARGUMENT);
 		return 0;
 	}
+	if (g->exec) {
+		return g__exec_memory_hard(g->exec);
+	}
 	return g->memory_hard();
 }
 
+size_t
+g_export_size(g_t g)
+{
+	size_t size, n, m;
+	int l;
+
+	if (!g || (SIG != g->sig)) {
+		G__DEBUG(G__ERR_ARGUMENT);
+		return 0;
+	}
+	size = 0;
+	m = g->exec ? g__exec_layer_size(g->exec, 0) : g->layer_size(0);
+	for (l=1; ; ++l, m=n) {
+		n = g->exec ? g__exec_layer_size(g->exec, l) : g->layer_size(l);
+		if (!n) {
+			break;
+		}
+		size += n * m + n;
+	}
+	return size * (g->exec ?
+		       g__exec_memory_unit(g->exec) :
+		       g->memory_unit());
+}
+
+int
+g_export(g_t g, void *x)
+{
+	if (!g || (SIG != g->sig) || !x) {
+		G__DEBUG(G__ERR_ARGUMENT);
+		return -1;
+	}
+	if (g->exec) {
+		g__exec_export(g->exec, g->memory, x);
+		return 0;
+	}
+	g->export_(g->memory, x);
+	return 0;
+}
+
+int
+g_import(g_t g, const void *x)
+{
+	if (!g || (SIG != g->sig) || !x) {
+		G__DEBUG(G__ERR_ARGUMENT);
+		return -1;
+	}
+	if (g->exec) {
+		g__exec_import(g->exec, g->memory, x);
+		return 0;
+	}
+	g->import_(g->memory, x);
+	return 0;
+}
+
 void *
 g_activate(g_t g, const void *x)
 {
@@ -307,7 +1293,242 @@ g_activate(g_t g, const void *x)
 		G__DEBUG(G__ERR_ARGUMENT);
 		return 0;
 	}
-	return g->activate(g->memory, x);
+	if (g->exec) {
+		return g__exec_activate(g->exec, g->memory, x);
+	}
+	return __atomic_load_n(&g->activate, __ATOMIC_ACQUIRE)(g->memory, x);
+}
+
+int
+g_activate_into(g_t g, const void *x, void *y)
+{
+	activate_into_fnc_t activate_into;
+
+	if (!g || (SIG != g->sig) || !x || !y) {
+		G__DEBUG(G__ERR_ARGUMENT);
+		return -1;
+	}
+	if (g->exec) {
+		g__exec_activate_into(g->exec, g->memory, x, y);
+		return 0;
+	}
+	activate_into = __atomic_load_n(&g->activate_into, __ATOMIC_ACQUIRE);
+	activate_into(g->memory, x, y);
+	return 0;
+}
+
+int
+g_activate_batch(g_t g, const void *x, size_t n, void *y)
+{
+	activate_batch_fnc_t activate_batch;
+
+	if (!g || (SIG != g->sig) || !x || !y) {
+		G__DEBUG(G__ERR_ARGUMENT);
+		return -1;
+	}
+	if (g->exec) {
+		g__exec_activate_batch(g->exec, g->memory, x, n, y);
+		return 0;
+	}
+	if (!g->scratch) {
+		g->scratch = g__memory_alloc(g->memory_batch(), 0);
+		if (!g->scratch) {
+			G__DEBUG(0);
+			return -1;
+		}
+	}
+	activate_batch = __atomic_load_n(&g->activate_batch, __ATOMIC_ACQUIRE);
+	activate_batch(g->memory, g->scratch, x, n, y);
+	return 0;
+}
+
+/*
+ * .schedule stale: the gradients of batch k are computed on the weights in
+ * memory while a second thread of the team writes them with those of batch
+ * k - 1 applied into stale.memory, the two buffers trading places once both
+ * are done.
+ * Every update lands one batch late, in exchange the update pass no longer
+ * holds up the next batch.
+ */
+
+static size_t
+layer_size(const struct g *g, int l)
+{
+	if (g->exec) {
+		return g__exec_layer_size(g->exec, l);
+	}
+	return g->layer_size(l);
+}
+
+/* units of the output layer */
+
+static size_t
+outputs(const struct g *g)
+{
+	int l;
+
+	for (l=1; layer_size(g, l + 1); ++l);
+	return layer_size(g, l);
+}
+
+/* bytes of the x and of the y of one sample, as g_train() takes them */
+
+static size_t
+sample_x(const struct g *g)
+{
+	return layer_size(g, 0) * (g->exec ?
+				   g__exec_input_unit(g->exec) :
+				   g->input_unit());
+}
+
+static size_t
+sample_y(const struct g *g)
+{
+	return outputs(g) * (g->exec ?
+			     g__exec_memory_unit(g->exec) :
+			     g->memory_unit());
+}
+
+static void
+team_run(struct g *g, int n, g__pool_fnc_t fnc, void *arg)
+{
+	g__pool_t pool;
+
+	/*
+	 * n threads of a pool kept until n changes, the caller alone if n
+	 * is 1, no pool can be had or it is busy (fnc then sees n = 1). A
+	 * run holds a reference, so reopening leaves a running pool be.
+	 */
+
+	pool = 0;
+	if (1 < n) {
+		pthread_mutex_lock(&g->team.mutex);
+		if (n != g->team.n) {
+			g__pool_close(g->team.pool);
+			g->team.pool = g__pool_open(n);
+			g->team.n = g->team.pool ? n : 0;
+		}
+		pool = g->team.pool ? g__pool_retain(g->team.pool) : 0;
+		pthread_mutex_unlock(&g->team.mutex);
+	}
+	if (pool) {
+		g__pool_run(pool, fnc, arg);
+		g__pool_close(pool);
+		return;
+	}
+	fnc(arg, 0, 1);
+}
+
+struct late {
+	struct g *g;
+	train_shard_fnc_t train_shard;
+	update_fnc_t update;
+	const void *x;
+	const void *y;
+	char *p; /* gradients of this batch */
+	const void *q; /* gradients of the last batch */
+	int labels;
+	int batch;
+	int pending; /* q still to be applied */
+};
+
+static void
+late(void *arg, int id, int n)
+{
+	struct late *late;
+	struct g *g;
+
+	/*
+	 * Thread 0 trains this batch on memory, thread 1 (0 if alone) writes
+	 * memory with the last batch's gradients applied into stale.memory;
+	 * both only read memory.
+	 */
+
+	late = (struct late *)arg;
+	g = late->g;
+	if (!id && g->exec) {
+		(late->labels ?
+		 g__exec_train_shard_labels :
+		 g__exec_train_shard)(g->exec,
+				      g->memory,
+				      late->p,
+				      late->x,
+				      late->y,
+				      0,
+				      late->batch);
+	}
+	else if (!id) {
+		late->train_shard(g->memory,
+				  late->p,
+				  late->x,
+				  late->y,
+				  0,
+				  late->batch);
+	}
+	if (((1 == id) || (1 == n)) && late->pending && g->exec) {
+		g__exec_update(g->exec,
+			       g->stale.memory,
+			       g->memory,
+			       late->q,
+			       late->batch);
+	}
+	else if (((1 == id) || (1 == n)) && late->pending) {
+		late->update(g->stale.memory, g->memory, late->q, late->batch);
+	}
+}
+
+/* y a batch of targets, or with labels of class indices */
+
+static int
+train_stale(struct g *g, const void *x, const void *y, int labels)
+{
+	struct late late_;
+	size_t size;
+	void *memory;
+
+	size = g_memory_size(g) - g_memory_hard(g);
+	size = (size + 63) / 64 * 64;
+	if (!g->stale.memory) {
+
+		/*
+		 * Swapped with memory, so placed the same way. Updates only
+		 * write the weights, whatever else is hard is copied once.
+		 */
+
+		g->stale.memory = model_alloc(g, g_memory_size(g));
+		g->stale.grads = g__memory_alloc(2 * size, 0);
+		if (!g->stale.memory || !g->stale.grads) {
+			model_free(g, g->stale.memory, g_memory_size(g));
+			g__memory_free(g->stale.grads, 2 * size, 0);
+			g->stale.memory = 0;
+			g->stale.grads = 0;
+			G__DEBUG(0);
+			return -1;
+		}
+		memcpy(g->stale.memory, g->memory, g_memory_hard(g));
+	}
+	memset(&late_, 0, sizeof (late_));
+	late_.g = g;
+	late_.train_shard = labels ?
+		__atomic_load_n(&g->train_shard_labels, __ATOMIC_ACQUIRE) :
+		__atomic_load_n(&g->train_shard, __ATOMIC_ACQUIRE);
+	late_.update = __atomic_load_n(&g->update, __ATOMIC_ACQUIRE);
+	late_.x = x;
+	late_.y = y;
+	late_.p = g->stale.grads + g->stale.k * size;
+	late_.q = g->stale.grads + (1 - g->stale.k) * size;
+	late_.labels = labels;
+	late_.batch = g->exec ? g__exec_batch(g->exec) : g->batch();
+	late_.pending = g->stale.pending;
+	team_run(g, late_.pending ? 2 : 1, late, &late_);
+	if (g->stale.pending) {
+		memory = g->memory;
+		g->memory = g->stale.memory;
+		g->stale.memory = memory;
+	}
+	g->stale.pending = 1;
+	g->stale.k = 1 - g->stale.k;
+	return 0;
 }
 
 int
@@ -317,6 +1538,1336 @@ g_train(g_t g, const void *x, const void *y)
 		G__DEBUG(G__ERR_ARGUMENT);
 		return -1;
 	}
-	g->train(g->memory, x, y);
+	if (G__ANN_SCHEDULE_STALE == (g->exec ?
+				      g__exec_schedule(g->exec) :
+				      g->schedule())) {
+		if (train_stale(g, x, y, 0)) {
+			G__DEBUG(0);
+			return -1;
+		}
+		return 0;
+	}
+	if (g->exec) {
+		g__exec_train(g->exec, g->memory, x, y);
+		return 0;
+	}
+	__atomic_load_n(&g->train, __ATOMIC_ACQUIRE)(g->memory, x, y);
 	return 0;
 }
+
+int
+g_train_labels(g_t g, const void *x, const int32_t *labels)
+{
+	size_t n;
+	int batch, i;
+
+	if (!g || (SIG != g->sig) || !x || !labels) {
+		G__DEBUG(G__ERR_ARGUMENT);
+		return -1;
+	}
+	n = outputs(g);
+	batch = g->exec ? g__exec_batch(g->exec) : g->batch();
+	for (i=0; i<batch; ++i) {
+		if ((0 > labels[i]) || (n <= (size_t)labels[i])) {
+			G__DEBUG(G__ERR_ARGUMENT);
+			return -1;
+		}
+	}
+	if (G__ANN_SCHEDULE_STALE == (g->exec ?
+				      g__exec_schedule(g->exec) :
+				      g->schedule())) {
+		if (train_stale(g, x, labels, 1)) {
+			G__DEBUG(0);
+			return -1;
+		}
+		return 0;
+	}
+	if (g->exec) {
+		g__exec_train_labels(g->exec, g->memory, x, labels);
+		return 0;
+	}
+	__atomic_load_n(&g->train_labels, __ATOMIC_ACQUIRE)(g->memory,
+							   x,
+							   labels);
+	return 0;
+}
+
+/*
+ * One step over the batch whose sample i is at index[i] (i if index is
+ * null) times the byte strides xs and ys of x and y. With .schedule stale
+ * the samples are gathered into one batch for train_stale.
+ */
+
+static int
+train_gather(struct g *g,
+	     const void *x,
+	     const void *y,
+	     const uint32_t *index,
+	     size_t xs,
+	     size_t ys)
+{
+	size_t a, b, k;
+	int batch, i;
+
+	if (G__ANN_SCHEDULE_STALE == (g->exec ?
+				      g__exec_schedule(g->exec) :
+				      g->schedule())) {
+		batch = g->exec ? g__exec_batch(g->exec) : g->batch();
+		a = sample_x(g);
+		b = sample_y(g);
+		if (!g->stale.samples &&
+		    !(g->stale.samples = g__malloc(batch * (a + b)))) {
+			G__DEBUG(0);
+			return -1;
+		}
+		for (i=0; i<batch; ++i) {
+			k = index ? index[i] : (size_t)i;
+			memcpy(g->stale.samples + i * a,
+			       (const char *)x + k * xs,
+			       a);
+			memcpy(g->stale.samples + batch * a + i * b,
+			       (const char *)y + k * ys,
+			       b);
+		}
+		if (train_stale(g,
+				g->stale.samples,
+				g->stale.samples + batch * a,
+				0)) {
+			G__DEBUG(0);
+			return -1;
+		}
+		return 0;
+	}
+	if (g->exec) {
+		g__exec_train_gather(g->exec, g->memory, x, y, index, xs, ys);
+		return 0;
+	}
+	__atomic_load_n(&g->train_gather, __ATOMIC_ACQUIRE)(g->memory,
+							   x,
+							   y,
+							   index,
+							   xs,
+							   ys);
+	return 0;
+}
+
+int
+g_train_gather(g_t g,
+	       const void *x,
+	       const void *y,
+	       const uint32_t *indices,
+	       size_t k)
+{
+	size_t i;
+	int batch;
+
+	if (!g || (SIG != g->sig) || !x || !y || !indices) {
+		G__DEBUG(G__ERR_ARGUMENT);
+		return -1;
+	}
+	batch = g->exec ? g__exec_batch(g->exec) : g->batch();
+	if (!k || (k % batch)) {
+		G__DEBUG(G__ERR_ARGUMENT);
+		return -1;
+	}
+	for (i=0; i<k; i+=batch) {
+		if (train_gather(g,
+				 x,
+				 y,
+				 indices + i,
+				 sample_x(g),
+				 sample_y(g))) {
+			G__DEBUG(0);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int
+g_train_strided(g_t g,
+		const void *x,
+		size_t x_stride,
+		const void *y,
+		size_t y_stride)
+{
+	if (!g || (SIG != g->sig) || !x || !y) {
+		G__DEBUG(G__ERR_ARGUMENT);
+		return -1;
+	}
+	if (train_gather(g, x, y, 0, x_stride, y_stride)) {
+		G__DEBUG(0);
+		return -1;
+	}
+	return 0;
+}
+
+struct lane {
+	struct g *g;
+	train_shard_fnc_t train_shard;
+	reduce_fnc_t reduce;
+	train_hogwild_fnc_t train_hogwild;
+	const void *x;
+	const void *y;
+	size_t n;
+	size_t size; /* of a slice */
+	int k; /* slices */
+	int id;
+	int m; /* lanes */
+	int phase; /* 0: shards, 1: reduce, 2: hogwild */
+};
+
+static void
+lane(struct lane *lane)
+{
+	size_t lo, hi;
+	char *p;
+	int i, s;
+
+	p = lane->g->slices;
+	if (2 == lane->phase) {
+
+		/* the lane's own samples, one update per batch, no locks */
+
+		lo = lane->n * lane->id / lane->m;
+		hi = lane->n * (lane->id + 1) / lane->m;
+		if (lane->g->exec) {
+			g__exec_train_hogwild(lane->g->exec,
+					      lane->g->memory,
+					      p + lane->id * lane->size,
+					      lane->x,
+					      lane->y,
+					      lo,
+					      hi);
+		}
+		else {
+			lane->train_hogwild(lane->g->memory,
+					    p + lane->id * lane->size,
+					    lane->x,
+					    lane->y,
+					    lo,
+					    hi);
+		}
+		return;
+	}
+	if (!lane->phase) {
+
+		/* slice i is samples [n * i / k, n * (i + 1) / k) */
+
+		for (i=lane->id; i<lane->k; i+=lane->m) {
+			lo = lane->n * i / lane->k;
+			hi = lane->n * (i + 1) / lane->k;
+			if (lane->g->exec) {
+				g__exec_train_shard(lane->g->exec,
+						    lane->g->memory,
+						    p + i * lane->size,
+						    lane->x,
+						    lane->y,
+						    lo,
+						    hi);
+			}
+			else {
+				lane->train_shard(lane->g->memory,
+						  p + i * lane->size,
+						  lane->x,
+						  lane->y,
+						  lo,
+						  hi);
+			}
+		}
+		return;
+	}
+
+	/*
+	 * Pairwise tree, the same for any number of lanes, each lane takes
+	 * its part of the gradients through all levels.
+	 */
+
+	for (s=1; s<lane->k; s*=2) {
+		for (i=0; (i + s)<lane->k; i+=2*s) {
+			if (lane->g->exec) {
+				g__exec_reduce(lane->g->exec,
+					       p + i * lane->size,
+					       p + (i + s) * lane->size,
+					       lane->id,
+					       lane->m);
+			}
+			else {
+				lane->reduce(p + i * lane->size,
+					     p + (i + s) * lane->size,
+					     lane->id,
+					     lane->m);
+			}
+		}
+	}
+}
+
+static void
+run_lanes(void *arg, int id, int n)
+{
+	struct lane *lanes_;
+	int i;
+
+	lanes_ = (struct lane *)arg;
+	for (i=id; i<lanes_[0].m; i+=n) {
+		lane(&lanes_[i]);
+	}
+}
+
+/*
+ * Counters waited on across threads: a waiter polls briefly, then sleeps
+ * until a store of a counter wakes it, the protocol of g_pool.c.
+ */
+
+struct monitor {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int sleepers;
+};
+
+static void
+monitor_open(struct monitor *monitor)
+{
+	memset(monitor, 0, sizeof (struct monitor));
+	pthread_mutex_init(&monitor->mutex, 0);
+	pthread_cond_init(&monitor->cond, 0);
+}
+
+static void
+monitor_close(struct monitor *monitor)
+{
+	pthread_cond_destroy(&monitor->cond);
+	pthread_mutex_destroy(&monitor->mutex);
+}
+
+static int
+reached(const size_t *count, size_t k, const int *stop)
+{
+	return (__atomic_load_n(count, __ATOMIC_SEQ_CST) >= k) ||
+		(stop && __atomic_load_n(stop, __ATOMIC_SEQ_CST));
+}
+
+static int
+monitor_wait(struct monitor *monitor,
+	     const size_t *count,
+	     size_t k,
+	     const int *stop)
+{
+	int i;
+
+	/* 0 once count reaches k, -1 if stop is set first */
+
+	for (i=0; (i<SPIN) && !reached(count, k, stop); ++i) {
+	}
+	if (SPIN == i) {
+		pthread_mutex_lock(&monitor->mutex);
+		__atomic_add_fetch(&monitor->sleepers, 1, __ATOMIC_SEQ_CST);
+		while (!reached(count, k, stop)) {
+			pthread_cond_wait(&monitor->cond, &monitor->mutex);
+		}
+		__atomic_sub_fetch(&monitor->sleepers, 1, __ATOMIC_SEQ_CST);
+		pthread_mutex_unlock(&monitor->mutex);
+	}
+	return (__atomic_load_n(count, __ATOMIC_SEQ_CST) >= k) ? 0 : -1;
+}
+
+static void
+monitor_store(struct monitor *monitor, size_t *count, size_t k)
+{
+	__atomic_store_n(count, k, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&monitor->sleepers, __ATOMIC_SEQ_CST)) {
+		pthread_mutex_lock(&monitor->mutex);
+		pthread_cond_broadcast(&monitor->cond);
+		pthread_mutex_unlock(&monitor->mutex);
+	}
+}
+
+static int
+prepare(struct g *g,
+	struct lane *lanes_,
+	const void *x,
+	const void *y,
+	size_t n,
+	int threads)
+{
+	size_t size;
+	long cores;
+	int i, k, m;
+
+	/* slice memory on first use, then m lanes over k slices */
+
+	size = g_memory_size(g) - g_memory_hard(g);
+	size = (size + 63) / 64 * 64;
+	if (!g->slices) {
+		g->slices = g__memory_alloc(SLICES * size, 0);
+		if (!g->slices) {
+			G__DEBUG(0);
+			return -1;
+		}
+	}
+	k = (int)G__MIN(n, SLICES);
+	cores = sysconf(_SC_NPROCESSORS_ONLN);
+	m = (int)G__MIN(G__MIN(G__MAX(1, threads), k), G__MAX(1, cores));
+	memset(lanes_, 0, m * sizeof (lanes_[0]));
+	for (i=0; i<m; ++i) {
+		lanes_[i].g = g;
+		lanes_[i].train_shard = __atomic_load_n(&g->train_shard,
+							__ATOMIC_ACQUIRE);
+		lanes_[i].reduce = __atomic_load_n(&g->reduce,
+						   __ATOMIC_ACQUIRE);
+		lanes_[i].train_hogwild = __atomic_load_n(&g->train_hogwild,
+							  __ATOMIC_ACQUIRE);
+		lanes_[i].x = x;
+		lanes_[i].y = y;
+		lanes_[i].n = n;
+		lanes_[i].size = size;
+		lanes_[i].k = k;
+		lanes_[i].id = i;
+		lanes_[i].m = m;
+	}
+	return m;
+}
+
+static int
+gradients(struct g *g, const void *x, const void *y, size_t n, int threads)
+{
+	struct lane lanes_[SLICES];
+	int i, m;
+
+	/* leaves the gradients of all n samples in slice 0 */
+
+	m = prepare(g, lanes_, x, y, n, threads);
+	if (0 > m) {
+		G__DEBUG(0);
+		return -1;
+	}
+	team_run(g, m, run_lanes, lanes_);
+	for (i=0; i<m; ++i) {
+		lanes_[i].phase = 1;
+	}
+	team_run(g, m, run_lanes, lanes_);
+	return 0;
+}
+
+static void
+update(struct g *g, size_t n)
+{
+	if (g->exec) {
+		g__exec_update(g->exec, g->memory, g->memory, g->slices, n);
+		return;
+	}
+	__atomic_load_n(&g->update, __ATOMIC_ACQUIRE)(g->memory,
+						      g->memory,
+						      g->slices,
+						      n);
+}
+
+int
+g_train_parallel(g_t g,
+		 const void *x,
+		 const void *y,
+		 size_t n,
+		 int threads)
+{
+	if (!g || (SIG != g->sig) || !x || !y || !n) {
+		G__DEBUG(G__ERR_ARGUMENT);
+		return -1;
+	}
+	if (gradients(g, x, y, n, threads)) {
+		G__DEBUG(0);
+		return -1;
+	}
+	update(g, n);
+	return 0;
+}
+
+int
+g_train_hogwild(g_t g,
+		const void *x,
+		const void *y,
+		size_t n,
+		int threads)
+{
+	struct lane lanes_[SLICES];
+	int i, m;
+
+	if (!g || (SIG != g->sig) || !x || !y || !n) {
+		G__DEBUG(G__ERR_ARGUMENT);
+		return -1;
+	}
+	m = prepare(g, lanes_, x, y, n, threads);
+	if (0 > m) {
+		G__DEBUG(0);
+		return -1;
+	}
+	for (i=0; i<m; ++i) {
+		lanes_[i].phase = 2;
+	}
+	team_run(g, m, run_lanes, lanes_);
+	return 0;
+}
+
+g_context_t
+g_context_new(g_t g)
+{
+	struct g_context *context;
+	size_t n;
+
+	if (!g || (SIG != g->sig)) {
+		G__DEBUG(G__ERR_ARGUMENT);
+		return 0;
+	}
+	context = g__malloc(sizeof (struct g_context));
+	if (!context) {
+		G__DEBUG(0);
+		return 0;
+	}
+	memset(context, 0, sizeof (struct g_context));
+	context->sig = SIG_CONTEXT;
+	context->g = g;
+	n = g->exec ?
+		g__exec_memory_context(g->exec) :
+		g->memory_context();
+	context->memory = g__memory_alloc(n, 0);
+	if (!context->memory) {
+		g_context_free(context);
+		G__DEBUG(0);
+		return 0;
+	}
+	context->size = n;
+	return context;
+}
+
+void
+g_context_free(g_context_t context)
+{
+	if (context && (SIG_CONTEXT == context->sig)) {
+		g__memory_free(context->memory, context->size, 0);
+		memset(context, 0, sizeof (struct g_context));
+		G__FREE(context);
+	}
+}
+
+void *
+g_context_activate(g_context_t context, const void *x)
+{
+	activate_ctx_fnc_t activate_ctx;
+	struct g *g;
+
+	if (!context || (SIG_CONTEXT != context->sig) || !x) {
+		G__DEBUG(G__ERR_ARGUMENT);
+		return 0;
+	}
+	g = context->g;
+	if (g->exec) {
+		return g__exec_activate_context(g->exec,
+						g->memory,
+						context->memory,
+						x);
+	}
+	activate_ctx = __atomic_load_n(&g->activate_ctx, __ATOMIC_ACQUIRE);
+	return activate_ctx(g->memory, context->memory, x);
+}
+
+/*
+ * Pipeline: stage s runs layers [first, last) of sample i in slot i % r,
+ * r two per stage. Each stage counts the samples it is done with and is
+ * the only writer of its count, so stage s + 1 consumes what stage s
+ * produced, and stage 0 reuses a slot the last stage released, through
+ * these counts alone: single-producer/single-consumer rings. The stages
+ * are the threads of the model's team, a stage waiting for its next
+ * sample sleeps on the monitor.
+ */
+
+struct pipeline;
+
+struct stage {
+	size_t done; /* samples through the stage */
+	struct pipeline *pipeline;
+	int id;
+	int first;
+	int last;
+};
+
+struct pipeline {
+	struct g *g;
+	activate_layer_fnc_t activate_layer;
+	const char *x;
+	char *y;
+	char *slots;
+	size_t n;
+	size_t a; /* input bytes of a sample */
+	size_t b; /* output bytes of a sample */
+	size_t size; /* of a slot */
+	int r; /* slots */
+	int m; /* stages */
+	struct stage *stages;
+	struct monitor monitor;
+};
+
+static void
+advance(const struct stage *stage, size_t i)
+{
+	const struct pipeline *pipeline;
+	const struct g *g;
+	const char *x;
+	void *o;
+	char *t;
+	int l;
+
+	/* the layers of stage for sample i, the last stage stores y */
+
+	pipeline = stage->pipeline;
+	g = pipeline->g;
+	t = pipeline->slots + (i % pipeline->r) * pipeline->size;
+	x = pipeline->x + i * pipeline->a;
+	o = 0;
+	for (l=stage->first; l<stage->last; ++l) {
+		if (g->exec) {
+			o = g__exec_activate_layer(g->exec, g->memory, t, x, l);
+		}
+		else {
+			o = pipeline->activate_layer(g->memory, t, x, l);
+		}
+	}
+	if ((stage->id + 1) == pipeline->m) {
+		memcpy(pipeline->y + i * pipeline->b, o, pipeline->b);
+	}
+}
+
+static void
+stage(void *arg, int id, int n)
+{
+	struct pipeline *pipeline;
+	struct stage *stage;
+	size_t i;
+	int s;
+
+	pipeline = (struct pipeline *)arg;
+	if (n != pipeline->m) {
+
+		/* alone, every stage of a sample in turn */
+
+		for (i=0; i<pipeline->n; ++i) {
+			for (s=0; s<pipeline->m; ++s) {
+				advance(&pipeline->stages[s], i);
+			}
+		}
+		return;
+	}
+	stage = &pipeline->stages[id];
+	for (i=0; i<pipeline->n; ++i) {
+		if (stage->id) {
+			monitor_wait(&pipeline->monitor,
+				     &pipeline->stages[stage->id - 1].done,
+				     i + 1,
+				     0);
+		}
+		else if (i >= (size_t)pipeline->r) {
+			monitor_wait(&pipeline->monitor,
+				     &pipeline->stages[pipeline->m - 1].done,
+				     i + 1 - pipeline->r,
+				     0);
+		}
+		advance(stage, i);
+		monitor_store(&pipeline->monitor, &stage->done, i + 1);
+	}
+}
+
+static void
+layout(struct pipeline *pipeline)
+{
+	uint64_t cost[1 + MAX_LAYERS + 1], total, sum;
+	int i, l, layers, m;
+
+	/*
+	 * Contiguous runs of layers, each close to an equal share of the
+	 * multiplies and at least one layer.
+	 */
+
+	total = 0;
+	for (layers=0; layer_size(pipeline->g, layers); ++layers) {
+		cost[layers] = layer_size(pipeline->g, layers);
+		if (layers) {
+			cost[layers] *= layer_size(pipeline->g, layers - 1);
+		}
+		total += cost[layers];
+	}
+	m = pipeline->m;
+	for (sum=0, l=0, i=0; i<m; ++i) {
+		pipeline->stages[i].first = l;
+		do {
+			sum += cost[l++];
+		}
+		while (((l + (m - 1 - i)) < layers) &&
+		       ((sum * m) < (total * (i + 1))));
+		pipeline->stages[i].last = l;
+	}
+	pipeline->stages[m - 1].last = layers;
+}
+
+int
+g_activate_pipeline(g_t g, const void *x, size_t n, void *y, int stages)
+{
+	struct pipeline pipeline;
+	long cores;
+	size_t unit;
+	int i, k, layers;
+
+	if (!g || (SIG != g->sig) || !x || !y) {
+		G__DEBUG(G__ERR_ARGUMENT);
+		return -1;
+	}
+
+	/* layer 0 only copies the input, a stage per later layer at most */
+
+	layers = 0;
+	while (layer_size(g, layers)) {
+		++layers;
+	}
+	cores = sysconf(_SC_NPROCESSORS_ONLN);
+	k = (int)G__MIN(G__MIN(G__MAX(1, stages), layers - 1),
+			G__MAX(1, cores));
+	unit = g->exec ? g__exec_memory_unit(g->exec) : g->memory_unit();
+	memset(&pipeline, 0, sizeof (pipeline));
+	pipeline.g = g;
+	pipeline.activate_layer = __atomic_load_n(&g->activate_layer,
+						  __ATOMIC_ACQUIRE);
+	pipeline.x = (const char *)x;
+	pipeline.y = (char *)y;
+	pipeline.n = n;
+	pipeline.a = layer_size(g, 0) * (g->exec ?
+					 g__exec_input_unit(g->exec) :
+					 g->input_unit());
+	pipeline.b = layer_size(g, layers - 1) * unit;
+	pipeline.size = g->exec ?
+		g__exec_memory_context(g->exec) :
+		g->memory_context();
+	pipeline.size = (pipeline.size + 63) / 64 * 64;
+	pipeline.r = 2 * k;
+	pipeline.slots = g__memory_alloc(pipeline.r * pipeline.size, 0);
+	pipeline.stages = g__malloc(k * sizeof (pipeline.stages[0]));
+	if (!pipeline.slots || !pipeline.stages) {
+		g__memory_free(pipeline.slots, pipeline.r * pipeline.size, 0);
+		G__FREE(pipeline.stages);
+		G__DEBUG(0);
+		return -1;
+	}
+	memset(pipeline.stages, 0, k * sizeof (pipeline.stages[0]));
+
+	/* stage 0 runs in the caller, the others on the team */
+
+	for (i=0; i<k; ++i) {
+		pipeline.stages[i].pipeline = &pipeline;
+		pipeline.stages[i].id = i;
+	}
+	pipeline.m = k;
+	layout(&pipeline);
+	monitor_open(&pipeline.monitor);
+	team_run(g, k, stage, &pipeline);
+	monitor_close(&pipeline.monitor);
+	g__memory_free(pipeline.slots, pipeline.r * pipeline.size, 0);
+	G__FREE(pipeline.stages);
+	return 0;
+}
+
+g_ring_t
+g_ring_open(const char *path, int rank, int size, int compress)
+{
+	struct g_ring *ring;
+
+	ring = g__malloc(sizeof (struct g_ring));
+	if (!ring) {
+		G__DEBUG(0);
+		return 0;
+	}
+	memset(ring, 0, sizeof (struct g_ring));
+	ring->sig = SIG_RING;
+	ring->size = size;
+	ring->compress = compress ? 1 : 0;
+	ring->ring = g__ring_open(path, rank, size);
+	if (!ring->ring) {
+		g_ring_close(ring);
+		G__DEBUG(0);
+		return 0;
+	}
+	return ring;
+}
+
+void
+g_ring_close(g_ring_t ring)
+{
+	if (ring && (SIG_RING == ring->sig)) {
+		g__ring_close(ring->ring);
+		memset(ring, 0, sizeof (struct g_ring));
+		G__FREE(ring);
+	}
+}
+
+int
+g_ring_broadcast(g_ring_t ring, g_t g)
+{
+	if (!ring || (SIG_RING != ring->sig) || !g || (SIG != g->sig)) {
+		G__DEBUG(G__ERR_ARGUMENT);
+		return -1;
+	}
+	if (g__ring_broadcast(ring->ring, g->memory, g_memory_hard(g))) {
+		G__DEBUG(0);
+		return -1;
+	}
+	return 0;
+}
+
+int
+g_train_ring(g_ring_t ring,
+	     g_t g,
+	     const void *x,
+	     const void *y,
+	     size_t n,
+	     int threads)
+{
+	size_t unit;
+
+	if (!ring || (SIG_RING != ring->sig) ||
+	    !g || (SIG != g->sig) ||
+	    !x || !y || !n) {
+		G__DEBUG(G__ERR_ARGUMENT);
+		return -1;
+	}
+	if (gradients(g, x, y, n, threads)) {
+		G__DEBUG(0);
+		return -1;
+	}
+
+	/* w_ and b_, as many bytes as w and b, lead slice 0 */
+
+	unit = g->exec ? g__exec_memory_unit(g->exec) : g->memory_unit();
+	if (g__ring_allreduce(ring->ring,
+			      g->slices,
+			      g_memory_hard(g) / unit,
+			      (int)unit,
+			      ring->compress)) {
+		G__DEBUG(0);
+		return -1;
+	}
+	update(g, n * ring->size);
+	return 0;
+}
+
+g_data_t
+g_data_open(const char *pathname)
+{
+	struct g_data *data;
+
+	data = g__malloc(sizeof (struct g_data));
+	if (!data) {
+		G__DEBUG(0);
+		return 0;
+	}
+	memset(data, 0, sizeof (struct g_data));
+	data->sig = SIG_DATA;
+	data->data = g__data_open(pathname);
+	if (!data->data) {
+		g_data_close(data);
+		G__DEBUG(0);
+		return 0;
+	}
+	return data;
+}
+
+void
+g_data_close(g_data_t data)
+{
+	if (data && (SIG_DATA == data->sig)) {
+		g__data_close(data->data);
+		memset(data, 0, sizeof (struct g_data));
+		G__FREE(data);
+	}
+}
+
+int
+g_data_type(g_data_t data)
+{
+	if (!data || (SIG_DATA != data->sig)) {
+		G__DEBUG(G__ERR_ARGUMENT);
+		return -1;
+	}
+	return g__data_type(data->data);
+}
+
+size_t
+g_data_dim(g_data_t data, int i)
+{
+	if (!data || (SIG_DATA != data->sig)) {
+		G__DEBUG(G__ERR_ARGUMENT);
+		return 0;
+	}
+	return (size_t)g__data_dim(data->data, i);
+}
+
+size_t
+g_data_count(g_data_t data)
+{
+	return g_data_dim(data, 0);
+}
+
+size_t
+g_data_size(g_data_t data)
+{
+	if (!data || (SIG_DATA != data->sig)) {
+		G__DEBUG(G__ERR_ARGUMENT);
+		return 0;
+	}
+	return (size_t)g__data_size(data->data);
+}
+
+const void *
+g_data_sample(g_data_t data, size_t i)
+{
+	if (!data || (SIG_DATA != data->sig)) {
+		G__DEBUG(G__ERR_ARGUMENT);
+		return 0;
+	}
+	return g__data_sample(data->data, i);
+}
+
+int
+g_data_save(const char *pathname,
+	    int type,
+	    const size_t *dims,
+	    int rank,
+	    const void *x)
+{
+	uint64_t dims_[G__DATA_RANK];
+	int i;
+
+	if (!dims || (0 > rank) || (G__DATA_RANK < rank)) {
+		G__DEBUG(G__ERR_ARGUMENT);
+		return -1;
+	}
+	for (i=0; i<rank; ++i) {
+		dims_[i] = dims[i];
+	}
+	if (g__data_save(pathname, type, dims_, rank, x)) {
+		G__DEBUG(0);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Batch k of the endless stream of epochs is prepared by producer k % m
+ * into slot k % r and handed to the single consumer through two monotone
+ * counters, the producer's done and the consumer's released, so each
+ * producer/consumer pair is a lock-free SPSC queue. Every producer derives
+ * the order of an epoch from the seed alone, so all agree on it without
+ * talking to each other.
+ */
+
+struct producer {
+	struct g_loader *loader;
+	size_t done; /* batches of this producer ready */
+	pthread_t thread;
+	int id;
+	int running;
+};
+
+struct g_loader {
+	struct g *g;
+	unsigned sig;
+	g__data_t x;
+	g__data_t y;
+	char *slots;
+	double scale;
+	unsigned seed;
+	int labels; /* y holds class indices, trained by g_train_labels() */
+	int input; /* bytes per model input value, 1: uint8 */
+	int unit; /* bytes per model real */
+	size_t n; /* samples per epoch */
+	size_t batch;
+	size_t batches; /* per epoch, a partial last batch is dropped */
+	size_t a; /* x bytes of a sample in a slot */
+	size_t b; /* y bytes of a sample in a slot */
+	size_t size; /* of a slot */
+	size_t taken; /* batches handed to the consumer */
+	size_t released; /* batches the consumer is done with */
+	size_t ready; /* epochs shuffled, epoch e in order[e % 2] */
+	uint32_t *order[2];
+	int stop;
+	int r; /* slots */
+	int m; /* producers */
+	struct producer *producers;
+	struct monitor monitor;
+};
+
+/* splitmix64, constants built from halves as C89 has no 64-bit literals */
+
+#define U64(hi, lo) (((uint64_t)(hi) << 32) | (uint64_t)(lo))
+
+static uint64_t
+random_(uint64_t *state)
+{
+	uint64_t z;
+
+	z = (*state += U64(0x9e3779b9, 0x7f4a7c15));
+	z = (z ^ (z >> 30)) * U64(0xbf58476d, 0x1ce4e5b9);
+	z = (z ^ (z >> 27)) * U64(0x94d049bb, 0x133111eb);
+	return z ^ (z >> 31);
+}
+
+/* Fisher-Yates, epoch e into order[e % 2] */
+
+static void
+shuffle(struct g_loader *loader, uint64_t epoch)
+{
+	uint64_t state;
+	uint32_t *order, t;
+	size_t i, j;
+
+	order = loader->order[epoch % 2];
+	for (i=0; i<loader->n; ++i) {
+		order[i] = (uint32_t)i;
+	}
+	state = ((uint64_t)loader->seed << 32) ^ epoch;
+	for (i=loader->n - 1; loader->seed && (0 < i); --i) {
+		j = (size_t)(random_(&state) % (i + 1));
+		t = order[i];
+		order[i] = order[j];
+		order[j] = t;
+	}
+}
+
+/* n values of data type type at x to reals of unit bytes at y, times scale */
+
+static void
+convert(void *y, int unit, const void *x, int type, size_t n, double scale)
+{
+	double v;
+	size_t i;
+
+	for (i=0; i<n; ++i) {
+		switch (type) {
+		case G__DATA_UINT8 : v = ((const uint8_t *)x)[i]; break;
+		case G__DATA_INT8  : v = ((const int8_t  *)x)[i]; break;
+		case G__DATA_INT16 : v = ((const int16_t *)x)[i]; break;
+		case G__DATA_INT32 : v = ((const int32_t *)x)[i]; break;
+		case G__DATA_FLOAT : v = ((const float   *)x)[i]; break;
+		default /*------*/ : v = ((const double  *)x)[i]; break;
+		}
+		if (sizeof (float) == (size_t)unit) {
+			((float *)y)[i] = (float)(v * scale);
+		}
+		else {
+			((double *)y)[i] = v * scale;
+		}
+	}
+}
+
+static int32_t
+label(const void *y, int type)
+{
+	switch (type) {
+	case G__DATA_UINT8 : return *(const uint8_t *)y;
+	case G__DATA_INT8  : return *(const int8_t  *)y;
+	case G__DATA_INT16 : return *(const int16_t *)y;
+	default /*------*/ : break;
+	}
+	return *(const int32_t *)y;
+}
+
+/*
+ * Batch k into slot: x then y (targets or labels) of each sample. The
+ * producer of the first batch of epoch e shuffles it, once every batch of
+ * epoch e - 2, whose order it overwrites, is released; the others wait
+ * for the shuffle and take their disjoint part of the one order.
+ */
+
+static int
+produce(struct g_loader *loader, size_t k, char *slot)
+{
+	const uint32_t *order;
+	size_t e, i;
+	char *x, *y;
+	uint32_t s;
+
+	e = k / loader->batches;
+	if (!(k % loader->batches)) {
+		if ((2 <= e) &&
+		    monitor_wait(&loader->monitor,
+				 &loader->released,
+				 (e - 1) * loader->batches,
+				 &loader->stop)) {
+			return -1;
+		}
+		shuffle(loader, e);
+		monitor_store(&loader->monitor, &loader->ready, e + 1);
+	}
+	else if (monitor_wait(&loader->monitor,
+			      &loader->ready,
+			      e + 1,
+			      &loader->stop)) {
+		return -1;
+	}
+	order = loader->order[e % 2];
+	x = slot;
+	y = slot + loader->batch * loader->a;
+	for (i=0; i<loader->batch; ++i) {
+		s = order[(k % loader->batches) * loader->batch + i];
+		if (1 == loader->input) {
+			memcpy(x + i * loader->a,
+			       g__data_sample(loader->x, s),
+			       loader->a);
+		}
+		else {
+			convert(x + i * loader->a,
+				loader->unit,
+				g__data_sample(loader->x, s),
+				g__data_type(loader->x),
+				loader->a / loader->unit,
+				loader->scale);
+		}
+		if (loader->labels) {
+			((int32_t *)y)[i] = label(g__data_sample(loader->y, s),
+						  g__data_type(loader->y));
+		}
+		else {
+			convert(y + i * loader->b,
+				loader->unit,
+				g__data_sample(loader->y, s),
+				g__data_type(loader->y),
+				loader->b / loader->unit,
+				1.0);
+		}
+	}
+	return 0;
+}
+
+static void *
+producer(void *arg)
+{
+	struct producer *producer;
+	struct g_loader *loader;
+	size_t j, k;
+
+	producer = (struct producer *)arg;
+	loader = producer->loader;
+	for (j=0; ; ++j) {
+		k = j * loader->m + producer->id;
+
+		/* slot k % r is free once batch k - r is released */
+
+		if ((k >= (size_t)loader->r) &&
+		    monitor_wait(&loader->monitor,
+				 &loader->released,
+				 k - loader->r + 1,
+				 &loader->stop)) {
+			break;
+		}
+		if (produce(loader,
+			    k,
+			    loader->slots + (k % loader->r) * loader->size)) {
+			break;
+		}
+		monitor_store(&loader->monitor, &producer->done, j + 1);
+	}
+	return 0;
+}
+
+g_loader_t
+g_loader_open(g_t g,
+	      g_data_t x,
+	      g_data_t y,
+	      double scale,
+	      int threads,
+	      int slots,
+	      unsigned seed)
+{
+	struct g_loader *loader;
+	size_t inputs, outputs_;
+	int cores, i;
+
+	if (!g || (SIG != g->sig) ||
+	    !x || (SIG_DATA != x->sig) ||
+	    !y || (SIG_DATA != y->sig) ||
+	    (g__data_dim(x->data, 0) != g__data_dim(y->data, 0)) ||
+	    (UINT32_MAX < g__data_dim(x->data, 0))) {
+		G__DEBUG(G__ERR_ARGUMENT);
+		return 0;
+	}
+	loader = g__malloc(sizeof (struct g_loader));
+	if (!loader) {
+		G__DEBUG(0);
+		return 0;
+	}
+	memset(loader, 0, sizeof (struct g_loader));
+	loader->sig = SIG_LOADER;
+	monitor_open(&loader->monitor);
+	loader->g = g;
+	loader->x = x->data;
+	loader->y = y->data;
+	loader->scale = scale;
+	loader->seed = seed;
+	loader->input = (int)(g->exec ?
+			      g__exec_input_unit(g->exec) :
+			      g->input_unit());
+	loader->unit = (int)(g->exec ?
+			     g__exec_memory_unit(g->exec) :
+			     g->memory_unit());
+	loader->n = (size_t)g__data_dim(x->data, 0);
+	loader->batch = (size_t)(g->exec ? g__exec_batch(g->exec) : g->batch());
+	loader->batches = loader->n / loader->batch;
+
+	/* x: a uint8 model takes the bytes, a real one any type converted */
+
+	inputs = layer_size(g, 0);
+	outputs_ = outputs(g);
+	loader->a = inputs * loader->input;
+	loader->labels = (g__data_size(y->data) ==
+			  (uint64_t)g__data_unit(g__data_type(y->data))) &&
+		(G__DATA_FLOAT != g__data_type(y->data)) &&
+		(G__DATA_DOUBLE != g__data_type(y->data));
+	loader->b = loader->labels ? sizeof (int32_t) : outputs_ * loader->unit;
+	if (!loader->batches ||
+	    ((1 == loader->input) &&
+	     (G__DATA_UINT8 != g__data_type(x->data))) ||
+	    ((inputs * g__data_unit(g__data_type(x->data))) !=
+	     g__data_size(x->data)) ||
+	    (!loader->labels &&
+	     ((outputs_ * g__data_unit(g__data_type(y->data))) !=
+	      g__data_size(y->data)))) {
+		g_loader_close(loader);
+		G__DEBUG(G__ERR_ARGUMENT);
+		return 0;
+	}
+
+	/* producers, at most one per online core, and 2 + m slots by default */
+
+	cores = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	loader->m = G__MIN(G__MAX(1, threads), G__MAX(1, cores));
+	loader->r = G__MAX(loader->m + 1, (0 < slots) ? slots : loader->m + 2);
+	loader->size = loader->batch * (loader->a + loader->b);
+	loader->size = (loader->size + 63) / 64 * 64;
+	loader->slots = g__malloc(loader->r * loader->size);
+	loader->producers = g__malloc(loader->m * sizeof (struct producer));
+	loader->order[0] = g__malloc(loader->n * sizeof (uint32_t));
+	loader->order[1] = g__malloc(loader->n * sizeof (uint32_t));
+	if (!loader->slots ||
+	    !loader->producers ||
+	    !loader->order[0] ||
+	    !loader->order[1]) {
+		g_loader_close(loader);
+		G__DEBUG(0);
+		return 0;
+	}
+	memset(loader->producers, 0, loader->m * sizeof (struct producer));
+	for (i=0; i<loader->m; ++i) {
+		loader->producers[i].loader = loader;
+		loader->producers[i].id = i;
+	}
+	for (i=0; i<loader->m; ++i) {
+		if (pthread_create(&loader->producers[i].thread,
+				   0,
+				   producer,
+				   &loader->producers[i])) {
+			g_loader_close(loader);
+			G__DEBUG(G__ERR_SYSTEM);
+			return 0;
+		}
+		loader->producers[i].running = 1;
+	}
+	return loader;
+}
+
+void
+g_loader_close(g_loader_t loader)
+{
+	int i;
+
+	if (loader && (SIG_LOADER == loader->sig)) {
+		pthread_mutex_lock(&loader->monitor.mutex);
+		__atomic_store_n(&loader->stop, 1, __ATOMIC_SEQ_CST);
+		pthread_cond_broadcast(&loader->monitor.cond);
+		pthread_mutex_unlock(&loader->monitor.mutex);
+		for (i=0; loader->producers && (i<loader->m); ++i) {
+			if (loader->producers[i].running) {
+				pthread_join(loader->producers[i].thread, 0);
+			}
+		}
+		monitor_close(&loader->monitor);
+		G__FREE(loader->producers);
+		G__FREE(loader->order[0]);
+		G__FREE(loader->order[1]);
+		G__FREE(loader->slots);
+		memset(loader, 0, sizeof (struct g_loader));
+		G__FREE(loader);
+	}
+}
+
+int
+g_loader_next(g_loader_t loader, const void **x, const void **y)
+{
+	struct producer *producer;
+	size_t k;
+	char *slot;
+
+	if (!loader || (SIG_LOADER != loader->sig) || !x || !y) {
+		G__DEBUG(G__ERR_ARGUMENT);
+		return -1;
+	}
+
+	/* the batch handed out last time is done with */
+
+	k = loader->taken;
+	monitor_store(&loader->monitor, &loader->released, k);
+	producer = &loader->producers[k % loader->m];
+	if (monitor_wait(&loader->monitor,
+			 &producer->done,
+			 k / loader->m + 1,
+			 &loader->stop)) {
+		G__DEBUG(G__ERR_SOFTWARE);
+		return -1;
+	}
+	slot = loader->slots + (k % loader->r) * loader->size;
+	(*x) = slot;
+	(*y) = slot + loader->batch * loader->a;
+	loader->taken = k + 1;
+	return 0;
+}
+
+int
+g_loader_train(g_loader_t loader)
+{
+	const void *x, *y;
+
+	if (g_loader_next(loader, &x, &y)) {
+		G__DEBUG(0);
+		return -1;
+	}
+	if (loader->labels ?
+	    g_train_labels(loader->g, x, (const int32_t *)y) :
+	    g_train(loader->g, x, y)) {
+		G__DEBUG(0);
+		return -1;
+	}
+	return 0;
+}
+
+int
+g_loader_labels(g_loader_t loader)
+{
+	if (!loader || (SIG_LOADER != loader->sig)) {
+		G__DEBUG(G__ERR_ARGUMENT);
+		return -1;
+	}
+	return loader->labels;
+}
+
+size_t
+g_loader_batches(g_loader_t loader)
+{
+	if (!loader || (SIG_LOADER != loader->sig)) {
+		G__DEBUG(G__ERR_ARGUMENT);
+		return 0;
+	}
+	return loader->batches;
+}
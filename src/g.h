@@ -19,6 +19,7 @@
 #define _G_H_
 
 #include <stddef.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -29,6 +30,59 @@ extern "C" {
 
 typedef struct g *g_t;
 
+#define G_PROFILE_PORTABLE 0 /* -O3 */
+#define G_PROFILE_NATIVE   1 /* -O3 -march=native -mtune=native */
+#define G_PROFILE_PGO      2 /* -O3, profile-guided by a warmup batch */
+
+#define G_MEMORY_HUGE 1 /* huge pages: hugetlbfs if reserved, else THP */
+#define G_MEMORY_LOCK 2 /* mlock()ed, never paged out */
+
+/**
+ * Options for g_open_ex(), zero for defaults.
+ *
+ * tiered : return as soon as a quick -O1 build is ready and hot-swap the
+ *          profile build in from a background thread once it completes
+ * profile: G_PROFILE_* used to build the final code
+ * warmup_: one batch (x, y as for g_train) run warmup_rounds times through
+ *          the instrumented G_PROFILE_PGO build, y may be null to profile
+ *          activation only, must remain valid until the final build is in
+ * autotune: benchmark the code generation variants on synthetic data of
+ *          the model shape and build the fastest, the winner is recorded
+ *          in tunedb (default $G_TUNEDB or $TMPDIR/gravity.tune) by
+ *          topology and CPU model so later opens skip the search
+ * interpret: run the model on the kernels built into libgravity, no code
+ *          is emitted or compiled so opening is instant, the fields above
+ *          are ignored; a model with linear, softmax or sigmoid hidden
+ *          layers opens and activates but aborts at its first training
+ *          call, the derivatives (LINEARD, SOFTMAXD, SIGMOIDD) being
+ *          unimplemented
+ * threads: split the wide layers of each g_train/g_activate call across
+ *          this many threads of a persistent pool (0, 1: single threaded),
+ *          at most one per online core
+ * memory : G_MEMORY_* flags for the model memory, which is always 64-byte
+ *          aligned and fully touched by g_open_ex()
+ * allocate: caller allocator for the model memory instead, e.g. to place
+ *          it in a buffer of the caller's, called with allocator and the
+ *          size in bytes and returning 64-byte aligned memory, handed back
+ *          to release (if any) on g_close(), memory is then ignored
+ */
+
+struct g_options {
+	int tiered;
+	int profile;
+	const void *warmup_x;
+	const void *warmup_y;
+	int warmup_rounds;
+	int autotune;
+	const char *tunedb;
+	int interpret;
+	int threads;
+	int memory;
+	void *(*allocate)(void *allocator, size_t size);
+	void (*release)(void *allocator, void *memory, size_t size);
+	void *allocator;
+};
+
 int g_version(void);
 
 void g_debug(int enabled);
@@ -41,16 +95,314 @@ g_t g_open(const char *optimizer,
 	   const char *output,
 	   /* hidden */ ...);
 
+g_t g_open_ex(const struct g_options *options,
+	      const char *optimizer,
+	      const char *precision,
+	      const char *costfnc,
+	      const char *batch,
+	      const char *input,
+	      const char *output,
+	      /* hidden */ ...);
+
+/*
+ * One model for g_open_many(), fields as the g_open() arguments with hidden
+ * a null terminated list of hidden layers.
+ */
+
+struct g_spec {
+	const char *optimizer;
+	const char *precision;
+	const char *costfnc;
+	const char *batch;
+	const char *input;
+	const char *output;
+	const char *const *hidden;
+};
+
+/*
+ * Opens n models with as few compiler invocations as possible: the models
+ * are emitted into one translation unit per shard (one shard per core) and
+ * the handles of a shard share the loaded code. On success g[0..n-1] are
+ * set, each to be closed with g_close(), and 0 is returned. On failure
+ * none are open and -1 is returned.
+ */
+
+int g_open_many(const struct g_spec *specs, int n, g_t *g);
+
+/*
+ * A new independent model of the same topology, sharing the loaded code of
+ * g (no compilation). With copy its memory (weights and training state)
+ * is a copy of g's, otherwise it is freshly initialized. Clones and g may
+ * be closed in any order.
+ */
+
+g_t g_clone(g_t g, int copy);
+
 void g_close(g_t g);
 
 size_t g_memory_size(g_t g);
 
 size_t g_memory_hard(g_t g);
 
+/*
+ * The weights in a portable form, whatever the .layout of the model: per
+ * layer w[l] row-major (n x m, n the layer's width and m the one before)
+ * then b[l], in the model's precision, g_export_size() bytes in all.
+ * g_export() writes them to x, g_import() reads them from x, e.g. from a
+ * checkpoint of a model with another .layout. Return 0 or -1.
+ */
+
+size_t g_export_size(g_t g);
+
+int g_export(g_t g, void *x);
+
+int g_import(g_t g, const void *x);
+
 void *g_activate(g_t g, const void *x);
 
+/*
+ * g_activate() without its copies: the first layer reads x where it is and
+ * the output layer writes its outputs straight to y, which the next call
+ * leaves alone. Models of .input uint8 still convert x on the way in.
+ * Returns 0 or -1.
+ */
+
+int g_activate_into(g_t g, const void *x, void *y);
+
+/*
+ * Activates n samples, x holding the n inputs and y receiving the n outputs
+ * back to back. Weights are read once per block of samples rather than
+ * once per sample. Unlike g_activate() the result does not alias model
+ * memory. The scratch of a block is allocated by the first call and kept
+ * until g_close(). Returns 0 or -1.
+ */
+
+int g_activate_batch(g_t g, const void *x, size_t n, void *y);
+
+/*
+ * A context holds the activations of one inference stream and shares the
+ * weights of its g_t read-only, so each thread may activate through its own
+ * context concurrently with the others (not with g_train() on the same g_t).
+ * A context costs about the activations of the widest two adjacent layers,
+ * the others reusing their memory, and must be freed before its g_t is
+ * closed.
+ */
+
+typedef struct g_context *g_context_t;
+
+g_context_t g_context_new(g_t g);
+
+void g_context_free(g_context_t context);
+
+void *g_context_activate(g_context_t context, const void *x);
+
+/*
+ * Streams n samples (x, y as for g_activate_batch()) through a pipeline of
+ * up to stages threads, at most one per online core and one per layer.
+ * Each stage runs a contiguous run of layers, the runs balanced by their
+ * multiply count, and hands each sample on to the next stage through a
+ * lock-free ring, so once the pipeline is full a sample completes every
+ * stage time rather than every model time. The stage threads stay with g
+ * between calls and sleep while waiting. As a context it only reads the
+ * weights. Returns 0 or -1.
+ */
+
+int g_activate_pipeline(g_t g, const void *x, size_t n, void *y, int stages);
+
+/*
+ * One SGD step over a batch. A model with .schedule stale (passed to
+ * g_open() like one more hidden layer) computes the gradients of each
+ * batch while a second thread applies those of the previous one to a
+ * second copy of the weights: every update is one step late, the last
+ * batch's waiting for the next call, and the update no longer stalls
+ * training. The default is .schedule serial. Returns 0 or -1.
+ */
+
 int g_train(g_t g, const void *x, const void *y);
 
+/*
+ * g_train() for classification: in place of the batch x outputs targets y,
+ * labels holds one class index in [0, outputs) per sample and the target
+ * is its one-hot vector, which is never materialized. Same result as
+ * g_train() on those one-hot targets. Returns 0 or -1, the latter also for
+ * a label out of range.
+ */
+
+int g_train_labels(g_t g, const void *x, const int32_t *labels);
+
+/*
+ * g_train() on samples read in place from a dataset rather than from a
+ * batch copied together: x and y hold any number of samples back to back
+ * (each as for g_train()) and the k indices, k a multiple of the batch
+ * size, pick the samples of k / batch steps, batch after batch. Indices
+ * are not checked against the dataset. Returns 0 or -1.
+ */
+
+int g_train_gather(g_t g,
+		   const void *x,
+		   const void *y,
+		   const uint32_t *indices,
+		   size_t k);
+
+/*
+ * One g_train() step over the batch whose sample i starts x_stride * i
+ * bytes into x and y_stride * i bytes into y, e.g. records holding both.
+ * Returns 0 or -1.
+ */
+
+int g_train_strided(g_t g,
+		    const void *x,
+		    size_t x_stride,
+		    const void *y,
+		    size_t y_stride);
+
+/*
+ * One SGD step over a minibatch of n samples (any n, x and y back to back
+ * as for g_activate_batch), its gradients computed by up to threads
+ * threads. The minibatch is cut into a fixed set of slices, each with its
+ * own gradient memory, the slices are summed in a fixed pairwise tree and
+ * the sum is applied once, so the result is bit-identical whatever the
+ * thread count. The threads stay with g between calls, until the count
+ * changes or g_close(). Returns 0 or -1.
+ */
+
+int g_train_parallel(g_t g,
+		     const void *x,
+		     const void *y,
+		     size_t n,
+		     int threads);
+
+/*
+ * Asynchronous (Hogwild) counterpart of g_train_parallel(): each of up to
+ * threads threads takes its share of the n samples and runs g_train()
+ * steps of the model's batch size over them, every step updating the
+ * shared weights directly without locks. Updates of different threads may
+ * interleave or overwrite each other, so results vary from run to run;
+ * in exchange no thread waits for another. Returns 0 or -1.
+ */
+
+int g_train_hogwild(g_t g,
+		    const void *x,
+		    const void *y,
+		    size_t n,
+		    int threads);
+
+/*
+ * Data-parallel training across size processes on one host, joined in a
+ * ring over Unix-domain sockets at path.0 .. path.<size - 1>. Every rank
+ * opens the ring with its own rank (the call returns once both neighbors
+ * are connected), starts from rank 0's weights via g_ring_broadcast() and
+ * then calls g_train_ring() in lockstep with the others, each on its own
+ * n samples (n the same on all ranks). The gradients are summed by a ring
+ * all-reduce and every rank applies the same update, so the weights stay
+ * identical everywhere. With compress the gradients travel at half width
+ * (bfloat16 for float models, float for double ones).
+ */
+
+typedef struct g_ring *g_ring_t;
+
+g_ring_t g_ring_open(const char *path, int rank, int size, int compress);
+
+void g_ring_close(g_ring_t ring);
+
+int g_ring_broadcast(g_ring_t ring, g_t g);
+
+int g_train_ring(g_ring_t ring,
+		 g_t g,
+		 const void *x,
+		 const void *y,
+		 size_t n,
+		 int threads);
+
+/*
+ * A dataset file mapped read-only into memory, its samples the slices along
+ * the first dimension, handed out in place so a dataset larger than RAM
+ * streams from the page cache without a copy in the process. The file is
+ * either IDX (as MNIST is distributed: big-endian header, G_DATA_* element
+ * codes) or a raw tensor written by g_data_save(), whose elements are in
+ * host byte order and 64-byte aligned. Multi-byte IDX elements are the
+ * exception: big-endian and not always aligned, they are converted once
+ * into an aligned copy in the process. Open validates the header and that
+ * the file holds every element.
+ *
+ * Samples of a G_DATA_UINT8 file feed a .input uint8 model, those of a file
+ * of the model's precision any model, e.g. g_data_sample(data, 0) as the x
+ * of g_train_gather() or g_activate_batch(). g_data_size() is the bytes of
+ * one sample and g_data_dim() dimension i, zero past the last.
+ */
+
+#define G_DATA_UINT8  0x08
+#define G_DATA_INT8   0x09
+#define G_DATA_INT16  0x0B
+#define G_DATA_INT32  0x0C
+#define G_DATA_FLOAT  0x0D
+#define G_DATA_DOUBLE 0x0E
+
+typedef struct g_data *g_data_t;
+
+g_data_t g_data_open(const char *pathname);
+
+void g_data_close(g_data_t data);
+
+int g_data_type(g_data_t data);
+
+size_t g_data_count(g_data_t data);
+
+size_t g_data_size(g_data_t data);
+
+size_t g_data_dim(g_data_t data, int i);
+
+const void *g_data_sample(g_data_t data, size_t i);
+
+/* writes the rank dimensional array x of G_DATA_* type as a raw file */
+
+int g_data_save(const char *pathname,
+		int type,
+		const size_t *dims,
+		int rank,
+		const void *x);
+
+/*
+ * Prepares training batches for g on up to threads producer threads (at
+ * most one per online core) ahead of the trainer. The samples of x and y
+ * are taken in an order shuffled anew each epoch (Fisher-Yates, seeded by
+ * seed, 0 keeps the file order) and, unless the model takes uint8 input,
+ * converted to its precision with x multiplied by scale. A y of one
+ * integer per sample is taken as class indices for g_train_labels(),
+ * otherwise as targets for g_train(). The batches go through slots ring
+ * buffers (0: threads + 2), each producer handing its batches to the
+ * caller by a lock-free single producer, single consumer queue, so the
+ * trainer only waits when the producers fall behind, and a waiting side
+ * sleeps after a brief spin.
+ *
+ * g_loader_next() returns the next batch in x and y, valid until the
+ * following call; g_loader_train() trains g on it. Epochs follow each
+ * other without end, g_loader_batches() long (a last partial batch is
+ * dropped). x and y must outlive the loader. Return 0 or -1.
+ */
+
+typedef struct g_loader *g_loader_t;
+
+g_loader_t g_loader_open(g_t g,
+			 g_data_t x,
+			 g_data_t y,
+			 double scale,
+			 int threads,
+			 int slots,
+			 unsigned seed);
+
+void g_loader_close(g_loader_t loader);
+
+int g_loader_next(g_loader_t loader, const void **x, const void **y);
+
+int g_loader_train(g_loader_t loader);
+
+/* 1 if the y of a batch are int32_t class indices, 0 if targets */
+
+int g_loader_labels(g_loader_t loader);
+
+size_t g_loader_batches(g_loader_t loader);
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
@@ -15,6 +15,7 @@
  * If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <limits.h>
 #include "g_ann.h"
 
 #define MAX_PROGRAM_CAPACITY 1000
@@ -46,6 +47,41 @@ unit(const struct g__ann_precision *precision)
 	return 0;
 }
 
+/*
+ * G__ANN_LAYOUT_ALIGNED starts every tensor on a G__ANN_ALIGN byte boundary
+ * and pads the rows of w (and w_) to a multiple of G__ANN_ALIGN bytes, the
+ * row stride of the weights given to MAC1-3 and RANDOM. The pads stay zero.
+ * G__ANN_LAYOUT_BLOCKED aligns the tensors alike and pads w (and w_) to
+ * whole panels of rows instead (see g_ann.h).
+ */
+
+static uint64_t
+align(const struct g__ann *ann, uint64_t size)
+{
+	if (G__ANN_LAYOUT_PACKED == ann->layout) {
+		return size;
+	}
+	return (size + G__ANN_ALIGN - 1) / G__ANN_ALIGN * G__ANN_ALIGN;
+}
+
+static uint64_t
+stride(const struct g__ann *ann, uint64_t m)
+{
+	if (G__ANN_LAYOUT_ALIGNED != ann->layout) {
+		return m;
+	}
+	return align(ann, m * unit(&ann->precision)) / unit(&ann->precision);
+}
+
+static uint64_t
+rows(const struct g__ann *ann, uint64_t n)
+{
+	if (G__ANN_LAYOUT_BLOCKED != ann->layout) {
+		return n;
+	}
+	return (n + G__ANN_PANEL - 1) / G__ANN_PANEL * G__ANN_PANEL;
+}
+
 static int
 emit_precision(struct g__ann *ann, const struct g__ir *ir)
 {
@@ -59,30 +95,36 @@ emit_precision(struct g__ann *ann, const struct g__ir *ir)
 	precision->precision = ir->precision.precision;
 	for (l=1; l<ir->layers; ++l) {
 		n = (uint64_t)ir->nodes[l].size;
-		m = (uint64_t)ir->nodes[l - 1].size;
-		precision->w[l] = precision->size;
-		precision->size += unit(precision) * n * m;
-		precision->b[l] = precision->size;
-		precision->size += unit(precision) * n * 1;
+		m = stride(ann, (uint64_t)ir->nodes[l - 1].size);
+		precision->w[l] = align(ann, precision->size);
+		precision->size = precision->w[l] +
+			unit(precision) * rows(ann, n) * m;
+		precision->b[l] = align(ann, precision->size);
+		precision->size = precision->b[l] + unit(precision) * n * 1;
 	}
+	precision->size = align(ann, precision->size);
 	precision->hard = precision->size;
 	for (l=1; l<ir->layers; ++l) {
 		n = (uint64_t)ir->nodes[l].size;
-		m = (uint64_t)ir->nodes[l - 1].size;
-		precision->w_[l] = precision->size;
-		precision->size += unit(precision) * n * m;
-		precision->b_[l] = precision->size;
-		precision->size += unit(precision) * n * 1;
+		m = stride(ann, (uint64_t)ir->nodes[l - 1].size);
+		precision->w_[l] = align(ann, precision->size);
+		precision->size = precision->w_[l] +
+			unit(precision) * rows(ann, n) * m;
+		precision->b_[l] = align(ann, precision->size);
+		precision->size = precision->b_[l] + unit(precision) * n * 1;
 	}
+	precision->size = align(ann, precision->size);
+	precision->scratch = precision->size;
 	for (l=0; l<ir->layers; ++l) {
 		n = (uint64_t)ir->nodes[l].size;
-		precision->a_[l] = precision->size;
-		precision->size += unit(precision) * n * 1;
+		precision->a_[l] = align(ann, precision->size);
+		precision->size = precision->a_[l] + unit(precision) * n * 1;
 		if (l) {
-			precision->d_[l] = precision->size;
-			precision->size += unit(precision) * n * 1;
+			precision->d_[l] = align(ann, precision->size);
+			precision->size = precision->d_[l] + unit(precision) * n;
 		}
 	}
+	precision->size = align(ann, precision->size);
 	return 0;
 }
 
@@ -125,7 +167,10 @@ emit_program_initialize(struct g__ann *ann,
 		inst->arg[0].i = precision->w[l];
 		inst->arg[1].r = (-6.0 / (n + m)) * 1.0;
 		inst->arg[2].r = (+6.0 / (n + m)) * 2.0;
-		inst->arg[3].i = n * m;
+		inst->arg[3].i = n * stride(ann, m);
+		inst->arg[4].i = m;
+		inst->arg[5].i = stride(ann, m);
+		inst->layout = ann->layout;
 		inst->whole = precision->whole;
 		inst->fraction = precision->fraction;
 		inst->precision = precision->precision;
@@ -171,7 +216,7 @@ emit_program_activate(struct g__ann *ann, const struct g__ir *ir, int program_)
 
 	/*
 	 * a_[*]:
-	 *    a_[0] := x
+	 *    a_[0] := x * scale
 	 */
 
 	n = (uint64_t)ir->nodes[0].size;
@@ -180,6 +225,8 @@ emit_program_activate(struct g__ann *ann, const struct g__ir *ir, int program_)
 	inst->opc = G__ANN_PROGRAM_INST_COPYX;
 	inst->arg[0].i = precision->a_[0];
 	inst->arg[1].i = n;
+	inst->arg[2].i = ann->input;
+	inst->arg[3].r = ann->scale;
 	inst->whole = precision->whole;
 	inst->fraction = precision->fraction;
 	inst->precision = precision->precision;
@@ -206,6 +253,8 @@ emit_program_activate(struct g__ann *ann, const struct g__ir *ir, int program_)
 		inst->arg[2].i = precision->a_[l - 1];
 		inst->arg[3].i = n;
 		inst->arg[4].i = m;
+		inst->arg[5].i = stride(ann, m);
+		inst->layout = ann->layout;
 		inst->whole = precision->whole;
 		inst->fraction = precision->fraction;
 		inst->precision = precision->precision;
@@ -281,14 +330,48 @@ emit_program_backprop(struct g__ann *ann, const struct g__ir *ir, int program_)
 	inst->precision = precision->precision;
 
 	/*
+	 * per layer, from the last, once d_[l] is known:
+	 *
+	 * b_[*]:
+	 *    b_[l] := b_[l] + d_[l]
+	 *
+	 * w_[*]:
+	 *    w_[l] := w_[l] + d_[l] * a_[l - 1]
+	 *
 	 * d_[*]:
-	 *    d_[l] := (w[l+1]' * d_[l+1]) ⊙ σ′(a_[l])
-	 *    d_[1] := (w[l+1]' * d_[l+1])
+	 *    d_[l - 1] := (w[l]' * d_[l]) ⊙ σ′(a_[l - 1])
+	 *
+	 * so d_[l] is dead as soon as d_[l - 1] is (see plan())
 	 */
 
-	while (1 < l) {
+	while (1 <= l) {
 		n = (uint64_t)ir->nodes[l].size;
 		m = (uint64_t)ir->nodes[l - 1].size;
+		/*--*/
+		inst = newinst(program);
+		inst->opc = G__ANN_PROGRAM_INST_ADD;
+		inst->arg[0].i = precision->b_[l];
+		inst->arg[1].i = precision->d_[l];
+		inst->arg[2].i = n;
+		inst->whole = precision->whole;
+		inst->fraction = precision->fraction;
+		inst->precision = precision->precision;
+		/*--*/
+		inst = newinst(program);
+		inst->opc = G__ANN_PROGRAM_INST_MAC3;
+		inst->arg[0].i = precision->w_[l];
+		inst->arg[1].i = precision->d_[l];
+		inst->arg[2].i = precision->a_[l - 1];
+		inst->arg[3].i = n;
+		inst->arg[4].i = m;
+		inst->arg[5].i = stride(ann, m);
+		inst->layout = ann->layout;
+		inst->whole = precision->whole;
+		inst->fraction = precision->fraction;
+		inst->precision = precision->precision;
+		if (1 == l) {
+			break;
+		}
 		if (G__IR_ACTIVATION_SOFTMAX == ir->nodes[l - 1].activation) {
 
 			/*
@@ -307,6 +390,8 @@ emit_program_backprop(struct g__ann *ann, const struct g__ir *ir, int program_)
 		inst->arg[2].i = precision->d_[l];
 		inst->arg[3].i = n;
 		inst->arg[4].i = m;
+		inst->arg[5].i = stride(ann, m);
+		inst->layout = ann->layout;
 		inst->whole = precision->whole;
 		inst->fraction = precision->fraction;
 		inst->precision = precision->precision;
@@ -321,39 +406,6 @@ emit_program_backprop(struct g__ann *ann, const struct g__ir *ir, int program_)
 		inst->precision = precision->precision;
 		--l;
 	}
-
-	/*
-	 * b_[*]:
-	 *    b_[l] := b_[l] + d_[l]
-	 *
-	 * w_[*]:
-	 *    w_[l] := w_[l] + d_[l] * a_[l - 1]
-	 */
-
-	for (l=1; l<ann->layers; ++l) {
-		n = (uint64_t)ir->nodes[l].size;
-		m = (uint64_t)ir->nodes[l - 1].size;
-		/*--*/
-		inst = newinst(program);
-		inst->opc = G__ANN_PROGRAM_INST_ADD;
-		inst->arg[0].i = precision->b_[l];
-		inst->arg[1].i = precision->d_[l];
-		inst->arg[2].i = n;
-		inst->whole = precision->whole;
-		inst->fraction = precision->fraction;
-		inst->precision = precision->precision;
-		/*--*/
-		inst = newinst(program);
-		inst->opc = G__ANN_PROGRAM_INST_MAC3;
-		inst->arg[0].i = precision->w_[l];
-		inst->arg[1].i = precision->d_[l];
-		inst->arg[2].i = precision->a_[l - 1];
-		inst->arg[3].i = n;
-		inst->arg[4].i = m;
-		inst->whole = precision->whole;
-		inst->fraction = precision->fraction;
-		inst->precision = precision->precision;
-	}
 	return 0;
 }
 
@@ -385,13 +437,7 @@ emit_program_train(struct g__ann *ann, const struct g__ir *ir, int program_)
 	 *   b_[*] := 0
 	 */
 
-	size = 0;
-	for (l=1; l<ann->layers; ++l) {
-		n = (uint64_t)ir->nodes[l].size;
-		m = (uint64_t)ir->nodes[l - 1].size;
-		size += n * m;
-		size += n * 1;
-	}
+	size = precision->hard / unit(precision);
 	/*--*/
 	inst = newinst(program);
 	inst->opc = G__ANN_PROGRAM_INST_CLEAR;
@@ -416,6 +462,10 @@ emit_program_train(struct g__ann *ann, const struct g__ir *ir, int program_)
 	inst->arg[0].i = ir->batch;
 	inst->arg[1].i = n;
 	inst->arg[2].i = m;
+	inst->arg[3].i = G__ANN_PROGRAM_BACKPROP;
+	inst->whole = precision->whole;
+	inst->fraction = precision->fraction;
+	inst->precision = precision->precision;
 
 	/*
 	 * w[*]:
@@ -446,7 +496,7 @@ emit_program_train(struct g__ann *ann, const struct g__ir *ir, int program_)
 		inst->arg[1].i = precision->w_[l];
 		inst->arg[2].r = -((double)ir->optimizer.learning_rate /
 				   (double)ir->batch);
-		inst->arg[3].i = n * m;
+		inst->arg[3].i = rows(ann, n) * stride(ann, m);
 		inst->whole = precision->whole;
 		inst->fraction = precision->fraction;
 		inst->precision = precision->precision;
@@ -486,6 +536,319 @@ emit_program(struct g__ann *ann, const struct g__ir *ir)
 	return 0;
 }
 
+/*
+ * Liveness-based placement of scratch tensors past precision->scratch. The
+ * programs given form one timeline, each run from inst[1] with its return
+ * last. A tensor lives from its first to its last reference, the one
+ * returned to the end. Tensors go largest first to the lowest offset
+ * clear of every placed tensor whose lifetime overlaps theirs, then the
+ * address arguments of the programs and the addresses are rewritten.
+ * Returns the bytes used.
+ */
+
+struct buffer {
+	uint64_t *address; /* byte address */
+	uint64_t size;     /* bytes */
+	uint64_t offset;   /* bytes past scratch */
+	int placed;
+	int first;
+	int last;
+};
+
+static int
+address(const struct g__ann_program_inst *inst, int k)
+{
+	switch (inst->opc) {
+	case G__ANN_PROGRAM_INST_RETARG:
+	case G__ANN_PROGRAM_INST_RANDOM:
+	case G__ANN_PROGRAM_INST_CLEAR:
+	case G__ANN_PROGRAM_INST_COPYX:
+	case G__ANN_PROGRAM_INST_RELU:
+	case G__ANN_PROGRAM_INST_LINEAR:
+	case G__ANN_PROGRAM_INST_SOFTMAX:
+	case G__ANN_PROGRAM_INST_SIGMOID:
+		return 0 == k;
+	case G__ANN_PROGRAM_INST_MAC4:
+	case G__ANN_PROGRAM_INST_ADD:
+	case G__ANN_PROGRAM_INST_SUBY:
+	case G__ANN_PROGRAM_INST_SUBY_INDEX:
+	case G__ANN_PROGRAM_INST_RELUD:
+	case G__ANN_PROGRAM_INST_LINEARD:
+	case G__ANN_PROGRAM_INST_SOFTMAXD:
+	case G__ANN_PROGRAM_INST_SIGMOIDD:
+		return 1 >= k;
+	case G__ANN_PROGRAM_INST_MAC1:
+	case G__ANN_PROGRAM_INST_MAC2:
+	case G__ANN_PROGRAM_INST_MAC3:
+		return 2 >= k;
+	default:
+		return 0;
+	}
+}
+
+static int
+find(const struct buffer *buffer, int n, uint64_t address)
+{
+	int i;
+
+	for (i=0; i<n; ++i) {
+		if (address == (*buffer[i].address)) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static int
+overlap(const struct buffer *a, const struct buffer *b, uint64_t offset)
+{
+	return b->placed &&
+		(a->first <= b->last) &&
+		(b->first <= a->last) &&
+		(offset < (b->offset + b->size)) &&
+		(b->offset < (offset + a->size));
+}
+
+static uint64_t
+plan(struct g__ann *ann,
+     struct buffer *buffer,
+     int n,
+     const int *programs,
+     int count)
+{
+	struct g__ann_program *program;
+	struct g__ann_program_inst *inst;
+	uint64_t end;
+	int i, j, k, p, t;
+
+	/* lifetimes */
+
+	for (i=0; i<n; ++i) {
+		buffer[i].placed = 0;
+		buffer[i].first = -1;
+		buffer[i].last = -1;
+	}
+	for (t=0, p=0; p<count; ++p) {
+		program = &ann->program[programs[p]];
+		for (j=1; j<=program->size; ++j, ++t) {
+			inst = &program->inst[j % program->size];
+			for (k=0; k<6; ++k) {
+				i = address(inst, k) ?
+					find(buffer, n, inst->arg[k].i) :
+					-1;
+				if (0 > i) {
+					continue;
+				}
+				if (0 > buffer[i].first) {
+					buffer[i].first = t;
+				}
+				buffer[i].last = G__MAX(buffer[i].last, t);
+				if (G__ANN_PROGRAM_INST_RETARG == inst->opc) {
+					buffer[i].last = INT_MAX;
+				}
+			}
+		}
+	}
+
+	/* placement */
+
+	end = 0;
+	while (1) {
+		for (k=-1, i=0; i<n; ++i) {
+			if (!buffer[i].placed &&
+			    (0 <= buffer[i].first) &&
+			    ((0 > k) || (buffer[k].size < buffer[i].size))) {
+				k = i;
+			}
+		}
+		if (0 > k) {
+			break;
+		}
+		buffer[k].offset = 0;
+		for (i=0; i<n; ++i) {
+			if (overlap(&buffer[k], &buffer[i], buffer[k].offset)) {
+				buffer[k].offset = buffer[i].offset;
+				buffer[k].offset += buffer[i].size;
+				buffer[k].offset = align(ann, buffer[k].offset);
+				i = -1;
+			}
+		}
+		buffer[k].placed = 1;
+		end = G__MAX(end, buffer[k].offset + buffer[k].size);
+	}
+
+	/* rewrite */
+
+	for (p=0; p<count; ++p) {
+		program = &ann->program[programs[p]];
+		for (j=0; j<program->size; ++j) {
+			inst = &program->inst[j];
+			for (k=0; k<6; ++k) {
+				i = address(inst, k) ?
+					find(buffer, n, inst->arg[k].i) :
+					-1;
+				if (0 <= i) {
+					inst->arg[k].i = ann->precision.scratch;
+					inst->arg[k].i += buffer[i].offset;
+				}
+			}
+		}
+	}
+	for (i=0; i<n; ++i) {
+		if (buffer[i].placed) {
+			(*buffer[i].address) = ann->precision.scratch;
+			(*buffer[i].address) += buffer[i].offset;
+		}
+	}
+	return align(ann, end);
+}
+
+static void
+copy(struct g__ann *ann, int to, int from)
+{
+	ann->program[to].size = ann->program[from].size;
+	memcpy(ann->program[to].inst,
+	       ann->program[from].inst,
+	       ann->program[from].size * sizeof (struct g__ann_program_inst));
+}
+
+static int
+emit_plan(struct g__ann *ann)
+{
+	const int TRAINING[] = {
+		G__ANN_PROGRAM_ACTIVATE,
+		G__ANN_PROGRAM_BACKPROP
+	};
+	const int INFERENCE[] = {
+		G__ANN_PROGRAM_INFER
+	};
+	struct g__ann_precision *precision;
+	struct buffer *buffer;
+	uint64_t *a_;
+	int l, n;
+
+	precision = &ann->precision;
+	buffer = g__malloc(2 * ann->layers * sizeof (struct buffer));
+	a_ = g__malloc(ann->layers * sizeof (uint64_t));
+	if (!buffer || !a_) {
+		G__FREE(buffer);
+		G__FREE(a_);
+		G__DEBUG(0);
+		return -1;
+	}
+
+	/* contexts: ACTIVATE alone, a_[l] is dead once a_[l + 1] is known */
+
+	copy(ann, G__ANN_PROGRAM_INFER, G__ANN_PROGRAM_ACTIVATE);
+	memcpy(a_, precision->a_, ann->layers * sizeof (uint64_t));
+	for (n=0, l=0; l<ann->layers; ++l, ++n) {
+		buffer[n].address = &a_[l];
+		buffer[n].size = unit(precision) * ann->nodes[l];
+	}
+	precision->context = plan(ann, buffer, n, INFERENCE, 1);
+
+	/* model memory: ACTIVATE then BACKPROP of every training sample */
+
+	for (n=0, l=0; l<ann->layers; ++l) {
+		buffer[n].address = &precision->a_[l];
+		buffer[n].size = unit(precision) * ann->nodes[l];
+		++n;
+		if (l) {
+			buffer[n].address = &precision->d_[l];
+			buffer[n].size = unit(precision) * ann->nodes[l];
+			++n;
+		}
+	}
+	precision->size = precision->scratch;
+	precision->size += plan(ann, buffer, n, TRAINING, 2);
+	G__FREE(buffer);
+	G__FREE(a_);
+	return 0;
+}
+
+static void
+emit_labels(struct g__ann *ann)
+{
+	struct g__ann_program_inst *inst;
+	int i;
+
+	/* as planned, so the addresses are those of BACKPROP and TRAIN */
+
+	copy(ann, G__ANN_PROGRAM_LABELS, G__ANN_PROGRAM_BACKPROP);
+	copy(ann, G__ANN_PROGRAM_TRAIN_LABELS, G__ANN_PROGRAM_TRAIN);
+	for (i=0; i<ann->program[G__ANN_PROGRAM_LABELS].size; ++i) {
+		inst = &ann->program[G__ANN_PROGRAM_LABELS].inst[i];
+		if (G__ANN_PROGRAM_INST_SUBY == inst->opc) {
+			inst->opc = G__ANN_PROGRAM_INST_SUBY_INDEX;
+		}
+	}
+	for (i=0; i<ann->program[G__ANN_PROGRAM_TRAIN_LABELS].size; ++i) {
+		inst = &ann->program[G__ANN_PROGRAM_TRAIN_LABELS].inst[i];
+		if (G__ANN_PROGRAM_INST_BATCHLOOP == inst->opc) {
+			inst->arg[2].i = 1;
+			inst->arg[3].i = G__ANN_PROGRAM_LABELS;
+		}
+	}
+}
+
+static void
+emit_gather(struct g__ann *ann)
+{
+	struct g__ann_program_inst *inst;
+	int i;
+
+	copy(ann, G__ANN_PROGRAM_TRAIN_GATHER, G__ANN_PROGRAM_TRAIN);
+	for (i=0; i<ann->program[G__ANN_PROGRAM_TRAIN_GATHER].size; ++i) {
+		inst = &ann->program[G__ANN_PROGRAM_TRAIN_GATHER].inst[i];
+		if (G__ANN_PROGRAM_INST_BATCHLOOP == inst->opc) {
+			inst->arg[4].i = 1;
+		}
+	}
+}
+
+static void
+emit_into(struct g__ann *ann)
+{
+	struct g__ann_program *prog;
+	struct g__ann_program_inst *inst;
+	uint64_t x, y;
+	int i, k, last;
+
+	/* after planning, a_[0] and a_[L] are where COPYX and RETARG say */
+
+	copy(ann, G__ANN_PROGRAM_ACTIVATE_INTO, G__ANN_PROGRAM_ACTIVATE);
+	prog = &ann->program[G__ANN_PROGRAM_ACTIVATE_INTO];
+	assert( G__ANN_PROGRAM_INST_RETARG == prog->inst[0].opc );
+	assert( G__ANN_PROGRAM_INST_COPYX == prog->inst[1].opc );
+	x = prog->inst[1].arg[0].i;
+	y = prog->inst[0].arg[0].i;
+	prog->inst[0].opc = G__ANN_PROGRAM_INST_RET;
+	for (last=i=1; i<prog->size; ++i) {
+		if (G__ANN_PROGRAM_INST_MAC1 == prog->inst[i].opc) {
+			last = i;
+		}
+	}
+	for (i=last; i<prog->size; ++i) {
+		inst = &prog->inst[i];
+		for (k=0; k<6; ++k) {
+			if (address(inst, k) && (y == inst->arg[k].i)) {
+				inst->arg[k].i = G__ANN_ADDRESS_Y;
+			}
+		}
+	}
+	if (G__ANN_INPUT_REAL != ann->input) {
+		return;
+	}
+	inst = &prog->inst[2];
+	assert( G__ANN_PROGRAM_INST_MAC1 == inst->opc );
+	assert( x == inst->arg[2].i );
+	inst->arg[2].i = G__ANN_ADDRESS_X;
+	for (i=2; i<prog->size; ++i) {
+		prog->inst[i - 1] = prog->inst[i];
+	}
+	--prog->size;
+}
+
 struct g__ann *
 g__ann_open(const struct g__ir *ir)
 {
@@ -505,9 +868,14 @@ g__ann_open(const struct g__ir *ir)
 	}
 	memset(ann, 0, sizeof (struct g__ann));
 	ann->layers = ir->layers;
+	ann->batch = ir->batch;
 	ann->module = g__strdup(ir->module);
 	ann->prefix = g__strdup(ir->prefix);
 	ann->cuda = ir->cuda;
+	ann->schedule = ir->schedule;
+	ann->layout = ir->layout;
+	ann->input = ir->input;
+	ann->scale = ir->scale;
 	if (!ann->module || !ann->prefix) {
 		g__ann_close(ann);
 		G__DEBUG(0);
@@ -517,6 +885,15 @@ g__ann_open(const struct g__ir *ir)
 	/* memories */
 
 	n = ir->layers * sizeof (uint64_t);
+	ann->nodes = g__malloc(n);
+	if (!ann->nodes) {
+		g__ann_close(ann);
+		G__DEBUG(0);
+		return 0;
+	}
+	for (i=0; i<ir->layers; ++i) {
+		ann->nodes[i] = (uint64_t)ir->nodes[i].size;
+	}
 	precision = &ann->precision;
 	precision->w = g__malloc(n);
 	precision->b = g__malloc(n);
@@ -553,11 +930,16 @@ g__ann_open(const struct g__ir *ir)
 		}
 		memset(ann->program[i].inst, 0, n);
 	}
-	if (emit_precision(ann, ir) || emit_program(ann, ir)) {
+	if (emit_precision(ann, ir) ||
+	    emit_program(ann, ir) ||
+	    emit_plan(ann)) {
 		g__ann_close(ann);
 		G__DEBUG(0);
 		return 0;
 	}
+	emit_labels(ann);
+	emit_gather(ann);
+	emit_into(ann);
 	return ann;
 }
 
@@ -578,6 +960,7 @@ g__ann_close(struct g__ann *ann)
 		for (i=0; i<G__ANN_PROGRAM_END; ++i) {
 			G__FREE(ann->program[i].inst);
 		}
+		G__FREE(ann->nodes);
 		G__FREE(ann->module);
 		G__FREE(ann->prefix);
 		memset(ann, 0, sizeof (struct g__ann));
@@ -28,11 +28,32 @@
 #define G__ANN_PRECISION_DOUBLE G__IR_PRECISION_DOUBLE
 #define G__ANN_PRECISION_FIXED  G__IR_PRECISION_FIXED
 
-#define G__ANN_PROGRAM_INITIALIZE 0
-#define G__ANN_PROGRAM_ACTIVATE   1
-#define G__ANN_PROGRAM_BACKPROP   2
-#define G__ANN_PROGRAM_TRAIN      3
-#define G__ANN_PROGRAM_END        4
+#define G__ANN_SCHEDULE_SERIAL G__IR_SCHEDULE_SERIAL
+#define G__ANN_SCHEDULE_STALE  G__IR_SCHEDULE_STALE
+
+#define G__ANN_LAYOUT_PACKED  G__IR_LAYOUT_PACKED
+#define G__ANN_LAYOUT_ALIGNED G__IR_LAYOUT_ALIGNED
+#define G__ANN_LAYOUT_BLOCKED G__IR_LAYOUT_BLOCKED
+
+#define G__ANN_INPUT_REAL  G__IR_INPUT_REAL
+#define G__ANN_INPUT_UINT8 G__IR_INPUT_UINT8
+
+#define G__ANN_ALIGN 64 /* bytes, all but G__ANN_LAYOUT_PACKED */
+
+#define G__ANN_ADDRESS_X (~(uint64_t)0 - 1) /* x_ itself, ACTIVATE_INTO */
+#define G__ANN_ADDRESS_Y (~(uint64_t)0 - 2) /* y_ itself, ACTIVATE_INTO */
+#define G__ANN_PANEL  8 /* rows, G__ANN_LAYOUT_BLOCKED */
+
+#define G__ANN_PROGRAM_INITIALIZE     0
+#define G__ANN_PROGRAM_ACTIVATE       1
+#define G__ANN_PROGRAM_BACKPROP       2
+#define G__ANN_PROGRAM_TRAIN          3
+#define G__ANN_PROGRAM_INFER          4 /* ACTIVATE in a context, see below */
+#define G__ANN_PROGRAM_LABELS         5 /* BACKPROP to a class index */
+#define G__ANN_PROGRAM_TRAIN_LABELS   6 /* TRAIN by LABELS */
+#define G__ANN_PROGRAM_TRAIN_GATHER   7 /* TRAIN, samples by index or stride */
+#define G__ANN_PROGRAM_ACTIVATE_INTO  8 /* ACTIVATE, x_ and y_ in place */
+#define G__ANN_PROGRAM_END            9
 
 #define G__ANN_PROGRAM_INST_RET         1
 #define G__ANN_PROGRAM_INST_RETARG      2
@@ -46,6 +67,7 @@
 #define G__ANN_PROGRAM_INST_MAC4       17
 #define G__ANN_PROGRAM_INST_ADD        18
 #define G__ANN_PROGRAM_INST_SUBY       19
+#define G__ANN_PROGRAM_INST_SUBY_INDEX 20
 #define G__ANN_PROGRAM_INST_RELU      101
 #define G__ANN_PROGRAM_INST_LINEAR    102
 #define G__ANN_PROGRAM_INST_SOFTMAX   103
@@ -57,15 +79,23 @@
 
 struct g__ann {
 	int layers;
+	int batch;
+	uint64_t *nodes; /* layer sizes */
 	const char *module;
 	const char *prefix;
 	int cuda;
+	int schedule; /* G__ANN_SCHEDULE_*, g_train() of libgravity */
+	int layout;   /* G__ANN_LAYOUT_* */
+	int input;    /* G__ANN_INPUT_*, the values of x */
+	double scale; /* of the values of x */
 	struct g__ann_precision {
 		int whole;
 		int fraction;
 		int precision;
 		uint64_t size; /* bytes */
 		uint64_t hard; /* bytes */
+		uint64_t scratch; /* byte address, a_ and d_ past it */
+		uint64_t context; /* bytes, scratch of G__ANN_PROGRAM_INFER */
 		uint64_t *w;   /* byte address */
 		uint64_t *b;   /* byte address */
 		uint64_t *a_;  /* byte address */
@@ -80,14 +110,48 @@ struct g__ann {
 			int whole;
 			int fraction;
 			int precision;
+			int layout; /* of the weights of MAC1-3, RANDOM */
 			union {
 				uint64_t i;
 				double r;
-			} arg[5];
+			} arg[6]; /* MAC1-3, RANDOM: arg[5] row stride */
 		} *inst;
 	} program[G__ANN_PROGRAM_END];
 };
 
+/*
+ * With G__ANN_LAYOUT_BLOCKED the weights w[l] (and w_[l]) of n x m are kept
+ * in panels of G__ANN_PANEL rows, the panel of row i holding column j of its
+ * rows next to each other: element (i, j) is at i / PANEL * PANEL * m +
+ * j * PANEL + i % PANEL, n rounded up to a whole panel with zero rows.
+ *
+ * G__ANN_PROGRAM_LABELS is BACKPROP with SUBY_INDEX for SUBY, its y a class
+ * index (int32_t) per sample rather than a target vector: d_[L] := a_[L]
+ * minus one at the index. G__ANN_PROGRAM_TRAIN_LABELS is TRAIN with its
+ * BATCHLOOP running LABELS. BATCHLOOP's arg[3] names the program it runs
+ * after ACTIVATE and arg[2] is the y values per sample.
+ *
+ * G__ANN_PROGRAM_TRAIN_GATHER is TRAIN with arg[4] of its BATCHLOOP set:
+ * sample i is read at i_[i] (i if i_ is null) times the byte strides xs_
+ * and ys_ rather than back to back, see g_train_gather().
+ *
+ * G__ANN_PROGRAM_ACTIVATE_INTO is ACTIVATE without its copies: the output
+ * layer's instructions address G__ANN_ADDRESS_Y, the caller's y_, in place
+ * of a_[L] and the program returns nothing. With real input (not uint8,
+ * which has to be converted) COPYX is dropped as well and the first MAC1
+ * reads G__ANN_ADDRESS_X, x_ itself, in place of a_[0].
+ *
+ * COPYX brings x into a_[0] in the model's precision. With x of
+ * G__ANN_INPUT_UINT8 (arg[2]) each byte is converted and multiplied by the
+ * scale (arg[3]) on the way, so the caller hands in raw bytes.
+ *
+ * The scratch tensors a_ and d_ share memory wherever their lifetimes over
+ * ACTIVATE and BACKPROP allow, and a_ and d_ above are the addresses that
+ * result. G__ANN_PROGRAM_INFER is ACTIVATE planned on its own, for contexts
+ * that only ever activate: its addresses past scratch are context offsets
+ * (context bytes in all) and a_[l] reuses the memory of layers before.
+ */
+
 struct g__ann *g__ann_open(const struct g__ir *ir);
 
 void g__ann_close(struct g__ann *an);
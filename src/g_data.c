@@ -0,0 +1,334 @@
+/**
+ * g_data.c
+ * Copyright (C) Tony Givargis, 2019-2020
+ *
+ * This file is part of The Gravity Compiler.
+ *
+ * The Gravity Compiler is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version. The Gravity Compiler is distributed in
+ * the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE. See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with Foobar.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include "g_data.h"
+
+#define MAGIC "GRVT"
+#define ORDER 0x01020304
+#define HEADER 64 /* bytes of the raw header, elements 64-byte aligned */
+
+struct g__data {
+	void *map;
+	size_t length;
+	char *copy; /* converted IDX elements, null if used in place */
+	const char *base; /* sample 0 */
+	uint64_t size; /* bytes per sample */
+	uint64_t dims[G__DATA_RANK];
+	int type;
+	int rank;
+};
+
+static uint32_t
+big(const unsigned char *p)
+{
+	return ((uint32_t)p[0] << 24) |
+		((uint32_t)p[1] << 16) |
+		((uint32_t)p[2] <<  8) |
+		((uint32_t)p[3] <<  0);
+}
+
+int
+g__data_unit(int type)
+{
+	switch (type) {
+	case G__DATA_UINT8 : return 1;
+	case G__DATA_INT8  : return 1;
+	case G__DATA_INT16 : return 2;
+	case G__DATA_INT32 : return 4;
+	case G__DATA_FLOAT : return 4;
+	case G__DATA_DOUBLE: return 8;
+	default /*------*/ : break;
+	}
+	return 0;
+}
+
+/* reverses the bytes of each of the n elements of w bytes at p */
+
+static void
+swap(char *p, uint64_t n, int w)
+{
+	uint64_t i;
+	int j;
+	char t;
+
+	for (i=0; i<n; ++i, p+=w) {
+		for (j=0; j<(w / 2); ++j) {
+			t = p[j];
+			p[j] = p[w - 1 - j];
+			p[w - 1 - j] = t;
+		}
+	}
+}
+
+static int
+host_big(void)
+{
+	const uint32_t one = 1;
+
+	return !*(const char *)&one;
+}
+
+/* type, rank and dims of the header, returns its bytes or 0 if invalid */
+
+static size_t
+header(struct g__data *data)
+{
+	const unsigned char *p;
+	uint32_t order, type, rank;
+	uint64_t dims[G__DATA_RANK];
+	int i;
+
+	p = (const unsigned char *)data->map;
+	if ((HEADER <= data->length) && !memcmp(p, MAGIC, 4)) {
+		memcpy(&order, p + 4, 4);
+		memcpy(&type, p + 8, 4);
+		memcpy(&rank, p + 12, 4);
+		memcpy(dims, p + 16, sizeof (dims));
+		if ((ORDER != order) || (1 > rank) || (G__DATA_RANK < rank)) {
+			return 0;
+		}
+		data->type = (int)type;
+		data->rank = (int)rank;
+		for (i=0; i<data->rank; ++i) {
+			data->dims[i] = dims[i];
+		}
+		return HEADER;
+	}
+	if ((4 <= data->length) && !p[0] && !p[1]) {
+		data->type = p[2];
+		data->rank = p[3];
+		if ((1 > data->rank) ||
+		    (G__DATA_RANK < data->rank) ||
+		    ((4 + 4 * (size_t)data->rank) > data->length)) {
+			return 0;
+		}
+		for (i=0; i<data->rank; ++i) {
+			data->dims[i] = big(p + 4 + 4 * i);
+		}
+		return 4 + 4 * (size_t)data->rank;
+	}
+	return 0;
+}
+
+g__data_t
+g__data_open(const char *pathname)
+{
+	struct g__data *data;
+	struct stat st;
+	size_t offset;
+	uint64_t n;
+	int fd, i, idx;
+
+	if (!g__strlen(pathname)) {
+		G__DEBUG(G__ERR_ARGUMENT);
+		return 0;
+	}
+	data = g__malloc(sizeof (struct g__data));
+	if (!data) {
+		G__DEBUG(0);
+		return 0;
+	}
+	memset(data, 0, sizeof (struct g__data));
+	fd = open(pathname, O_RDONLY);
+	if ((0 > fd) || fstat(fd, &st) || (0 >= st.st_size)) {
+		if (0 <= fd) {
+			close(fd);
+		}
+		g__data_close(data);
+		G__DEBUG(G__ERR_FILE);
+		return 0;
+	}
+
+	/* read-only, the pages are the page cache's */
+
+	data->length = (size_t)st.st_size;
+	data->map = mmap(0, data->length, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (MAP_FAILED == data->map) {
+		data->map = 0;
+		g__data_close(data);
+		G__DEBUG(G__ERR_SYSTEM);
+		return 0;
+	}
+	offset = header(data);
+	if (!offset || !g__data_unit(data->type)) {
+		g__data_close(data);
+		G__DEBUG(G__ERR_FILE);
+		return 0;
+	}
+	idx = (HEADER != offset);
+
+	/* elements, overflow checked, must all be in the file */
+
+	n = 1;
+	for (i=0; i<data->rank; ++i) {
+		if (!data->dims[i] || (((uint64_t)-1 / data->dims[i]) < n)) {
+			g__data_close(data);
+			G__DEBUG(G__ERR_FILE);
+			return 0;
+		}
+		n *= data->dims[i];
+	}
+	if ((((uint64_t)-1 / g__data_unit(data->type)) < n) ||
+	    ((data->length - offset) < (n * g__data_unit(data->type)))) {
+		g__data_close(data);
+		G__DEBUG(G__ERR_FILE);
+		return 0;
+	}
+	data->base = (const char *)data->map + offset;
+	data->size = n / data->dims[0] * g__data_unit(data->type);
+
+	/*
+	 * Multi-byte IDX elements, big-endian and 4 + 4 * rank bytes into the
+	 * file (misaligned for a double at an even rank), are converted once
+	 * into an aligned copy unless usable in place.
+	 */
+
+	if (idx &&
+	    (1 < g__data_unit(data->type)) &&
+	    (!host_big() || (offset % g__data_unit(data->type)))) {
+		n *= g__data_unit(data->type);
+		data->copy = g__malloc((size_t)n);
+		if (!data->copy) {
+			g__data_close(data);
+			G__DEBUG(0);
+			return 0;
+		}
+		memcpy(data->copy, data->base, (size_t)n);
+		if (!host_big()) {
+			swap(data->copy,
+			     n / g__data_unit(data->type),
+			     g__data_unit(data->type));
+		}
+		munmap(data->map, data->length);
+		data->map = 0;
+		data->base = data->copy;
+	}
+	return data;
+}
+
+void
+g__data_close(g__data_t data)
+{
+	if (data) {
+		if (data->map) {
+			munmap(data->map, data->length);
+		}
+		G__FREE(data->copy);
+		memset(data, 0, sizeof (struct g__data));
+		G__FREE(data);
+	}
+}
+
+int
+g__data_type(g__data_t data)
+{
+	assert( data );
+
+	return data->type;
+}
+
+uint64_t
+g__data_dim(g__data_t data, int i)
+{
+	assert( data );
+
+	return ((0 <= i) && (i < data->rank)) ? data->dims[i] : 0;
+}
+
+uint64_t
+g__data_size(g__data_t data)
+{
+	assert( data );
+
+	return data->size;
+}
+
+const void *
+g__data_sample(g__data_t data, uint64_t i)
+{
+	assert( data );
+
+	return (i < data->dims[0]) ? (data->base + i * data->size) : 0;
+}
+
+int
+g__data_save(const char *pathname,
+	     int type,
+	     const uint64_t *dims,
+	     int rank,
+	     const void *x)
+{
+	unsigned char head[HEADER];
+	uint32_t u;
+	size_t n;
+	FILE *file;
+	int i;
+
+	if (!g__strlen(pathname) ||
+	    !g__data_unit(type) ||
+	    !dims ||
+	    (1 > rank) ||
+	    (G__DATA_RANK < rank) ||
+	    !x) {
+		G__DEBUG(G__ERR_ARGUMENT);
+		return -1;
+	}
+	memset(head, 0, sizeof (head));
+	memcpy(head, MAGIC, 4);
+	u = ORDER;
+	memcpy(head + 4, &u, 4);
+	u = (uint32_t)type;
+	memcpy(head + 8, &u, 4);
+	u = (uint32_t)rank;
+	memcpy(head + 12, &u, 4);
+	/* bytes of x, overflow checked */
+
+	n = (size_t)g__data_unit(type);
+	for (i=0; i<rank; ++i) {
+		if (!dims[i] || (((size_t)-1 / n) < dims[i])) {
+			G__DEBUG(G__ERR_ARGUMENT);
+			return -1;
+		}
+		memcpy(head + 16 + 8 * i, &dims[i], 8);
+		n *= (size_t)dims[i];
+	}
+	file = fopen(pathname, "w");
+	if (!file) {
+		G__DEBUG(G__ERR_FILE);
+		return -1;
+	}
+	if ((sizeof (head) != fwrite(head, 1, sizeof (head), file)) ||
+	    (n != fwrite(x, 1, n, file))) {
+		fclose(file);
+		G__DEBUG(G__ERR_FILE);
+		return -1;
+	}
+	if (fclose(file)) {
+		G__DEBUG(G__ERR_FILE);
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,74 @@
+/**
+ * g_data.h
+ * Copyright (C) Tony Givargis, 2019-2020
+ *
+ * This file is part of The Gravity Compiler.
+ *
+ * The Gravity Compiler is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version. The Gravity Compiler is distributed in
+ * the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE. See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with Foobar.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _G_DATA_H_
+#define _G_DATA_H_
+
+#include "g_common.h"
+
+#define G__DATA_UINT8  0x08 /* element types, the codes of IDX */
+#define G__DATA_INT8   0x09
+#define G__DATA_INT16  0x0B
+#define G__DATA_INT32  0x0C
+#define G__DATA_FLOAT  0x0D
+#define G__DATA_DOUBLE 0x0E
+
+#define G__DATA_RANK 6 /* most dimensions */
+
+/* bytes of an element of type G__DATA_*, zero if unknown */
+
+int g__data_unit(int type);
+
+/*
+ * A dataset file mapped into memory, samples being its slices along the
+ * first dimension. Either an IDX file (the format of MNIST, big-endian) or
+ * a raw tensor file of g__data_save(): a 64-byte header (magic "GRVT",
+ * uint32_t byte order mark 0x01020304, type, rank, then G__DATA_RANK
+ * uint64_t dimensions) followed by the elements in host order. Single
+ * byte and raw elements are used in place from a read-only mapping;
+ * multi-byte IDX elements are converted once into an aligned copy.
+ */
+
+typedef struct g__data *g__data_t;
+
+g__data_t g__data_open(const char *pathname);
+
+void g__data_close(g__data_t data);
+
+/* G__DATA_* */
+
+int g__data_type(g__data_t data);
+
+/* dimension i, zero past the last */
+
+uint64_t g__data_dim(g__data_t data, int i);
+
+/* bytes of one sample */
+
+uint64_t g__data_size(g__data_t data);
+
+/* sample i, null past the last */
+
+const void *g__data_sample(g__data_t data, uint64_t i);
+
+int g__data_save(const char *pathname,
+		 int type,
+		 const uint64_t *dims,
+		 int rank,
+		 const void *x);
+
+#endif /* _G_DATA_H_ */
@@ -15,10 +15,16 @@
  * If not, see <https://www.gnu.org/licenses/>.
  */
 
+#define _POSIX_C_SOURCE 200112L
+
 #include "g_emitc.h"
 
 #define UL(x) ((unsigned long)(x))
 
+#define BLOCK 16 /* activate_batch: samples per pass over the weights */
+
+#define PARALLEL_MIN 16384 /* MACs below this stay on the calling thread */
+
 #define P print
 
 static const char *
@@ -84,6 +90,52 @@ type(uint64_t x)
 	return "uint64_t";
 }
 
+/* the values of x_ */
+
+static const char *
+input(const struct g__ann *ann)
+{
+	if (G__ANN_INPUT_UINT8 == ann->input) {
+		return "uint8_t";
+	}
+	return precision(&ann->program[G__ANN_PROGRAM_ACTIVATE].inst[0]);
+}
+
+/*
+ * How an instruction's memory offsets are spelled in the emitted code.
+ * Offsets below split address lo, the rest address hi rebased to zero.
+ * The plain view is lo = hi = "m_" with no split.
+ */
+
+struct view {
+	const char *lo;
+	const char *hi;
+	uint64_t split;
+};
+
+static const struct view M_ = { "m_", "m_", (uint64_t)-1 };
+
+static const char *
+vb(const struct view *view, uint64_t offset)
+{
+	if (G__ANN_ADDRESS_X == offset) {
+		return "(const char *)x_";
+	}
+	if (G__ANN_ADDRESS_Y == offset) {
+		return "(char *)y_";
+	}
+	return (offset < view->split) ? view->lo : view->hi;
+}
+
+static unsigned long
+vo(const struct view *view, uint64_t offset)
+{
+	if ((G__ANN_ADDRESS_X == offset) || (G__ANN_ADDRESS_Y == offset)) {
+		return 0;
+	}
+	return UL((offset < view->split) ? offset : (offset - view->split));
+}
+
 static int
 inst_ret(const struct g__ann_program_inst *inst, FILE *file)
 {
@@ -99,14 +151,17 @@ inst_ret(const struct g__ann_program_inst *inst, FILE *file)
 }
 
 static int
-inst_retarg(const struct g__ann_program_inst *inst, FILE *file)
+inst_retarg(const struct g__ann_program_inst *inst,
+	    const struct view *view,
+	    FILE *file)
 {
 	if (P(file,
 	      "  { /* RETARG */\n"
-	      "    return (%s *)( m_ + %lu );\n"
+	      "    return (%s *)( %s + %lu );\n"
 	      "  }\n",
 	      precision(inst),
-	      UL(inst->arg[0].i))) {
+	      vb(view, inst->arg[0].i),
+	      vo(view, inst->arg[0].i))) {
 		G__DEBUG(0);
 		return -1;
 	}
@@ -114,19 +169,50 @@ inst_retarg(const struct g__ann_program_inst *inst, FILE *file)
 }
 
 static int
-inst_batchloop(const struct g__ann_program_inst *inst, FILE *file)
+inst_batchloop(const struct g__ann *ann,
+	       const struct g__ann_program_inst *inst,
+	       FILE *file)
 {
+	const char *prefix;
+
+	prefix = ann->prefix;
+	if (inst->arg[4].i) {
+		if (P(file,
+		      "  { /* BATCHLOOP, gather */\n"
+		      "    size_t i, j;\n"
+		      "    for (i=0; i<%lu; ++i) {\n"
+		      "        j = i_ ? i_[i] : i;\n"
+		      "        %s_activate_(m_, (const %s *)(x_ + j * xs_));\n"
+		      "        %s_backprop%s_(m_, (const %s *)(y_ + j * ys_));\n"
+		      "    }\n"
+		      "  }\n\n",
+		      UL(inst->arg[0].i),
+		      prefix,
+		      input(ann),
+		      prefix,
+		      (G__ANN_PROGRAM_LABELS == inst->arg[3].i) ? "_labels" : "",
+		      (G__ANN_PROGRAM_LABELS == inst->arg[3].i) ?
+		      "int32_t" :
+		      precision(inst))) {
+			G__DEBUG(0);
+			return -1;
+		}
+		return 0;
+	}
 	if (P(file,
 	      "  { /* BATCHLOOP */\n"
 	      "    %s i;\n"
 	      "    for (i=0; i<%lu; ++i) {\n"
-	      "        _activate_(m_, x_ + i * %lu);\n"
-	      "        _backprop_(m_, y_ + i * %lu);\n"
+	      "        %s_activate_(m_, x_ + i * %lu);\n"
+	      "        %s_backprop%s_(m_, y_ + i * %lu);\n"
 	      "    }\n"
 	      "  }\n\n",
 	      type(inst->arg[0].i * G__MAX(inst->arg[1].i, inst->arg[2].i)),
 	      UL(inst->arg[0].i),
+	      prefix,
 	      UL(inst->arg[1].i),
+	      prefix,
+	      (G__ANN_PROGRAM_LABELS == inst->arg[3].i) ? "_labels" : "",
 	      UL(inst->arg[2].i))) {
 		G__DEBUG(0);
 		return -1;
@@ -134,12 +220,72 @@ inst_batchloop(const struct g__ann_program_inst *inst, FILE *file)
 	return 0;
 }
 
+/* index of weight (i, j) of inst (MAC1-3, RANDOM), i and j expressions */
+
+static int
+element(const struct g__ann_program_inst *inst,
+	const char *i,
+	const char *j,
+	FILE *file)
+{
+	if (G__ANN_LAYOUT_BLOCKED == inst->layout) {
+		return P(file,
+			 "%s / %d * %lu + %s * %d + %s %% %d",
+			 i,
+			 G__ANN_PANEL,
+			 UL(G__ANN_PANEL * inst->arg[4].i),
+			 j,
+			 G__ANN_PANEL,
+			 i,
+			 G__ANN_PANEL);
+	}
+	return P(file, "%s * %lu + %s", i, UL(inst->arg[5].i), j);
+}
+
 static int
-inst_random(const struct g__ann_program_inst *inst, FILE *file)
+inst_random(const struct g__ann_program_inst *inst,
+	    const struct view *view,
+	    FILE *file)
 {
+	if ((inst->arg[4].i != inst->arg[5].i) ||
+	    (G__ANN_LAYOUT_BLOCKED == inst->layout)) {
+
+		/*
+		 * arg[4] values per row, rows arg[5] apart or in panels
+		 */
+
+		if (P(file,
+		      "  { /* RANDOM */\n"
+		      "    %s r, *z = (%s *)( %s + %lu );\n"
+		      "    %s i, j;\n"
+		      "    for (i=0; i<%lu; ++i) {\n"
+		      "      for (j=0; j<%lu; ++j) {\n"
+		      "        r = (%s)rand() / RAND_MAX;\n"
+		      "        z[",
+		      precision(inst),
+		      precision(inst),
+		      vb(view, inst->arg[0].i),
+		      vo(view, inst->arg[0].i),
+		      type(inst->arg[3].i + G__ANN_PANEL * inst->arg[4].i),
+		      UL(inst->arg[3].i / inst->arg[5].i),
+		      UL(inst->arg[4].i),
+		      precision(inst)) ||
+		    element(inst, "i", "j", file) ||
+		    P(file,
+		      "] = %f + r * %f;\n"
+		      "      }\n"
+		      "    }\n"
+		      "  }\n\n",
+		      inst->arg[1].r,
+		      inst->arg[2].r)) {
+			G__DEBUG(0);
+			return -1;
+		}
+		return 0;
+	}
 	if (P(file,
 	      "  { /* RANDOM */\n"
-	      "    %s r, *z = (%s *)( m_ + %lu );\n"
+	      "    %s r, *z = (%s *)( %s + %lu );\n"
 	      "    %s i;\n"
 	      "    for (i=0; i<%lu; ++i) {\n"
   		  "      r = (%s)rand() / RAND_MAX;\n"
@@ -148,7 +294,8 @@ inst_random(const struct g__ann_program_inst *inst, FILE *file)
 	      "  }\n\n",
 	      precision(inst),
 	      precision(inst),
-	      UL(inst->arg[0].i),
+	      vb(view, inst->arg[0].i),
+	      vo(view, inst->arg[0].i),
 	      type(inst->arg[3].i),
 	      UL(inst->arg[3].i),
 	      precision(inst),
@@ -161,13 +308,16 @@ inst_random(const struct g__ann_program_inst *inst, FILE *file)
 }
 
 static int
-inst_clear(const struct g__ann_program_inst *inst, FILE *file)
+inst_clear(const struct g__ann_program_inst *inst,
+	   const struct view *view,
+	   FILE *file)
 {
 	if (P(file,
 	      "  { /* CLEAR */\n"
-	      "    memset(m_ + %lu, 0, %lu * sizeof (%s));\n"
+	      "    memset(%s + %lu, 0, %lu * sizeof (%s));\n"
 	      "  }\n\n",
-	      UL(inst->arg[0].i),
+	      vb(view, inst->arg[0].i),
+	      vo(view, inst->arg[0].i),
 	      UL(inst->arg[1].i),
 	      precision(inst))) {
 		G__DEBUG(0);
@@ -177,13 +327,44 @@ inst_clear(const struct g__ann_program_inst *inst, FILE *file)
 }
 
 static int
-inst_copyx(const struct g__ann_program_inst *inst, FILE *file)
+inst_copyx(const struct g__ann_program_inst *inst,
+	   const struct view *view,
+	   FILE *file)
 {
+	if (G__ANN_INPUT_UINT8 == inst->arg[2].i) {
+
+		/*
+		 * bytes converted and scaled on the way in
+		 */
+
+		if (P(file,
+		      "  { /* COPYX */\n"
+		      "    %s *z = (%s *)( %s + %lu );\n"
+		      "    %s i;\n"
+		      "    for (i=0; i<%lu; ++i) {\n"
+		      "      z[i] = (%s)x_[i] * (%s)%.17g;\n"
+		      "    }\n"
+		      "  }\n\n",
+		      precision(inst),
+		      precision(inst),
+		      vb(view, inst->arg[0].i),
+		      vo(view, inst->arg[0].i),
+		      type(inst->arg[1].i),
+		      UL(inst->arg[1].i),
+		      precision(inst),
+		      precision(inst),
+		      inst->arg[3].r)) {
+			G__DEBUG(0);
+			return -1;
+		}
+		return 0;
+	}
 	if (P(file,
 	      "  { /* COPYX */\n"
-	      "    memcpy(m_ + %lu, x_, %lu * sizeof (%s));\n"
+	      "    memcpy(%s + %lu, x_, %lu * sizeof (%s));\n"
 	      "  }\n\n",
-	      UL(inst->arg[0].i),
+	      vb(view, inst->arg[0].i),
+	      vo(view, inst->arg[0].i),
 	      UL(inst->arg[1].i),
 	      precision(inst))) {
 		G__DEBUG(0);
@@ -192,36 +373,311 @@ inst_copyx(const struct g__ann_program_inst *inst, FILE *file)
 	return 0;
 }
 
+/*
+ * MAC1-3 on weights in panels of G__ANN_PANEL rows (G__ANN_LAYOUT_BLOCKED):
+ * the rows of a panel are the vector lanes, A read with unit stride, and the
+ * tile/unroll/interchange strategies do not apply. MAC1 keeps the lane loop
+ * outermost, which compilers vectorize across the panel rather than along
+ * the row (strided gathers). The lanes past n in the last panel are
+ * computed on zero rows but neither read against a vector element nor
+ * written out.
+ */
+
+static void
+lanes(const struct g__ann_program_inst *inst, char *s, size_t size)
+{
+	uint64_t n;
+
+	n = inst->arg[3].i;
+	if (n % G__ANN_PANEL) {
+		g__sprintf(s,
+			   size,
+			   "((%lu - i) < %d ? (%lu - i) : %d)",
+			   UL(n),
+			   G__ANN_PANEL,
+			   UL(n),
+			   G__ANN_PANEL);
+		return;
+	}
+	g__sprintf(s, size, "%d", G__ANN_PANEL);
+}
+
+static int
+panel_head(const struct g__ann_program_inst *inst,
+	   const char *z,
+	   const struct view *view,
+	   FILE *file)
+{
+	return P(file,
+		 "    %s *%s = (%s *)( %s + %lu );\n"
+		 "    const %s *%s = (const %s *)( %s + %lu );\n"
+		 "    const %s *%s = (const %s *)( %s + %lu );\n"
+		 "    %s i, j, k, h;\n",
+		 precision(inst),
+		 z,
+		 precision(inst),
+		 vb(view, inst->arg[0].i),
+		 vo(view, inst->arg[0].i),
+		 precision(inst),
+		 (G__ANN_PROGRAM_INST_MAC3 == inst->opc) ? "B" : "A",
+		 precision(inst),
+		 vb(view, inst->arg[1].i),
+		 vo(view, inst->arg[1].i),
+		 precision(inst),
+		 (G__ANN_PROGRAM_INST_MAC3 == inst->opc) ? "C" : "B",
+		 precision(inst),
+		 vb(view, inst->arg[2].i),
+		 vo(view, inst->arg[2].i),
+		 type(inst->arg[3].i * inst->arg[4].i +
+		      G__ANN_PANEL * inst->arg[4].i));
+}
+
+static int
+inst_panel1(const struct g__ann_program_inst *inst,
+	    const struct g__ann_program_inst *bias,
+	    const struct view *view,
+	    FILE *file)
+{
+	char h[64];
+	int e;
+
+	lanes(inst, h, sizeof (h));
+	e = P(file, "  { /* MAC1 */\n") || panel_head(inst, "z", view, file);
+	if (bias) {
+		e = e || P(file,
+			   "    const %s *b = (const %s *)( %s + %lu );\n",
+			   precision(inst),
+			   precision(inst),
+			   vb(view, bias->arg[1].i),
+			   vo(view, bias->arg[1].i));
+	}
+	e = e ||
+		P(file,
+		  "    %s s[%d];\n"
+		  "    for (i=0; i<%lu; i+=%d) {\n"
+		  "      for (k=0; k<%d; ++k) {\n"
+		  "        s[k] = 0.0;\n"
+		  "        for (j=0; j<%lu; ++j) {\n"
+		  "          s[k] += A[i * %lu + j * %d + k] * B[j];\n"
+		  "        }\n"
+		  "      }\n"
+		  "      h = %s;\n"
+		  "      for (k=0; k<h; ++k) {\n"
+		  "        z[i + k] = %ss[k];\n"
+		  "      }\n"
+		  "    }\n"
+		  "  }\n\n",
+		  precision(inst),
+		  G__ANN_PANEL,
+		  UL(inst->arg[3].i),
+		  G__ANN_PANEL,
+		  G__ANN_PANEL,
+		  UL(inst->arg[4].i),
+		  UL(inst->arg[4].i),
+		  G__ANN_PANEL,
+		  h,
+		  bias ? "b[i + k] + " : "");
+	if (e) {
+		G__DEBUG(0);
+		return -1;
+	}
+	return 0;
+}
+
 static int
-inst_mul1(const struct g__ann_program_inst *inst, FILE *file)
+inst_panel2(const struct g__ann_program_inst *inst,
+	    const struct view *view,
+	    FILE *file)
 {
-	if (P(file,
-	      "  { /* MAC1 */\n"
-	      "    %s *z = (%s *)( m_ + %lu );\n"
-	      "    const %s *A = (const %s *)( m_ + %lu );\n"
-	      "    const %s *B = (const %s *)( m_ + %lu );\n"
-	      "    %s i, j;\n",
-	      precision(inst),
-	      precision(inst),
-	      UL(inst->arg[0].i),
-	      precision(inst),
-	      precision(inst),
-	      UL(inst->arg[1].i),
-	      precision(inst),
+	char h[64];
+
+	lanes(inst, h, sizeof (h));
+	if (P(file, "  { /* MAC2 */\n") ||
+	    panel_head(inst, "z", view, file) ||
+	    P(file,
+	      "    %s s;\n"
+	      "    for (j=0; j<%lu; ++j) {\n"
+	      "      z[j] = 0.0;\n"
+	      "    }\n"
+	      "    for (i=0; i<%lu; i+=%d) {\n"
+	      "      h = %s;\n"
+	      "      for (j=0; j<%lu; ++j) {\n"
+	      "        s = 0.0;\n"
+	      "        for (k=0; k<h; ++k) {\n"
+	      "          s += A[i * %lu + j * %d + k] * B[i + k];\n"
+	      "        }\n"
+	      "        z[j] += s;\n"
+	      "      }\n"
+	      "    }\n"
+	      "  }\n\n",
 	      precision(inst),
-	      UL(inst->arg[2].i),
-	      type(G__MAX(inst->arg[3].i, inst->arg[4].i))) ||
+	      UL(inst->arg[4].i),
+	      UL(inst->arg[3].i),
+	      G__ANN_PANEL,
+	      h,
+	      UL(inst->arg[4].i),
+	      UL(inst->arg[4].i),
+	      G__ANN_PANEL)) {
+		G__DEBUG(0);
+		return -1;
+	}
+	return 0;
+}
+
+static int
+inst_panel3(const struct g__ann_program_inst *inst,
+	    const struct view *view,
+	    FILE *file)
+{
+	char h[64];
+
+	lanes(inst, h, sizeof (h));
+	if (P(file, "  { /* MAC3 */\n") ||
+	    panel_head(inst, "za", view, file) ||
 	    P(file,
-	      "    for (i=0; i<%lu; ++i) {\n"
-	      "      z[i] = 0.0;\n"
+	      "    for (i=0; i<%lu; i+=%d) {\n"
+	      "      h = %s;\n"
 	      "      for (j=0; j<%lu; ++j) {\n"
-	      "        z[i] += A[i * %lu + j] * B[j];\n"
+	      "        for (k=0; k<h; ++k) {\n"
+	      "          za[i * %lu + j * %d + k] += B[i + k] * C[j];\n"
+	      "        }\n"
 	      "      }\n"
 	      "    }\n"
 	      "  }\n\n",
 	      UL(inst->arg[3].i),
+	      G__ANN_PANEL,
+	      h,
+	      UL(inst->arg[4].i),
 	      UL(inst->arg[4].i),
-	      UL(inst->arg[4].i))) {
+	      G__ANN_PANEL)) {
+		G__DEBUG(0);
+		return -1;
+	}
+	return 0;
+}
+
+static int
+inst_mul1(const struct g__ann_program_inst *inst,
+	  const struct g__ann_program_inst *bias,
+	  const struct g__emitc_strategy *strategy,
+	  const struct view *view,
+	  FILE *file)
+{
+	uint64_t n, m, ld, t, u, r, k;
+	int e;
+
+	/*
+	 * z := A * B, computed tile rows at a time with unroll partial sums
+	 * per row, the bias (ADD following) is folded in when given
+	 */
+
+	if (G__ANN_LAYOUT_BLOCKED == inst->layout) {
+		return inst_panel1(inst, bias, view, file);
+	}
+	n = inst->arg[3].i;
+	m = inst->arg[4].i;
+	ld = inst->arg[5].i;
+	t = (uint64_t)G__MAX(1, strategy->tile);
+	u = (uint64_t)G__MAX(1, strategy->unroll);
+	t = G__MIN(t, n);
+	u = G__MIN(u, m);
+	e = P(file,
+	      "  { /* MAC1 */\n"
+	      "    %s *z = (%s *)( %s + %lu );\n"
+	      "    const %s *A = (const %s *)( %s + %lu );\n"
+	      "    const %s *B = (const %s *)( %s + %lu );\n",
+	      precision(inst),
+	      precision(inst),
+	      vb(view, inst->arg[0].i),
+	      vo(view, inst->arg[0].i),
+	      precision(inst),
+	      precision(inst),
+	      vb(view, inst->arg[1].i),
+	      vo(view, inst->arg[1].i),
+	      precision(inst),
+	      precision(inst),
+	      vb(view, inst->arg[2].i),
+	      vo(view, inst->arg[2].i));
+	if (bias) {
+		e = e || P(file,
+			   "    const %s *b = (const %s *)( %s + %lu );\n",
+			   precision(inst),
+			   precision(inst),
+			   vb(view, bias->arg[1].i),
+			   vo(view, bias->arg[1].i));
+	}
+	e = e ||
+		P(file,
+		  "    %s s[%lu];\n"
+		  "    %s i, j;\n"
+		  "    for (i=0; i<%lu; i+=%lu) {\n",
+		  precision(inst),
+		  UL(t * u),
+		  type(G__MAX(n, m)),
+		  UL(n / t * t),
+		  UL(t));
+	for (k=0; k<t*u; ++k) {
+		e = e || P(file, "      s[%lu] = 0.0;\n", UL(k));
+	}
+	e = e ||
+		P(file,
+		  "      for (j=0; j<%lu; j+=%lu) {\n",
+		  UL(m / u * u),
+		  UL(u));
+	for (r=0; r<t; ++r) {
+		for (k=0; k<u; ++k) {
+			e = e ||
+				P(file,
+				  "        s[%lu] += A[(i + %lu) * %lu + j + %lu]"
+				  " * B[j + %lu];\n",
+				  UL(r * u + k),
+				  UL(r),
+				  UL(ld),
+				  UL(k),
+				  UL(k));
+		}
+	}
+	e = e || P(file, "      }\n");
+	if (m % u) {
+		e = e || P(file, "      for (; j<%lu; ++j) {\n", UL(m));
+		for (r=0; r<t; ++r) {
+			e = e ||
+				P(file,
+				  "        s[%lu] += A[(i + %lu) * %lu + j] * B[j];\n",
+				  UL(r * u),
+				  UL(r),
+				  UL(ld));
+		}
+		e = e || P(file, "      }\n");
+	}
+	for (r=0; r<t; ++r) {
+		e = e || P(file, "      z[i + %lu] = ", UL(r));
+		if (bias) {
+			e = e || P(file, "b[i + %lu] + ", UL(r));
+		}
+		for (k=0; k<u; ++k) {
+			e = e || P(file, "%ss[%lu]", k ? " + " : "", UL(r * u + k));
+		}
+		e = e || P(file, ";\n");
+	}
+	e = e || P(file, "    }\n");
+	if (n % t) {
+		e = e ||
+			P(file,
+			  "    for (; i<%lu; ++i) {\n"
+			  "      s[0] = 0.0;\n"
+			  "      for (j=0; j<%lu; ++j) {\n"
+			  "        s[0] += A[i * %lu + j] * B[j];\n"
+			  "      }\n"
+			  "      z[i] = %ss[0];\n"
+			  "    }\n",
+			  UL(n),
+			  UL(m),
+			  UL(ld),
+			  bias ? "b[i] + " : "");
+	}
+	e = e || P(file, "  }\n\n");
+	if (e) {
 		G__DEBUG(0);
 		return -1;
 	}
@@ -229,25 +685,62 @@ inst_mul1(const struct g__ann_program_inst *inst, FILE *file)
 }
 
 static int
-inst_mul2(const struct g__ann_program_inst *inst, FILE *file)
+inst_mul2(const struct g__ann_program_inst *inst,
+	  const struct g__emitc_strategy *strategy,
+	  const struct view *view,
+	  FILE *file)
 {
+	if (G__ANN_LAYOUT_BLOCKED == inst->layout) {
+		return inst_panel2(inst, view, file);
+	}
 	if (P(file,
 	      "  { /* MAC2 */\n"
-	      "    %s *z = (%s *)( m_ + %lu );\n"
-	      "    const %s *A = (const %s *)( m_ + %lu );\n"
-	      "    const %s *B = (const %s *)( m_ + %lu );\n"
+	      "    %s *z = (%s *)( %s + %lu );\n"
+	      "    const %s *A = (const %s *)( %s + %lu );\n"
+	      "    const %s *B = (const %s *)( %s + %lu );\n"
 	      "    %s i, j;\n",
 	      precision(inst),
 	      precision(inst),
-	      UL(inst->arg[0].i),
+	      vb(view, inst->arg[0].i),
+	      vo(view, inst->arg[0].i),
 	      precision(inst),
 	      precision(inst),
-	      UL(inst->arg[1].i),
+	      vb(view, inst->arg[1].i),
+	      vo(view, inst->arg[1].i),
 	      precision(inst),
 	      precision(inst),
-	      UL(inst->arg[2].i),
-	      type(G__MAX(inst->arg[3].i, inst->arg[4].i))) ||
-	    P(file,
+	      vb(view, inst->arg[2].i),
+	      vo(view, inst->arg[2].i),
+	      type(G__MAX(inst->arg[3].i, inst->arg[4].i)))) {
+		G__DEBUG(0);
+		return -1;
+	}
+	if (strategy->interchange) {
+
+		/*
+		 * walk A row-wise (unit stride) accumulating into z
+		 */
+
+		if (P(file,
+		      "    for (i=0; i<%lu; ++i) {\n"
+		      "      z[i] = 0.0;\n"
+		      "    }\n"
+		      "    for (j=0; j<%lu; ++j) {\n"
+		      "      for (i=0; i<%lu; ++i) {\n"
+		      "        z[i] += A[j * %lu + i] * B[j];\n"
+		      "      }\n"
+		      "    }\n"
+		      "  }\n\n",
+		      UL(inst->arg[4].i),
+		      UL(inst->arg[3].i),
+		      UL(inst->arg[4].i),
+		      UL(inst->arg[5].i))) {
+			G__DEBUG(0);
+			return -1;
+		}
+		return 0;
+	}
+	if (P(file,
 	      "    for (i=0; i<%lu; ++i) {\n"
 	      "      z[i] = 0.0;\n"
 	      "      for (j=0; j<%lu; ++j) {\n"
@@ -257,7 +750,7 @@ inst_mul2(const struct g__ann_program_inst *inst, FILE *file)
 	      "  }\n\n",
 	      UL(inst->arg[4].i),
 	      UL(inst->arg[3].i),
-	      UL(inst->arg[4].i))) {
+	      UL(inst->arg[5].i))) {
 		G__DEBUG(0);
 		return -1;
 	}
@@ -265,23 +758,31 @@ inst_mul2(const struct g__ann_program_inst *inst, FILE *file)
 }
 
 static int
-inst_mul3(const struct g__ann_program_inst *inst, FILE *file)
+inst_mul3(const struct g__ann_program_inst *inst,
+	  const struct view *view,
+	  FILE *file)
 {
+	if (G__ANN_LAYOUT_BLOCKED == inst->layout) {
+		return inst_panel3(inst, view, file);
+	}
 	if (P(file,
 	      "  { /* MAC3 */\n"
-	      "    %s *za = (%s *)( m_ + %lu );\n"
-	      "    const %s *B = (const %s *)( m_ + %lu );\n"
-	      "    const %s *C = (const %s *)( m_ + %lu );\n"
+	      "    %s *za = (%s *)( %s + %lu );\n"
+	      "    const %s *B = (const %s *)( %s + %lu );\n"
+	      "    const %s *C = (const %s *)( %s + %lu );\n"
 	      "    %s i, j;\n",
 	      precision(inst),
 	      precision(inst),
-	      UL(inst->arg[0].i),
+	      vb(view, inst->arg[0].i),
+	      vo(view, inst->arg[0].i),
 	      precision(inst),
 	      precision(inst),
-	      UL(inst->arg[1].i),
+	      vb(view, inst->arg[1].i),
+	      vo(view, inst->arg[1].i),
 	      precision(inst),
 	      precision(inst),
-	      UL(inst->arg[2].i),
+	      vb(view, inst->arg[2].i),
+	      vo(view, inst->arg[2].i),
 	      type(G__MAX(inst->arg[3].i, inst->arg[4].i))) ||
 	    P(file,
 	      "    for (i=0; i<%lu; ++i) {\n"
@@ -292,7 +793,7 @@ inst_mul3(const struct g__ann_program_inst *inst, FILE *file)
 	      "  }\n\n",
 	      UL(inst->arg[3].i),
 	      UL(inst->arg[4].i),
-	      UL(inst->arg[4].i))) {
+	      UL(inst->arg[5].i))) {
 		G__DEBUG(0);
 		return -1;
 	}
@@ -300,19 +801,23 @@ inst_mul3(const struct g__ann_program_inst *inst, FILE *file)
 }
 
 static int
-inst_mul4(const struct g__ann_program_inst *inst, FILE *file)
+inst_mul4(const struct g__ann_program_inst *inst,
+	  const struct view *view,
+	  FILE *file)
 {
 	if (P(file,
 	      "  { /* MAC4 */\n"
-	      "    %s *za = (%s *)( m_ + %lu );\n"
-	      "    const %s *B = (const %s *)( m_ + %lu );\n"
+	      "    %s *za = (%s *)( %s + %lu );\n"
+	      "    const %s *B = (const %s *)( %s + %lu );\n"
 	      "    %s i;\n",
 	      precision(inst),
 	      precision(inst),
-	      UL(inst->arg[0].i),
+	      vb(view, inst->arg[0].i),
+	      vo(view, inst->arg[0].i),
 	      precision(inst),
 	      precision(inst),
-	      UL(inst->arg[1].i),
+	      vb(view, inst->arg[1].i),
+	      vo(view, inst->arg[1].i),
 	      type(inst->arg[3].i)) ||
 	    P(file,
 	      "    for (i=0; i<%lu; ++i) {\n"
@@ -328,19 +833,23 @@ inst_mul4(const struct g__ann_program_inst *inst, FILE *file)
 }
 
 static int
-inst_add(const struct g__ann_program_inst *inst, FILE *file)
+inst_add(const struct g__ann_program_inst *inst,
+	 const struct view *view,
+	 FILE *file)
 {
 	if (P(file,
 	      "  { /* ADD */\n"
-	      "    %s *za = (%s *)( m_ + %lu );\n"
-	      "    const %s *B = (const %s *)( m_ + %lu );\n"
+	      "    %s *za = (%s *)( %s + %lu );\n"
+	      "    const %s *B = (const %s *)( %s + %lu );\n"
 	      "    %s i;\n",
 	      precision(inst),
 	      precision(inst),
-	      UL(inst->arg[0].i),
+	      vb(view, inst->arg[0].i),
+	      vo(view, inst->arg[0].i),
 	      precision(inst),
 	      precision(inst),
-	      UL(inst->arg[1].i),
+	      vb(view, inst->arg[1].i),
+	      vo(view, inst->arg[1].i),
 	      type(inst->arg[2].i)) ||
 	    P(file,
 	      "    for (i=0; i<%lu; ++i) {\n"
@@ -355,19 +864,23 @@ inst_add(const struct g__ann_program_inst *inst, FILE *file)
 }
 
 static int
-inst_suby(const struct g__ann_program_inst *inst, FILE *file)
+inst_suby(const struct g__ann_program_inst *inst,
+	  const struct view *view,
+	  FILE *file)
 {
 	if (P(file,
 	      "  { /* SUBY */\n"
-	      "    %s *z = (%s *)( m_ + %lu );\n"
-	      "    const %s *A = (const %s *)( m_ + %lu );\n"
+	      "    %s *z = (%s *)( %s + %lu );\n"
+	      "    const %s *A = (const %s *)( %s + %lu );\n"
 	      "    %s i;\n",
 	      precision(inst),
 	      precision(inst),
-	      UL(inst->arg[0].i),
+	      vb(view, inst->arg[0].i),
+	      vo(view, inst->arg[0].i),
 	      precision(inst),
 	      precision(inst),
-	      UL(inst->arg[1].i),
+	      vb(view, inst->arg[1].i),
+	      vo(view, inst->arg[1].i),
 	      type(inst->arg[2].i)) ||
 	    P(file,
 	      "    for (i=0; i<%lu; ++i) {\n"
@@ -382,15 +895,46 @@ inst_suby(const struct g__ann_program_inst *inst, FILE *file)
 }
 
 static int
-inst_relu(const struct g__ann_program_inst *inst, FILE *file)
+inst_suby_index(const struct g__ann_program_inst *inst,
+		const struct view *view,
+		FILE *file)
+{
+	if (P(file,
+	      "  { /* SUBY_INDEX */\n"
+	      "    %s *z = (%s *)( %s + %lu );\n"
+	      "    const %s *A = (const %s *)( %s + %lu );\n"
+	      "    memcpy(z, A, %lu * sizeof (%s));\n"
+	      "    z[*y_] -= 1.0;\n"
+	      "  }\n\n",
+	      precision(inst),
+	      precision(inst),
+	      vb(view, inst->arg[0].i),
+	      vo(view, inst->arg[0].i),
+	      precision(inst),
+	      precision(inst),
+	      vb(view, inst->arg[1].i),
+	      vo(view, inst->arg[1].i),
+	      UL(inst->arg[2].i),
+	      precision(inst))) {
+		G__DEBUG(0);
+		return -1;
+	}
+	return 0;
+}
+
+static int
+inst_relu(const struct g__ann_program_inst *inst,
+	  const struct view *view,
+	  FILE *file)
 {
 	if (P(file,
 	      "  { /* RELU */\n"
-	      "    %s *za = (%s *)( m_ + %lu );\n"
+	      "    %s *za = (%s *)( %s + %lu );\n"
 	      "    %s i;\n",
 	      precision(inst),
 	      precision(inst),
-	      UL(inst->arg[0].i),
+	      vb(view, inst->arg[0].i),
+	      vo(view, inst->arg[0].i),
 	      type(inst->arg[1].i)) ||
 	    P(file,
 	      "    for (i=0; i<%lu; ++i) {\n"
@@ -421,16 +965,19 @@ inst_linear(const struct g__ann_program_inst *inst, FILE *file)
 }
 
 static int
-inst_softmax(const struct g__ann_program_inst *inst, FILE *file)
+inst_softmax(const struct g__ann_program_inst *inst,
+	     const struct view *view,
+	     FILE *file)
 {
 	if (P(file,
 	      "  { /* SOFTMAX */\n"
-	      "    %s *za = (%s *)( m_ + %lu );\n"
+	      "    %s *za = (%s *)( %s + %lu );\n"
 	      "    %s max=za[0], sum=0.0;\n"
 	      "    %s i;\n",
 	      precision(inst),
 	      precision(inst),
-	      UL(inst->arg[0].i),
+	      vb(view, inst->arg[0].i),
+	      vo(view, inst->arg[0].i),
 	      precision(inst),
 	      type(inst->arg[1].i)) ||
 	    P(file,
@@ -459,16 +1006,19 @@ inst_softmax(const struct g__ann_program_inst *inst, FILE *file)
 }
 
 static int
-inst_sigmoid(const struct g__ann_program_inst *inst, FILE *file)
+inst_sigmoid(const struct g__ann_program_inst *inst,
+	     const struct view *view,
+	     FILE *file)
 {
 	if (P(file,
 	      "  { /* SIGMOID */\n"
-	      "    %s *za = (%s *)( m_ + %lu );\n"
+	      "    %s *za = (%s *)( %s + %lu );\n"
 	      "    %s zee;\n"
 	      "    %s i;\n",
 	      precision(inst),
 	      precision(inst),
-	      UL(inst->arg[0].i),
+	      vb(view, inst->arg[0].i),
+	      vo(view, inst->arg[0].i),
 	      precision(inst),
 	      type(inst->arg[1].i)) ||
 	    P(file,
@@ -493,19 +1043,23 @@ inst_sigmoid(const struct g__ann_program_inst *inst, FILE *file)
 }
 
 static int
-inst_relud(const struct g__ann_program_inst *inst, FILE *file)
+inst_relud(const struct g__ann_program_inst *inst,
+	   const struct view *view,
+	   FILE *file)
 {
 	if (P(file,
 	      "  { /* RELUD */\n"
-	      "    %s *za = (%s *)( m_ + %lu );\n"
-	      "    const %s *B = (const %s *)( m_ + %lu );\n"
+	      "    %s *za = (%s *)( %s + %lu );\n"
+	      "    const %s *B = (const %s *)( %s + %lu );\n"
 	      "    %s i;\n",
 	      precision(inst),
 	      precision(inst),
-	      UL(inst->arg[0].i),
+	      vb(view, inst->arg[0].i),
+	      vo(view, inst->arg[0].i),
 	      precision(inst),
 	      precision(inst),
-	      UL(inst->arg[1].i),
+	      vb(view, inst->arg[1].i),
+	      vo(view, inst->arg[1].i),
 	      type(inst->arg[2].i)) ||
 	    P(file,
 	      "    for (i=0; i<%lu; ++i) {\n"
@@ -554,76 +1108,491 @@ inst_sigmoidd(const struct g__ann_program_inst *inst, FILE *file)
 	return -1;
 }
 
+/*
+ * Intra-operator threading: a wide MAC is outlined into a worker covering
+ * rows [lo, hi) of thread id_ out of n_, run through the pool the module
+ * was handed (or inline without one). The pool returns once all rows are
+ * done, which is the barrier before the next instruction.
+ */
+
 static int
-program(const struct g__ann_program *program, FILE *file)
+parallel(const struct g__ann_program_inst *inst,
+	 const struct g__emitc_strategy *strategy)
 {
-	const struct g__ann_program_inst *inst;
-	int i;
+	uint64_t work;
 
-	for (i=1; i<program->size; ++i) {
-		inst = &program->inst[i];
-		if (G__ANN_PROGRAM_INST_BATCHLOOP == inst->opc) {
-			if (inst_batchloop(inst, file)) {
-				G__DEBUG(0);
-				return -1;
-			}
-		}
-		else if (G__ANN_PROGRAM_INST_RANDOM == inst->opc) {
-			if (inst_random(inst, file)) {
-				G__DEBUG(0);
-				return -1;
-			}
-		}
-		else if (G__ANN_PROGRAM_INST_CLEAR == inst->opc) {
-			if (inst_clear(inst, file)) {
-				G__DEBUG(0);
-				return -1;
-			}
-		}
-		else if (G__ANN_PROGRAM_INST_COPYX == inst->opc) {
-			if (inst_copyx(inst, file)) {
-				G__DEBUG(0);
-				return -1;
-			}
-		}
-		else if (G__ANN_PROGRAM_INST_MAC1 == inst->opc) {
-			if (inst_mul1(inst, file)) {
-				G__DEBUG(0);
-				return -1;
-			}
-		}
-		else if (G__ANN_PROGRAM_INST_MAC2 == inst->opc) {
-			if (inst_mul2(inst, file)) {
-				G__DEBUG(0);
-				return -1;
-			}
-		}
-		else if (G__ANN_PROGRAM_INST_MAC3 == inst->opc) {
-			if (inst_mul3(inst, file)) {
-				G__DEBUG(0);
-				return -1;
-			}
-		}
-		else if (G__ANN_PROGRAM_INST_MAC4 == inst->opc) {
-			if (inst_mul4(inst, file)) {
-				G__DEBUG(0);
-				return -1;
-			}
-		}
-		else if (G__ANN_PROGRAM_INST_ADD == inst->opc) {
-			if (inst_add(inst, file)) {
-				G__DEBUG(0);
-				return -1;
-			}
+	if (1 >= strategy->threads) {
+		return 0;
+	}
+	switch (inst->opc) {
+	case G__ANN_PROGRAM_INST_MAC1:
+	case G__ANN_PROGRAM_INST_MAC2:
+	case G__ANN_PROGRAM_INST_MAC3:
+		work = inst->arg[3].i * inst->arg[4].i;
+		break;
+	case G__ANN_PROGRAM_INST_MAC4:
+		work = inst->arg[3].i;
+		break;
+	default:
+		return 0;
+	}
+	return PARALLEL_MIN <= work;
+}
+
+/* parallel and addressing model memory alone, a worker only sees m_ */
+
+static int
+outlined(const struct g__ann_program_inst *inst,
+	 const struct g__emitc_strategy *strategy)
+{
+	int k;
+
+	for (k=0; k<3; ++k) {
+		if ((G__ANN_ADDRESS_X == inst->arg[k].i) ||
+		    (G__ANN_ADDRESS_Y == inst->arg[k].i)) {
+			return 0;
 		}
-		else if (G__ANN_PROGRAM_INST_SUBY == inst->opc) {
-			if (inst_suby(inst, file)) {
-				G__DEBUG(0);
-				return -1;
-			}
+	}
+	return parallel(inst, strategy);
+}
+
+/* the ADD following a MAC1 to fold into it, or 0 */
+
+static const struct g__ann_program_inst *
+fold(const struct g__ann_program *program,
+     int i,
+     int hi,
+     const struct g__emitc_strategy *strategy)
+{
+	const struct g__ann_program_inst *inst;
+
+	inst = &program->inst[i];
+	if (strategy->fuse &&
+	    (G__ANN_PROGRAM_INST_MAC1 == inst->opc) &&
+	    ((i + 1) < hi) &&
+	    (G__ANN_PROGRAM_INST_ADD == inst[1].opc) &&
+	    (inst[1].arg[0].i == inst->arg[0].i)) {
+		return &inst[1];
+	}
+	return 0;
+}
+
+/* partial sums per row of a MAC1 worker */
+
+static uint64_t
+partials(const struct g__ann_program_inst *inst,
+	 const struct g__emitc_strategy *strategy)
+{
+	if (G__ANN_LAYOUT_BLOCKED == inst->layout) {
+		return 1;
+	}
+	return G__MIN((uint64_t)G__MAX(1, strategy->unroll), inst->arg[4].i);
+}
+
+/*
+ * Rows [lo, hi) of MAC1 summed exactly as inst_mul1() sums them: unroll
+ * partial sums for rows in whole tiles, a single sum for the rows past
+ * them, so a row comes out the same whichever thread computes it.
+ */
+
+static int
+worker_mul1(const struct g__ann_program_inst *inst,
+	    const struct g__ann_program_inst *bias,
+	    const struct g__emitc_strategy *strategy,
+	    FILE *file)
+{
+	uint64_t n, m, t, u, k;
+	int e;
+
+	n = inst->arg[3].i;
+	m = inst->arg[4].i;
+	t = G__MIN((uint64_t)G__MAX(1, strategy->tile), n);
+	t = (G__ANN_LAYOUT_BLOCKED == inst->layout) ? 1 : t;
+	u = partials(inst, strategy);
+	e = P(file, "  for (i=lo; (i<hi) && (i<%lu); ++i) {\n", UL(n / t * t));
+	for (k=0; k<u; ++k) {
+		e = e || P(file, "    s[%lu] = 0.0;\n", UL(k));
+	}
+	e = e || P(file,
+		   "    for (j=0; j<%lu; j+=%lu) {\n",
+		   UL(m / u * u),
+		   UL(u));
+	for (k=0; k<u; ++k) {
+		e = e ||
+			P(file, "      s[%lu] += A[", UL(k)) ||
+			element(inst, "i", "j", file) ||
+			P(file, " + %lu] * B[j + %lu];\n", UL(k), UL(k));
+	}
+	e = e || P(file, "    }\n");
+	if (m % u) {
+		e = e ||
+			P(file,
+			  "    for (; j<%lu; ++j) {\n"
+			  "      s[0] += A[",
+			  UL(m)) ||
+			element(inst, "i", "j", file) ||
+			P(file, "] * B[j];\n    }\n");
+	}
+	e = e || P(file, "    z[i] = %s", bias ? "b[i] + " : "");
+	for (k=0; k<u; ++k) {
+		e = e || P(file, "%ss[%lu]", k ? " + " : "", UL(k));
+	}
+	e = e || P(file, ";\n  }\n");
+	if (n % t) {
+		e = e ||
+			P(file,
+			  "  for (; i<hi; ++i) {\n"
+			  "    s[0] = 0.0;\n"
+			  "    for (j=0; j<%lu; ++j) {\n"
+			  "      s[0] += A[",
+			  UL(m)) ||
+			element(inst, "i", "j", file) ||
+			P(file,
+			  "] * B[j];\n"
+			  "    }\n"
+			  "    z[i] = %ss[0];\n"
+			  "  }\n",
+			  bias ? "b[i] + " : "");
+	}
+	if (e) {
+		G__DEBUG(0);
+		return -1;
+	}
+	return 0;
+}
+
+/* columns [lo, hi) of MAC2 on panels, a sum per panel as inst_panel2() */
+
+static int
+worker_panel2(const struct g__ann_program_inst *inst, FILE *file)
+{
+	if (P(file,
+	      "  for (i=lo; i<hi; ++i) {\n"
+	      "    z[i] = 0.0;\n"
+	      "  }\n"
+	      "  for (j=0; j<%lu; j+=%d) {\n"
+	      "    %s k, h;\n"
+	      "    h = ((%lu - j) < %d) ? (%lu - j) : %d;\n"
+	      "    for (i=lo; i<hi; ++i) {\n"
+	      "      s = 0.0;\n"
+	      "      for (k=0; k<h; ++k) {\n"
+	      "        s += A[",
+	      UL(inst->arg[3].i),
+	      G__ANN_PANEL,
+	      type(G__ANN_PANEL),
+	      UL(inst->arg[3].i),
+	      G__ANN_PANEL,
+	      UL(inst->arg[3].i),
+	      G__ANN_PANEL) ||
+	    element(inst, "(j + k)", "i", file) ||
+	    P(file,
+	      "] * B[j + k];\n"
+	      "      }\n"
+	      "      z[i] += s;\n"
+	      "    }\n"
+	      "  }\n")) {
+		G__DEBUG(0);
+		return -1;
+	}
+	return 0;
+}
+
+static int
+inst_worker(const struct g__ann *ann,
+	    int program,
+	    int index,
+	    const struct g__ann_program_inst *inst,
+	    const struct g__ann_program_inst *bias,
+	    const struct g__emitc_strategy *strategy,
+	    FILE *file)
+{
+	const char *p;
+	uint64_t n;
+	int e;
+
+	p = precision(inst);
+	n = (G__ANN_PROGRAM_INST_MAC2 == inst->opc) ?
+		inst->arg[4].i :
+		inst->arg[3].i;
+	e = P(file,
+	      "static void %s_p%d_%d_(void *a_, int id_, int n_) {\n"
+	      "  char *m_ = (char *)a_;\n"
+	      "  %s *z = (%s *)( m_ + %lu );\n"
+	      "  const %s *A = (const %s *)( m_ + %lu );\n",
+	      ann->prefix,
+	      program,
+	      index,
+	      p,
+	      p,
+	      UL(inst->arg[0].i),
+	      p,
+	      p,
+	      UL(inst->arg[1].i));
+	if (G__ANN_PROGRAM_INST_MAC4 == inst->opc) {
+		e = e || P(file,
+			   "  %s i, lo, hi;\n",
+			   type(inst->arg[3].i));
+	}
+	else if (G__ANN_PROGRAM_INST_MAC1 == inst->opc) {
+		e = e || P(file,
+			   "  const %s *B = (const %s *)( m_ + %lu );\n"
+			   "  %s i, j, lo, hi;\n"
+			   "  %s s[%lu];\n",
+			   p,
+			   p,
+			   UL(inst->arg[2].i),
+			   type(G__MAX(inst->arg[3].i, inst->arg[4].i)),
+			   p,
+			   UL(partials(inst, strategy)));
+	}
+	else {
+		e = e || P(file,
+			   "  const %s *B = (const %s *)( m_ + %lu );\n"
+			   "  %s i, j, lo, hi;\n"
+			   "  %s s;\n",
+			   p,
+			   p,
+			   UL(inst->arg[2].i),
+			   type(G__MAX(inst->arg[3].i, inst->arg[4].i)),
+			   p);
+	}
+	if (bias) {
+		e = e || P(file,
+			   "  const %s *b = (const %s *)( m_ + %lu );\n",
+			   p,
+			   p,
+			   UL(bias->arg[1].i));
+	}
+	e = e || P(file,
+		   "  lo = (uint64_t)%lu * id_ / n_;\n"
+		   "  hi = (uint64_t)%lu * (id_ + 1) / n_;\n",
+		   UL(n),
+		   UL(n));
+	switch (inst->opc) {
+	case G__ANN_PROGRAM_INST_MAC1: /* z := A * B (+ b), rows */
+		e = e || worker_mul1(inst, bias, strategy, file);
+		break;
+	case G__ANN_PROGRAM_INST_MAC2: /* z := A' * B, columns */
+		if (G__ANN_LAYOUT_BLOCKED == inst->layout) {
+			e = e || worker_panel2(inst, file);
+			break;
+		}
+		e = e ||
+			P(file,
+			  "  (void)s;\n"
+			  "  for (i=lo; i<hi; ++i) {\n"
+			  "    z[i] = 0.0;\n"
+			  "  }\n"
+			  "  for (j=0; j<%lu; ++j) {\n"
+			  "    for (i=lo; i<hi; ++i) {\n"
+			  "      z[i] += A[",
+			  UL(inst->arg[3].i)) ||
+			element(inst, "j", "i", file) ||
+			P(file,
+			  "] * B[j];\n"
+			  "    }\n"
+			  "  }\n");
+		break;
+	case G__ANN_PROGRAM_INST_MAC3: /* z += A x B, rows */
+		e = e ||
+			P(file,
+			  "  (void)s;\n"
+			  "  for (i=lo; i<hi; ++i) {\n"
+			  "    for (j=0; j<%lu; ++j) {\n"
+			  "      z[",
+			  UL(inst->arg[4].i)) ||
+			element(inst, "i", "j", file) ||
+			P(file,
+			  "] += A[i] * B[j];\n"
+			  "    }\n"
+			  "  }\n");
+		break;
+	default: /* MAC4, z += A * r, elements */
+		e = e || P(file,
+			   "  for (i=lo; i<hi; ++i) {\n"
+			   "    z[i] += A[i] * %f;\n"
+			   "  }\n",
+			   inst->arg[2].r);
+		break;
+	}
+	if (e || P(file, "}\n\n")) {
+		G__DEBUG(0);
+		return -1;
+	}
+	return 0;
+}
+
+static int
+workers(const struct g__ann *ann,
+	const struct g__emitc_strategy *strategy,
+	FILE *file)
+{
+	const struct g__ann_program *prog;
+	int i, j, k;
+
+	if (1 >= strategy->threads) {
+		return 0;
+	}
+	if (P(file,
+	      "static void (*%s_run_)(void *,"
+	      " void (*)(void *, int, int),"
+	      " void *);\n"
+	      "static void *%s_pool_;\n\n",
+	      ann->prefix,
+	      ann->prefix)) {
+		G__DEBUG(0);
+		return -1;
+	}
+
+	/* the dispatcher only if it has a caller, the module is -Werror */
+
+	for (k=0, i=0; i<G__ANN_PROGRAM_END; ++i) {
+		prog = &ann->program[i];
+		for (j=1; (G__ANN_PROGRAM_INFER != i) && (j<prog->size); ++j) {
+			k = k || outlined(&prog->inst[j], strategy);
+		}
+	}
+	if (!k) {
+		return 0;
+	}
+	if (P(file,
+	      "static void %s_parallel_(void (*fnc)(void *, int, int),"
+	      " void *arg) {\n"
+	      "  if (%s_run_) {\n"
+	      "    %s_run_(%s_pool_, fnc, arg);\n"
+	      "  }\n"
+	      "  else {\n"
+	      "    fnc(arg, 0, 1);\n"
+	      "  }\n"
+	      "}\n\n",
+	      ann->prefix,
+	      ann->prefix,
+	      ann->prefix,
+	      ann->prefix)) {
+		G__DEBUG(0);
+		return -1;
+	}
+	for (i=0; i<G__ANN_PROGRAM_END; ++i) {
+		if (G__ANN_PROGRAM_INFER == i) {
+			continue; /* never on the plain view */
+		}
+		prog = &ann->program[i];
+		for (j=1; j<prog->size; ++j) {
+			if (outlined(&prog->inst[j], strategy) &&
+			    inst_worker(ann,
+					i,
+					j,
+					&prog->inst[j],
+					fold(prog, j, prog->size, strategy),
+					strategy,
+					file)) {
+				G__DEBUG(0);
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+/* emits instructions [lo, hi) of program, the return excluded */
+
+static int
+body(const struct g__ann *ann,
+     const struct g__ann_program *program,
+     const struct g__emitc_strategy *strategy,
+     const struct view *view,
+     int lo,
+     int hi,
+     FILE *file)
+{
+	const struct g__ann_program_inst *inst, *bias;
+	int i;
+
+	for (i=lo; i<hi; ++i) {
+		inst = &program->inst[i];
+		if ((&M_ == view) && outlined(inst, strategy)) {
+			if (P(file,
+			      "  %s_parallel_(%s_p%d_%d_, m_);\n\n",
+			      ann->prefix,
+			      ann->prefix,
+			      (int)(program - ann->program),
+			      i)) {
+				G__DEBUG(0);
+				return -1;
+			}
+			i += fold(program, i, program->size, strategy) ? 1 : 0;
+			continue;
+		}
+		bias = fold(program, i, hi, strategy);
+		if (G__ANN_PROGRAM_INST_BATCHLOOP == inst->opc) {
+			if (inst_batchloop(ann, inst, file)) {
+				G__DEBUG(0);
+				return -1;
+			}
+		}
+		else if (G__ANN_PROGRAM_INST_RANDOM == inst->opc) {
+			if (inst_random(inst, view, file)) {
+				G__DEBUG(0);
+				return -1;
+			}
+		}
+		else if (G__ANN_PROGRAM_INST_CLEAR == inst->opc) {
+			if (inst_clear(inst, view, file)) {
+				G__DEBUG(0);
+				return -1;
+			}
+		}
+		else if (G__ANN_PROGRAM_INST_COPYX == inst->opc) {
+			if (inst_copyx(inst, view, file)) {
+				G__DEBUG(0);
+				return -1;
+			}
+		}
+		else if (G__ANN_PROGRAM_INST_MAC1 == inst->opc) {
+			if (inst_mul1(inst, bias, strategy, view, file)) {
+				G__DEBUG(0);
+				return -1;
+			}
+			i += bias ? 1 : 0;
+		}
+		else if (G__ANN_PROGRAM_INST_MAC2 == inst->opc) {
+			if (inst_mul2(inst, strategy, view, file)) {
+				G__DEBUG(0);
+				return -1;
+			}
+		}
+		else if (G__ANN_PROGRAM_INST_MAC3 == inst->opc) {
+			if (inst_mul3(inst, view, file)) {
+				G__DEBUG(0);
+				return -1;
+			}
+		}
+		else if (G__ANN_PROGRAM_INST_MAC4 == inst->opc) {
+			if (inst_mul4(inst, view, file)) {
+				G__DEBUG(0);
+				return -1;
+			}
+		}
+		else if (G__ANN_PROGRAM_INST_ADD == inst->opc) {
+			if (inst_add(inst, view, file)) {
+				G__DEBUG(0);
+				return -1;
+			}
+		}
+		else if (G__ANN_PROGRAM_INST_SUBY == inst->opc) {
+			if (inst_suby(inst, view, file)) {
+				G__DEBUG(0);
+				return -1;
+			}
+		}
+		else if (G__ANN_PROGRAM_INST_SUBY_INDEX == inst->opc) {
+			if (inst_suby_index(inst, view, file)) {
+				G__DEBUG(0);
+				return -1;
+			}
 		}
 		else if (G__ANN_PROGRAM_INST_RELU == inst->opc) {
-			if (inst_relu(inst, file)) {
+			if (inst_relu(inst, view, file)) {
 				G__DEBUG(0);
 				return -1;
 			}
@@ -635,19 +1604,19 @@ program(const struct g__ann_program *program, FILE *file)
 			}
 		}
 		else if (G__ANN_PROGRAM_INST_SOFTMAX == inst->opc) {
-			if (inst_softmax(inst, file)) {
+			if (inst_softmax(inst, view, file)) {
 				G__DEBUG(0);
 				return -1;
 			}
 		}
 		else if (G__ANN_PROGRAM_INST_SIGMOID == inst->opc) {
-			if (inst_sigmoid(inst, file)) {
+			if (inst_sigmoid(inst, view, file)) {
 				G__DEBUG(0);
 				return -1;
 			}
 		}
 		else if (G__ANN_PROGRAM_INST_RELUD == inst->opc) {
-			if (inst_relud(inst, file)) {
+			if (inst_relud(inst, view, file)) {
 				G__DEBUG(0);
 				return -1;
 			}
@@ -677,6 +1646,22 @@ program(const struct g__ann_program *program, FILE *file)
 			return -1;
 		}
 	}
+	return 0;
+}
+
+static int
+program(const struct g__ann *ann,
+	const struct g__ann_program *program,
+	const struct g__emitc_strategy *strategy,
+	const struct view *view,
+	FILE *file)
+{
+	const struct g__ann_program_inst *inst;
+
+	if (body(ann, program, strategy, view, 1, program->size, file)) {
+		G__DEBUG(0);
+		return -1;
+	}
 	inst = &program->inst[0];
 	if (G__ANN_PROGRAM_INST_RET == inst->opc) {
 		if (inst_ret(inst, file)) {
@@ -685,7 +1670,7 @@ program(const struct g__ann_program *program, FILE *file)
 		}
 	}
 	else if (G__ANN_PROGRAM_INST_RETARG == inst->opc) {
-		if (inst_retarg(inst, file)) {
+		if (inst_retarg(inst, view, file)) {
 			G__DEBUG(0);
 			return -1;
 		}
@@ -700,8 +1685,9 @@ program(const struct g__ann_program *program, FILE *file)
 }
 
 static int
-header(const struct g__ann *ann, FILE *file, int includes)
+header(const char *module, FILE *file, int includes)
 {
+	char buf[32];
 	time_t t;
 
 	t = time(0);
@@ -710,8 +1696,9 @@ header(const struct g__ann *ann, FILE *file, int includes)
 	      " * Auto Generated by The Gravity Compiler - %s"
 	      " * Copyright (C) Tony Givargis, 2019-2020\n"
 	      " */\n\n",
-	      ctime(&t),
-	      ann->module)) {
+	      ctime_r(&t, buf))) {
+		G__DEBUG(0);
+		return -1;
 	}
 	if (includes) {
 		if (P(file,
@@ -720,7 +1707,7 @@ header(const struct g__ann *ann, FILE *file, int includes)
 		      "#include <string.h>\n"
 		      "#include <math.h>\n"
 		      "#include \"%s.h\"\n\n",
-		      ann->module)) {
+		      module)) {
 			G__DEBUG(0);
 			return -1;
 		}
@@ -729,13 +1716,15 @@ header(const struct g__ann *ann, FILE *file, int includes)
 }
 
 static int
-initialize(const struct g__ann *ann, FILE *file)
+initialize(const struct g__ann *ann,
+	   const struct g__emitc_strategy *strategy,
+	   FILE *file)
 {
 	const struct g__ann_program *prog;
 
 	prog = &ann->program[G__ANN_PROGRAM_INITIALIZE];
-	if (P(file, "static void _initialize_(char *m_) {\n") ||
-	    program(prog, file) ||
+	if (P(file, "static void %s_initialize_(char *m_) {\n", ann->prefix) ||
+	    program(ann, prog, strategy, &M_, file) ||
 	    P(file, "}\n\n")) {
 		G__DEBUG(0);
 		return -1;
@@ -744,16 +1733,32 @@ initialize(const struct g__ann *ann, FILE *file)
 }
 
 static int
-activate(const struct g__ann *ann, FILE *file)
+activate(const struct g__ann *ann,
+	 const struct g__emitc_strategy *strategy,
+	 FILE *file)
 {
 	const struct g__ann_program *prog;
 
 	prog = &ann->program[G__ANN_PROGRAM_ACTIVATE];
 	if (P(file,
-	      "static %s *_activate_(char *m_, const %s *x_) {\n",
+	      "static %s *%s_activate_(char *m_, const %s *x_) {\n",
 	      precision(&prog->inst[0]),
+	      ann->prefix,
+	      input(ann)) ||
+	    program(ann, prog, strategy, &M_, file) ||
+	    P(file, "}\n\n") ||
+	    P(file,
+	      "static void %s_activate_into_(char *m_,"
+	      " const %s *x_,"
+	      " %s *y_) {\n",
+	      ann->prefix,
+	      input(ann),
 	      precision(&prog->inst[0])) ||
-	    program(prog, file) ||
+	    program(ann,
+		    &ann->program[G__ANN_PROGRAM_ACTIVATE_INTO],
+		    strategy,
+		    &M_,
+		    file) ||
 	    P(file, "}\n\n")) {
 		G__DEBUG(0);
 		return -1;
@@ -762,15 +1767,27 @@ activate(const struct g__ann *ann, FILE *file)
 }
 
 static int
-backprop(const struct g__ann *ann, FILE *file)
+backprop(const struct g__ann *ann,
+	 const struct g__emitc_strategy *strategy,
+	 FILE *file)
 {
 	const struct g__ann_program *prog;
 
 	prog = &ann->program[G__ANN_PROGRAM_BACKPROP];
 	if (P(file,
-	      "static void _backprop_(char *m_, const %s *y_) {\n",
+	      "static void %s_backprop_(char *m_, const %s *y_) {\n",
+	      ann->prefix,
 	      precision(&prog->inst[0])) ||
-	    program(prog, file) ||
+	    program(ann, prog, strategy, &M_, file) ||
+	    P(file, "}\n\n") ||
+	    P(file,
+	      "static void %s_backprop_labels_(char *m_, const int32_t *y_) {\n",
+	      ann->prefix) ||
+	    program(ann,
+		    &ann->program[G__ANN_PROGRAM_LABELS],
+		    strategy,
+		    &M_,
+		    file) ||
 	    P(file, "}\n\n")) {
 		G__DEBUG(0);
 		return -1;
@@ -779,16 +1796,47 @@ backprop(const struct g__ann *ann, FILE *file)
 }
 
 static int
-train(const struct g__ann *ann, FILE *file)
+train(const struct g__ann *ann,
+      const struct g__emitc_strategy *strategy,
+      FILE *file)
 {
 	const struct g__ann_program *prog;
 
 	prog = &ann->program[G__ANN_PROGRAM_TRAIN];
 	if (P(file,
-	      "static void _train_(char *m_, const %s *x_, const %s *y_) {\n",
-	      precision(&prog->inst[0]),
+	      "static void %s_train_(char *m_,"
+	      " const %s *x_,"
+	      " const %s *y_) {\n",
+	      ann->prefix,
+	      input(ann),
 	      precision(&prog->inst[0])) ||
-	    program(prog, file) ||
+	    program(ann, prog, strategy, &M_, file) ||
+	    P(file, "}\n\n") ||
+	    P(file,
+	      "static void %s_train_labels_(char *m_,"
+	      " const %s *x_,"
+	      " const int32_t *y_) {\n",
+	      ann->prefix,
+	      input(ann)) ||
+	    program(ann,
+		    &ann->program[G__ANN_PROGRAM_TRAIN_LABELS],
+		    strategy,
+		    &M_,
+		    file) ||
+	    P(file, "}\n\n") ||
+	    P(file,
+	      "static void %s_train_gather_(char *m_,"
+	      " const char *x_,"
+	      " const char *y_,"
+	      " const uint32_t *i_,"
+	      " size_t xs_,"
+	      " size_t ys_) {\n",
+	      ann->prefix) ||
+	    program(ann,
+		    &ann->program[G__ANN_PROGRAM_TRAIN_GATHER],
+		    strategy,
+		    &M_,
+		    file) ||
 	    P(file, "}\n\n")) {
 		G__DEBUG(0);
 		return -1;
@@ -796,123 +1844,1398 @@ train(const struct g__ann *ann, FILE *file)
 	return 0;
 }
 
-static int
-export(const struct g__ann *ann, FILE *file1, FILE *file2)
-{
-	const struct g__ann_program_inst *inst1, *inst2;
-	const char *prefix;
+/*
+ * Data-parallel training: a shard runs activate/backprop over a range of
+ * samples with weights read from m_ and everything past hard (gradients,
+ * activations, deltas) kept in the shard's own p_. Shards are summed by
+ * reduce, a slice of the gradients at a time, and update applies the sum
+ * once, scaled to the number of samples behind it, to the weights of s_
+ * written to m_ (the same memory but for .schedule stale). train_hogwild
+ * is the asynchronous variant, a shard and an update per batch straight
+ * into the shared weights, racing with whatever other threads do the same.
+ */
 
-	inst1 = &ann->program[G__ANN_PROGRAM_ACTIVATE].inst[0];
-	inst2 = &ann->program[G__ANN_PROGRAM_TRAIN].inst[0];
-	prefix = capitalize(ann->prefix);
+/* backprop_p and train_shard of a TRAIN program, by its BATCHLOOP */
 
-	/* C file */
+static int
+shard(const struct g__ann *ann,
+      const struct g__ann_program *prog,
+      const struct g__emitc_strategy *strategy,
+      const struct view *view,
+      FILE *file)
+{
+	const struct g__ann_program_inst *loop;
+	const char *s, *y;
 
-	if (P(file1,
-	      "int %s_version(void) {\n"
-	      "  return %d;\n"
-	      "}\n\n",
-	      ann->prefix,
-	      G__VERSION) ||
-	    P(file1,
-	      "size_t %s_memory_size(void) {\n"
-	      "  return %lu;\n"
-	      "}\n\n",
+	loop = &prog->inst[2];
+	assert( G__ANN_PROGRAM_INST_CLEAR == prog->inst[1].opc );
+	assert( G__ANN_PROGRAM_INST_BATCHLOOP == loop->opc );
+	s = (G__ANN_PROGRAM_LABELS == loop->arg[3].i) ? "_labels" : "";
+	y = (G__ANN_PROGRAM_LABELS == loop->arg[3].i) ?
+		"int32_t" :
+		precision(&prog->inst[0]);
+	if (P(file,
+	      "static void %s_backprop%s_p_(const char *m_,"
+	      " char *p_,"
+	      " const %s *y_) {\n",
 	      ann->prefix,
-	      UL(ann->precision.size)) ||
-	    P(file1,
-	      "size_t %s_memory_hard(void) {\n"
-	      "  return %lu;\n"
-	      "}\n\n",
+	      s,
+	      y) ||
+	    program(ann, &ann->program[loop->arg[3].i], strategy, view, file) ||
+	    P(file, "}\n\n") ||
+	    P(file,
+	      "static void %s_train_shard%s_(const char *m_,"
+	      " char *p_,"
+	      " const %s *x_,"
+	      " const %s *y_,"
+	      " size_t lo_,"
+	      " size_t hi_) {\n"
+	      "  size_t i;\n\n",
 	      ann->prefix,
-	      UL(ann->precision.hard)) ||
-	    P(file1,
-	      "void %s_initialize(void *m) {\n"
-	      "  _initialize_((char *)m);\n"
-	      "}\n\n",
-	      ann->prefix) ||
-	    P(file1,
-	      "void *%s_activate(void *m, const void *x) {\n"
-	      "  return _activate_((char *)m, (const %s *)x);\n"
+	      s,
+	      input(ann),
+	      y) ||
+	    inst_clear(&prog->inst[1], view, file) ||
+	    P(file,
+	      "  for (i=lo_; i<hi_; ++i) {\n"
+	      "    %s_activate_p_(m_, p_, x_ + i * %lu);\n"
+	      "    %s_backprop%s_p_(m_, p_, y_ + i * %lu);\n"
+	      "  }\n"
 	      "}\n\n",
 	      ann->prefix,
-	      precision(inst1)) ||
-	    P(file1,
-	      "void %s_train(void *m, const void *x, const void *y) {\n"
-	      "  _train_((char *)m, (const %s *)x, (const %s *)y);\n"
-	      "}\n\n",
+	      UL(loop->arg[1].i),
 	      ann->prefix,
-	      precision(inst2),
-	      precision(inst2))) {
-		G__FREE(prefix);
-		G__DEBUG(0);
-		return -1;
-	}
-
-	/* H file */
-
-	if (P(file2,
-	      "#ifndef _%s_H_\n"
-	      "#define _%s_H_\n\n"
-	      "#include <stddef.h>\n\n"
-	      "#ifdef __cplusplus\n"
-	      "extern \"C\" {\n"
-	      "#endif /* __cplusplus */\n\n",
-	      prefix,
-	      prefix) ||
-	    P(file2, "int %s_version(void);\n", ann->prefix) ||
-	    P(file2, "size_t %s_memory_size(void);\n", ann->prefix) ||
-	    P(file2, "size_t %s_memory_hard(void);\n", ann->prefix) ||
-	    P(file2, "void %s_initialize(void *m);\n", ann->prefix) ||
-	    P(file2,
-	      "void *%s_activate(void *m, const void *x);\n",
-	      ann->prefix) ||
-	    P(file2,
-	      "void %s_train(void *m, const void *x, const void *y);\n\n",
-	      ann->prefix) ||
-	    P(file2,
-	      "#ifdef __cplusplus\n"
-	      "}\n"
-	      "#endif /* __cplusplus */\n\n"
-	      "#endif /* _%s_H_ */\n",
-	      prefix)) {
-		G__FREE(prefix);
+	      s,
+	      UL(loop->arg[2].i))) {
 		G__DEBUG(0);
 		return -1;
 	}
-	G__FREE(prefix);
 	return 0;
 }
 
-int
-g__emitc(const struct g__ann *ann, const char *tmp)
+static int
+train_parallel(const struct g__ann *ann,
+	       const struct g__emitc_strategy *strategy,
+	       FILE *file)
 {
-	FILE *file1, *file2;
-	size_t n;
-	char *s;
+	const struct g__ann_program *prog;
+	const struct g__ann_program_inst *inst;
+	struct view view;
+	const char *p;
+	int i, e;
 
-	assert( ann );
+	view.lo = "m_";
+	view.hi = "p_";
+	view.split = ann->precision.hard;
+	prog = &ann->program[G__ANN_PROGRAM_TRAIN];
+	p = precision(&prog->inst[0]);
+	e = P(file,
+	      "static %s *%s_activate_p_(const char *m_,"
+	      " char *p_,"
+	      " const %s *x_) {\n",
+	      p,
+	      ann->prefix,
+	      input(ann)) ||
+		program(ann,
+			&ann->program[G__ANN_PROGRAM_ACTIVATE],
+			strategy,
+			&view,
+			file) ||
+		P(file, "}\n\n") ||
+		shard(ann, prog, strategy, &view, file) ||
+		shard(ann,
+		      &ann->program[G__ANN_PROGRAM_TRAIN_LABELS],
+		      strategy,
+		      &view,
+		      file) ||
+		P(file,
+		  "static void %s_reduce_(%s *z_,"
+		  " const %s *b_,"
+		  " int id_,"
+		  " int n_) {\n"
+		  "  uint64_t i, lo, hi;\n"
+		  "  lo = (uint64_t)%lu * id_ / n_;\n"
+		  "  hi = (uint64_t)%lu * (id_ + 1) / n_;\n"
+		  "  for (i=lo; i<hi; ++i) {\n"
+		  "    z_[i] += b_[i];\n"
+		  "  }\n"
+		  "}\n\n",
+		  ann->prefix,
+		  p,
+		  p,
+		  UL(prog->inst[1].arg[1].i),
+		  UL(prog->inst[1].arg[1].i)) ||
+		P(file,
+		  "static void %s_update_(char *m_,"
+		  " const char *s_,"
+		  " const char *p_,"
+		  " size_t n_) {\n",
+		  ann->prefix);
+	for (i=3; i<prog->size; ++i) {
 
-	n = g__strlen(ann->module) + g__strlen(tmp) + 32;
-	s = g__malloc(n);
-	if (!s) {
+		/*
+		 * MAC4 with -lr / batch rescaled to -lr / n_, the weights
+		 * it updates read from s_ (m_ itself, or the other copy of
+		 * .schedule stale) and written to m_
+		 */
+
+		inst = &prog->inst[i];
+		assert( G__ANN_PROGRAM_INST_MAC4 == inst->opc );
+		assert( inst->arg[0].i < ann->precision.hard );
+		e = e || P(file,
+			   "  { /* MAC4 */\n"
+			   "    %s *za = (%s *)( m_ + %lu );\n"
+			   "    const %s *zs = (const %s *)( s_ + %lu );\n"
+			   "    const %s *B = (const %s *)( %s + %lu );\n"
+			   "    %s i;\n"
+			   "    for (i=0; i<%lu; ++i) {\n"
+			   "      za[i] = zs[i] + B[i] * (%f / n_);\n"
+			   "    }\n"
+			   "  }\n\n",
+			   p,
+			   p,
+			   UL(inst->arg[0].i),
+			   p,
+			   p,
+			   UL(inst->arg[0].i),
+			   p,
+			   p,
+			   vb(&view, inst->arg[1].i),
+			   vo(&view, inst->arg[1].i),
+			   type(inst->arg[3].i),
+			   UL(inst->arg[3].i),
+			   inst->arg[2].r * ann->batch);
+	}
+	if (e ||
+	    P(file, "}\n\n") ||
+	    P(file,
+	      "static void %s_train_hogwild_(char *m_,"
+	      " char *p_,"
+	      " const %s *x_,"
+	      " const %s *y_,"
+	      " size_t lo_,"
+	      " size_t hi_) {\n"
+	      "  size_t s_, e_;\n"
+	      "  for (s_=lo_; s_<hi_; s_=e_) {\n"
+	      "    e_ = ((hi_ - s_) < %lu) ? hi_ : (s_ + %lu);\n"
+	      "    %s_train_shard_(m_, p_, x_, y_, s_, e_);\n"
+	      "    %s_update_(m_, m_, p_, e_ - s_);\n"
+	      "  }\n"
+	      "}\n\n",
+	      ann->prefix,
+	      input(ann),
+	      p,
+	      UL(ann->batch),
+	      UL(ann->batch),
+	      ann->prefix,
+	      ann->prefix)) {
 		G__DEBUG(0);
 		return -1;
 	}
-	if (!ann->cuda) {
-		g__sprintf(s,
-			n,
-			"%s%s%s.c",
-			g__strlen(tmp) ? tmp : "",
-			g__strlen(tmp) ? "/" : "",
-			ann->module);
-	} else {
-		g__sprintf(s,
+	return 0;
+}
+
+/*
+ * activate_batch: the activate program over blocks of up to BLOCK samples.
+ * Activations of the block live in the caller's scratch t_ (one a_ region
+ * per sample, r bytes apart, memory_batch bytes in all), weights stay in
+ * m_, so no call allocates. Each weight row is read once per block and
+ * multiplied against four samples at a time.
+ */
+
+static int
+batch_copyx(const struct g__ann_program_inst *inst,
+	    uint64_t base,
+	    uint64_t r,
+	    FILE *file)
+{
+	if (G__ANN_INPUT_UINT8 == inst->arg[2].i) {
+		if (P(file,
+		      "    for (k=0; k<b_; ++k) { /* COPYX */\n"
+		      "      %s *z = (%s *)( t_ + k * %lu + %lu );\n"
+		      "      const uint8_t *u = x_ + (s_ + k) * %lu;\n"
+		      "      %s i;\n"
+		      "      for (i=0; i<%lu; ++i) {\n"
+		      "        z[i] = (%s)u[i] * (%s)%.17g;\n"
+		      "      }\n"
+		      "    }\n\n",
+		      precision(inst),
+		      precision(inst),
+		      UL(r),
+		      UL(inst->arg[0].i - base),
+		      UL(inst->arg[1].i),
+		      type(inst->arg[1].i),
+		      UL(inst->arg[1].i),
+		      precision(inst),
+		      precision(inst),
+		      inst->arg[3].r)) {
+			G__DEBUG(0);
+			return -1;
+		}
+		return 0;
+	}
+	if (P(file,
+	      "    for (k=0; k<b_; ++k) { /* COPYX */\n"
+	      "      memcpy(t_ + k * %lu + %lu,\n"
+	      "             x_ + (s_ + k) * %lu,\n"
+	      "             %lu * sizeof (%s));\n"
+	      "    }\n\n",
+	      UL(r),
+	      UL(inst->arg[0].i - base),
+	      UL(inst->arg[1].i),
+	      UL(inst->arg[1].i),
+	      precision(inst))) {
+		G__DEBUG(0);
+		return -1;
+	}
+	return 0;
+}
+
+/* batch_mul1 on weights in panels, four samples of a panel at a time */
+
+static int
+batch_panel1(const struct g__ann_program_inst *inst,
+	     const struct g__ann_program_inst *bias,
+	     uint64_t base,
+	     uint64_t r,
+	     FILE *file)
+{
+	const char *p;
+	uint64_t m, z, x;
+	char h[64];
+	int e, q;
+
+	p = precision(inst);
+	m = inst->arg[4].i;
+	z = inst->arg[0].i - base;
+	x = inst->arg[2].i - base;
+	lanes(inst, h, sizeof (h));
+	e = P(file,
+	      "    { /* MAC1 */\n"
+	      "      const %s *A = (const %s *)( m_ + %lu );\n",
+	      p,
+	      p,
+	      UL(inst->arg[1].i));
+	if (bias) {
+		e = e || P(file,
+			   "      const %s *b = (const %s *)( m_ + %lu );\n",
+			   p,
+			   p,
+			   UL(bias->arg[1].i));
+	}
+	e = e || P(file,
+		   "      %s i, j, r, h;\n"
+		   "      for (i=0; i<%lu; i+=%d) {\n"
+		   "        h = %s;\n"
+		   "        for (k=0; (k + 4)<=b_; k+=4) {\n",
+		   type(G__MAX(inst->arg[3].i, m) + G__ANN_PANEL),
+		   UL(inst->arg[3].i),
+		   G__ANN_PANEL,
+		   h);
+	for (q=0; q<4; ++q) {
+		e = e || P(file,
+			   "          const %s *B%d ="
+			   " (const %s *)( t_ + (k + %d) * %lu + %lu );\n",
+			   p,
+			   q,
+			   p,
+			   q,
+			   UL(r),
+			   UL(x));
+	}
+	e = e || P(file,
+		   "          %s s0[%d], s1[%d], s2[%d], s3[%d];\n"
+		   "          for (r=0; r<%d; ++r) {\n"
+		   "            s0[r] = s1[r] = s2[r] = s3[r] = 0.0;\n"
+		   "            for (j=0; j<%lu; ++j) {\n"
+		   "              s0[r] += A[j * %d + r] * B0[j];\n"
+		   "              s1[r] += A[j * %d + r] * B1[j];\n"
+		   "              s2[r] += A[j * %d + r] * B2[j];\n"
+		   "              s3[r] += A[j * %d + r] * B3[j];\n"
+		   "            }\n"
+		   "          }\n"
+		   "          for (r=0; r<h; ++r) {\n",
+		   p,
+		   G__ANN_PANEL,
+		   G__ANN_PANEL,
+		   G__ANN_PANEL,
+		   G__ANN_PANEL,
+		   G__ANN_PANEL,
+		   UL(m),
+		   G__ANN_PANEL,
+		   G__ANN_PANEL,
+		   G__ANN_PANEL,
+		   G__ANN_PANEL);
+	for (q=0; q<4; ++q) {
+		e = e || P(file,
+			   "            ((%s *)( t_ + (k + %d) * %lu + %lu ))[i + r] ="
+			   " %ss%d[r];\n",
+			   p,
+			   q,
+			   UL(r),
+			   UL(z),
+			   bias ? "b[i + r] + " : "",
+			   q);
+	}
+	e = e || P(file,
+		   "          }\n"
+		   "        }\n"
+		   "        for (; k<b_; ++k) {\n"
+		   "          const %s *B0 = (const %s *)( t_ + k * %lu + %lu );\n"
+		   "          %s s0[%d];\n"
+		   "          for (r=0; r<%d; ++r) {\n"
+		   "            s0[r] = 0.0;\n"
+		   "            for (j=0; j<%lu; ++j) {\n"
+		   "              s0[r] += A[j * %d + r] * B0[j];\n"
+		   "            }\n"
+		   "          }\n"
+		   "          for (r=0; r<h; ++r) {\n"
+		   "            ((%s *)( t_ + k * %lu + %lu ))[i + r] = %ss0[r];\n"
+		   "          }\n"
+		   "        }\n"
+		   "        A += %lu;\n"
+		   "      }\n"
+		   "    }\n\n",
+		   p,
+		   p,
+		   UL(r),
+		   UL(x),
+		   p,
+		   G__ANN_PANEL,
+		   G__ANN_PANEL,
+		   UL(m),
+		   G__ANN_PANEL,
+		   p,
+		   UL(r),
+		   UL(z),
+		   bias ? "b[i + r] + " : "",
+		   UL(G__ANN_PANEL * m));
+	if (e) {
+		G__DEBUG(0);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * The sum of partials s<q>[0 .. u) of row i, the bias added where the
+ * single sample code adds it: first when folded (fuse), last when the ADD
+ * follows on its own.
+ */
+
+static int
+batch_sum(const struct g__ann_program_inst *bias,
+	  const struct g__emitc_strategy *strategy,
+	  int q,
+	  uint64_t u,
+	  FILE *file)
+{
+	uint64_t k;
+	int e;
+
+	e = (bias && strategy->fuse) ? P(file, "b[i] + ") : 0;
+	for (k=0; k<u; ++k) {
+		e = e || P(file, "%ss%d[%lu]", k ? " + " : "", q, UL(k));
+	}
+	if (bias && !strategy->fuse) {
+		e = e || P(file, " + b[i]");
+	}
+	return e || P(file, ";\n");
+}
+
+/* rows from i up to end of batch_mul1, u partial sums per row */
+
+static int
+batch_rows(const struct g__ann_program_inst *inst,
+	   const struct g__ann_program_inst *bias,
+	   const struct g__emitc_strategy *strategy,
+	   uint64_t u,
+	   uint64_t end,
+	   uint64_t r,
+	   uint64_t base,
+	   FILE *file)
+{
+	const char *p;
+	uint64_t m, z, x, k;
+	int e, q, c;
+
+	p = precision(inst);
+	m = inst->arg[4].i;
+	z = inst->arg[0].i - base;
+	x = inst->arg[2].i - base;
+	e = P(file, "      for (; i<%lu; ++i) {\n", UL(end));
+	for (c=4; 0<c; c-=3) {
+
+		/* four samples at a time, then the rest one by one */
+
+		if (4 == c) {
+			e = e || P(file, "        for (k=0; (k + 4)<=b_; k+=4) {\n");
+		}
+		else {
+			e = e || P(file, "        for (; k<b_; ++k) {\n");
+		}
+		for (q=0; q<c; ++q) {
+			e = e || P(file,
+				   "          const %s *B%d ="
+				   " (const %s *)( t_ + (k + %d) * %lu + %lu );\n",
+				   p,
+				   q,
+				   p,
+				   q,
+				   UL(r),
+				   UL(x));
+		}
+		e = e || P(file, "          %s ", p);
+		for (q=0; q<c; ++q) {
+			e = e || P(file, "%ss%d[%lu]", q ? ", " : "", q, UL(u));
+		}
+		e = e || P(file,
+			   ";\n"
+			   "          for (j=0; j<%lu; ++j) {\n"
+			   "            ",
+			   UL(u));
+		for (q=0; q<c; ++q) {
+			e = e || P(file, "s%d[j] = ", q);
+		}
+		e = e || P(file,
+			   "0.0;\n"
+			   "          }\n"
+			   "          for (j=0; j<%lu; j+=%lu) {\n",
+			   UL(m / u * u),
+			   UL(u));
+		for (q=0; q<c; ++q) {
+			for (k=0; k<u; ++k) {
+				e = e || P(file,
+					   "            s%d[%lu] +="
+					   " A[j + %lu] * B%d[j + %lu];\n",
+					   q,
+					   UL(k),
+					   UL(k),
+					   q,
+					   UL(k));
+			}
+		}
+		e = e || P(file, "          }\n");
+		if (m % u) {
+			e = e || P(file, "          for (; j<%lu; ++j) {\n", UL(m));
+			for (q=0; q<c; ++q) {
+				e = e || P(file,
+					   "            s%d[0] += A[j] * B%d[j];\n",
+					   q,
+					   q);
+			}
+			e = e || P(file, "          }\n");
+		}
+		for (q=0; q<c; ++q) {
+			e = e ||
+				P(file,
+				  "          ((%s *)( t_ + (k + %d) * %lu + %lu ))[i] = ",
+				  p,
+				  q,
+				  UL(r),
+				  UL(z)) ||
+				batch_sum(bias, strategy, q, u, file);
+		}
+		e = e || P(file, "        }\n");
+	}
+	e = e || P(file,
+		   "        A += %lu;\n"
+		   "      }\n",
+		   UL(inst->arg[5].i));
+	if (e) {
+		G__DEBUG(0);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Each row is summed as inst_mul1() sums it for the strategy at hand:
+ * unroll partial sums for the rows in whole tiles, a single sum past them,
+ * so batches and contexts come out as g_activate() does.
+ */
+
+static int
+batch_mul1(const struct g__ann_program_inst *inst,
+	   const struct g__ann_program_inst *bias,
+	   const struct g__emitc_strategy *strategy,
+	   uint64_t base,
+	   uint64_t r,
+	   FILE *file)
+{
+	const char *p;
+	uint64_t n, t;
+	int e;
+
+	if (G__ANN_LAYOUT_BLOCKED == inst->layout) {
+		return batch_panel1(inst, bias, base, r, file);
+	}
+	p = precision(inst);
+	n = inst->arg[3].i;
+	t = G__MIN((uint64_t)G__MAX(1, strategy->tile), n);
+	e = P(file,
+	      "    { /* MAC1 */\n"
+	      "      const %s *A = (const %s *)( m_ + %lu );\n",
+	      p,
+	      p,
+	      UL(inst->arg[1].i));
+	if (bias) {
+		e = e || P(file,
+			   "      const %s *b = (const %s *)( m_ + %lu );\n",
+			   p,
+			   p,
+			   UL(bias->arg[1].i));
+	}
+	e = e ||
+		P(file,
+		  "      %s i, j;\n"
+		  "      i = 0;\n",
+		  type(G__MAX(n, inst->arg[4].i))) ||
+		batch_rows(inst,
+			   bias,
+			   strategy,
+			   partials(inst, strategy),
+			   n / t * t,
+			   r,
+			   base,
+			   file);
+	if (n % t) {
+		e = e || batch_rows(inst, bias, strategy, 1, n, r, base, file);
+	}
+	e = e || P(file, "    }\n\n");
+	if (e) {
+		G__DEBUG(0);
+		return -1;
+	}
+	return 0;
+}
+
+static int
+batch_add(const struct g__ann_program_inst *inst,
+	  uint64_t base,
+	  uint64_t r,
+	  FILE *file)
+{
+	if (P(file,
+	      "    for (k=0; k<b_; ++k) { /* ADD */\n"
+	      "      %s *za = (%s *)( t_ + k * %lu + %lu );\n"
+	      "      const %s *B = (const %s *)( m_ + %lu );\n"
+	      "      %s i;\n"
+	      "      for (i=0; i<%lu; ++i) {\n"
+	      "        za[i] += B[i];\n"
+	      "      }\n"
+	      "    }\n\n",
+	      precision(inst),
+	      precision(inst),
+	      UL(r),
+	      UL(inst->arg[0].i - base),
+	      precision(inst),
+	      precision(inst),
+	      UL(inst->arg[1].i),
+	      type(inst->arg[2].i),
+	      UL(inst->arg[2].i))) {
+		G__DEBUG(0);
+		return -1;
+	}
+	return 0;
+}
+
+static int
+batch_activation(const struct g__ann_program_inst *inst,
+		 uint64_t base,
+		 uint64_t r,
+		 FILE *file)
+{
+	struct view view;
+	int e;
+
+	/* the single sample kernel, rebased onto the sample's a_ region */
+
+	view.lo = "m_";
+	view.hi = "a_";
+	view.split = base;
+	if (P(file,
+	      "    for (k=0; k<b_; ++k) {\n"
+	      "      char *a_ = t_ + k * %lu;\n",
+	      UL(r))) {
+		G__DEBUG(0);
+		return -1;
+	}
+	switch (inst->opc) {
+	case G__ANN_PROGRAM_INST_RELU   : e = inst_relu(inst, &view, file); break;
+	case G__ANN_PROGRAM_INST_SOFTMAX: e = inst_softmax(inst, &view, file); break;
+	case G__ANN_PROGRAM_INST_SIGMOID: e = inst_sigmoid(inst, &view, file); break;
+	default /*--------------------*/: e = -1; break;
+	}
+	if (e || P(file, "    }\n\n")) {
+		G__DEBUG(0);
+		return -1;
+	}
+	return 0;
+}
+
+static uint64_t
+batch_region(const struct g__ann *ann, uint64_t *base)
+{
+	/* the scratch of G__ANN_PROGRAM_INFER, r bytes */
+
+	(*base) = ann->precision.scratch;
+	return ann->precision.context;
+}
+
+static int
+batch_program(const struct g__ann *ann,
+	      const struct g__emitc_strategy *strategy,
+	      FILE *file)
+{
+	const struct g__ann_program_inst *inst, *bias;
+	const struct g__ann_program *prog;
+	uint64_t base, r;
+	int i, e;
+
+	prog = &ann->program[G__ANN_PROGRAM_INFER];
+	r = batch_region(ann, &base);
+	for (i=1; i<prog->size; ++i) {
+		inst = &prog->inst[i];
+		switch (inst->opc) {
+		case G__ANN_PROGRAM_INST_COPYX:
+			e = batch_copyx(inst, base, r, file);
+			break;
+		case G__ANN_PROGRAM_INST_MAC1:
+			bias = 0;
+			if (((i + 1) < prog->size) &&
+			    (G__ANN_PROGRAM_INST_ADD == inst[1].opc) &&
+			    (inst[1].arg[0].i == inst->arg[0].i)) {
+				bias = &inst[1];
+				++i;
+			}
+			e = batch_mul1(inst, bias, strategy, base, r, file);
+			break;
+		case G__ANN_PROGRAM_INST_ADD:
+			e = batch_add(inst, base, r, file);
+			break;
+		case G__ANN_PROGRAM_INST_LINEAR:
+			e = 0;
+			break;
+		case G__ANN_PROGRAM_INST_RELU:
+		case G__ANN_PROGRAM_INST_SOFTMAX:
+		case G__ANN_PROGRAM_INST_SIGMOID:
+			e = batch_activation(inst, base, r, file);
+			break;
+		default:
+			G__DEBUG(G__ERR_SOFTWARE);
+			assert( 0 );
+			exit(-1);
+			return -1;
+		}
+		if (e) {
+			G__DEBUG(0);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int
+activate_batch(const struct g__ann *ann,
+	       const struct g__emitc_strategy *strategy,
+	       FILE *file)
+{
+	const struct g__ann_program *prog;
+	uint64_t base, r, o, n;
+	const char *p;
+
+	prog = &ann->program[G__ANN_PROGRAM_INFER];
+	p = precision(&prog->inst[0]);
+	r = batch_region(ann, &base);
+	o = prog->inst[0].arg[0].i - base;
+	n = ann->nodes[ann->layers - 1];
+	if (P(file,
+	      "static void %s_activate_batch_(const char *m_,"
+	      " char *t_,"
+	      " const %s *x_,"
+	      " size_t n_,"
+	      " %s *y_) {\n"
+	      "  size_t s_, b_, k;\n\n"
+	      "  for (s_=0; s_<n_; s_+=b_) {\n"
+	      "    b_ = ((n_ - s_) < %d) ? (n_ - s_) : %d;\n\n",
+	      ann->prefix,
+	      input(ann),
+	      p,
+	      BLOCK,
+	      BLOCK) ||
+	    batch_program(ann, strategy, file) ||
+	    P(file,
+	      "    for (k=0; k<b_; ++k) { /* RETARG */\n"
+	      "      memcpy(y_ + (s_ + k) * %lu,\n"
+	      "             t_ + k * %lu + %lu,\n"
+	      "             %lu * sizeof (%s));\n"
+	      "    }\n"
+	      "  }\n"
+	      "}\n\n",
+	      UL(n),
+	      UL(r),
+	      UL(o),
+	      UL(n),
+	      p)) {
+		G__DEBUG(0);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * activate_ctx: one sample, weights read from m_ (never written) and
+ * activations kept in the caller's context t_, so any number of threads
+ * may run it concurrently on the same weights.
+ */
+
+static int
+activate_context(const struct g__ann *ann,
+		 const struct g__emitc_strategy *strategy,
+		 FILE *file)
+{
+	const struct g__ann_program *prog;
+	uint64_t base, o;
+	const char *p;
+
+	prog = &ann->program[G__ANN_PROGRAM_INFER];
+	p = precision(&prog->inst[0]);
+	batch_region(ann, &base);
+	o = prog->inst[0].arg[0].i - base;
+	if (P(file,
+	      "static %s *%s_activate_ctx_(const char *m_,"
+	      " char *t_,"
+	      " const %s *x_) {\n"
+	      "  const size_t s_ = 0, b_ = 1;\n"
+	      "  size_t k;\n\n"
+	      "  {\n",
+	      p,
+	      ann->prefix,
+	      input(ann)) ||
+	    batch_program(ann, strategy, file) ||
+	    P(file,
+	      "  }\n"
+	      "  return (%s *)( t_ + %lu );\n"
+	      "}\n\n",
+	      p,
+	      UL(o))) {
+		G__DEBUG(0);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * activate_layer: layer l_ alone of one sample, as activate_ctx with the
+ * activations in t_, for the stages of a pipeline. Layer 0 is the copy of
+ * x_, layer l from its MAC1 up to the next. layer_size gives the width of
+ * each layer, zero past the last.
+ */
+
+static int
+activate_layer(const struct g__ann *ann,
+	       const struct g__emitc_strategy *strategy,
+	       FILE *file)
+{
+	const struct g__ann_program *prog;
+	struct view view;
+	const char *p;
+	int i, j, l, e;
+
+	prog = &ann->program[G__ANN_PROGRAM_INFER];
+	p = precision(&prog->inst[0]);
+	view.lo = "m_";
+	view.hi = "t_";
+	batch_region(ann, &view.split);
+	e = P(file,
+	      "static %s *%s_activate_layer_(const char *m_,"
+	      " char *t_,"
+	      " const %s *x_,"
+	      " int l_) {\n"
+	      "  switch (l_) {\n",
+	      p,
+	      ann->prefix,
+	      input(ann));
+	for (i=1, l=0; !e && (l<ann->layers); ++l, i=j) {
+		for (j=i + 1; j<prog->size; ++j) {
+			if (G__ANN_PROGRAM_INST_MAC1 == prog->inst[j].opc) {
+				break;
+			}
+		}
+		e = P(file, "  case %d:\n", l) ||
+			body(ann, prog, strategy, &view, i, j, file) ||
+			P(file,
+			  "    return (%s *)( t_ + %lu );\n",
+			  p,
+			  vo(&view, prog->inst[i].arg[0].i));
+	}
+	if (e ||
+	    P(file,
+	      "  }\n"
+	      "  return 0;\n"
+	      "}\n\n"
+	      "static size_t %s_layer_size_(int l_) {\n"
+	      "  switch (l_) {\n",
+	      ann->prefix)) {
+		G__DEBUG(0);
+		return -1;
+	}
+	for (l=0; l<ann->layers; ++l) {
+		if (P(file,
+		      "  case %d: return %lu;\n",
+		      l,
+		      UL(ann->nodes[l]))) {
+			G__DEBUG(0);
+			return -1;
+		}
+	}
+	if (P(file,
+	      "  }\n"
+	      "  return 0;\n"
+	      "}\n\n")) {
+		G__DEBUG(0);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * export_/import_: the weights to/from the portable form, per layer w[l]
+ * row-major then b[l], the layer taken from its MAC1 and the ADD after.
+ */
+
+static int
+weights(const struct g__ann *ann, int import, FILE *file)
+{
+	const struct g__ann_program_inst *inst;
+	const struct g__ann_program *prog;
+	const char *p;
+	int i, e;
+
+	prog = &ann->program[G__ANN_PROGRAM_ACTIVATE];
+	p = precision(&prog->inst[0]);
+	e = import ?
+		P(file,
+		  "static void %s_import_(char *m_, const %s *x_) {\n",
+		  ann->prefix,
+		  p) :
+		P(file,
+		  "static void %s_export_(const char *m_, %s *x_) {\n",
+		  ann->prefix,
+		  p);
+	for (i=1; !e && (i<prog->size); ++i) {
+		inst = &prog->inst[i];
+		if (G__ANN_PROGRAM_INST_MAC1 != inst->opc) {
+			continue;
+		}
+		assert( G__ANN_PROGRAM_INST_ADD == inst[1].opc );
+		e = P(file,
+		      "  {\n"
+		      "    %s%s *w = (%s%s *)( m_ + %lu );\n"
+		      "    %s i, j;\n"
+		      "    for (i=0; i<%lu; ++i) {\n"
+		      "      for (j=0; j<%lu; ++j) {\n"
+		      "        %sw[",
+		      import ? "" : "const ",
+		      p,
+		      import ? "" : "const ",
+		      p,
+		      UL(inst->arg[1].i),
+		      type(inst->arg[3].i * inst->arg[4].i +
+			   G__ANN_PANEL * inst->arg[4].i),
+		      UL(inst->arg[3].i),
+		      UL(inst->arg[4].i),
+		      import ? "" : "*x_++ = ") ||
+			element(inst, "i", "j", file) ||
+			P(file,
+			  "]%s;\n"
+			  "      }\n"
+			  "    }\n",
+			  import ? " = *x_++" : "") ||
+			(import ?
+			 P(file,
+			   "    memcpy(m_ + %lu, x_, %lu * sizeof (%s));\n",
+			   UL(inst[1].arg[1].i),
+			   UL(inst->arg[3].i),
+			   p) :
+			 P(file,
+			   "    memcpy(x_, m_ + %lu, %lu * sizeof (%s));\n",
+			   UL(inst[1].arg[1].i),
+			   UL(inst->arg[3].i),
+			   p)) ||
+			P(file,
+			  "    x_ += %lu;\n"
+			  "  }\n",
+			  UL(inst->arg[3].i));
+	}
+	if (e || P(file, "}\n\n")) {
+		G__DEBUG(0);
+		return -1;
+	}
+	return 0;
+}
+
+static int
+export_c(const struct g__ann *ann,
+	 const struct g__emitc_strategy *strategy,
+	 FILE *file)
+{
+	const struct g__ann_program_inst *inst1, *inst2;
+	uint64_t base;
+
+	inst1 = &ann->program[G__ANN_PROGRAM_ACTIVATE].inst[0];
+	inst2 = &ann->program[G__ANN_PROGRAM_TRAIN].inst[0];
+	if (P(file,
+	      "int %s_version(void) {\n"
+	      "  return %d;\n"
+	      "}\n\n",
+	      ann->prefix,
+	      G__VERSION) ||
+	    P(file,
+	      "size_t %s_memory_size(void) {\n"
+	      "  return %lu;\n"
+	      "}\n\n",
+	      ann->prefix,
+	      UL(ann->precision.size)) ||
+	    P(file,
+	      "size_t %s_memory_hard(void) {\n"
+	      "  return %lu;\n"
+	      "}\n\n",
+	      ann->prefix,
+	      UL(ann->precision.hard)) ||
+	    P(file,
+	      "size_t %s_memory_unit(void) {\n"
+	      "  return sizeof (%s);\n"
+	      "}\n\n",
+	      ann->prefix,
+	      precision(inst2)) ||
+	    P(file,
+	      "size_t %s_input_unit(void) {\n"
+	      "  return sizeof (%s);\n"
+	      "}\n\n",
+	      ann->prefix,
+	      input(ann)) ||
+	    P(file,
+	      "int %s_batch(void) {\n"
+	      "  return %d;\n"
+	      "}\n\n",
+	      ann->prefix,
+	      ann->batch) ||
+	    P(file,
+	      "int %s_schedule(void) {\n"
+	      "  return %d;\n"
+	      "}\n\n",
+	      ann->prefix,
+	      ann->schedule) ||
+	    P(file,
+	      "void %s_initialize(void *m) {\n"
+	      "  %s_initialize_((char *)m);\n"
+	      "}\n\n",
+	      ann->prefix,
+	      ann->prefix) ||
+	    P(file,
+	      "void *%s_activate(void *m, const void *x) {\n"
+	      "  return %s_activate_((char *)m, (const %s *)x);\n"
+	      "}\n\n",
+	      ann->prefix,
+	      ann->prefix,
+	      input(ann)) ||
+	    P(file,
+	      "void %s_activate_into(void *m, const void *x, void *y) {\n"
+	      "  %s_activate_into_((char *)m, (const %s *)x, (%s *)y);\n"
+	      "}\n\n",
+	      ann->prefix,
+	      ann->prefix,
+	      input(ann),
+	      precision(&ann->program[G__ANN_PROGRAM_ACTIVATE].inst[0])) ||
+	    P(file,
+	      "size_t %s_memory_context(void) {\n"
+	      "  return %lu;\n"
+	      "}\n\n",
+	      ann->prefix,
+	      UL(batch_region(ann, &base))) ||
+	    P(file,
+	      "size_t %s_memory_batch(void) {\n"
+	      "  return %d * %lu;\n"
+	      "}\n\n",
+	      ann->prefix,
+	      BLOCK,
+	      UL(batch_region(ann, &base))) ||
+	    P(file,
+	      "void %s_activate_batch(const void *m,"
+	      " void *t,"
+	      " const void *x,"
+	      " size_t n,"
+	      " void *y) {\n"
+	      "  %s_activate_batch_((const char *)m,"
+	      " (char *)t,"
+	      " (const %s *)x,"
+	      " n,"
+	      " (%s *)y);\n"
+	      "}\n\n",
+	      ann->prefix,
+	      ann->prefix,
+	      input(ann),
+	      precision(inst1)) ||
+	    P(file,
+	      "void *%s_activate_ctx(const void *m, void *t, const void *x) {\n"
+	      "  return %s_activate_ctx_((const char *)m,"
+	      " (char *)t,"
+	      " (const %s *)x);\n"
+	      "}\n\n",
+	      ann->prefix,
+	      ann->prefix,
+	      input(ann)) ||
+	    P(file,
+	      "void *%s_activate_layer(const void *m,"
+	      " void *t,"
+	      " const void *x,"
+	      " int l) {\n"
+	      "  return %s_activate_layer_((const char *)m,"
+	      " (char *)t,"
+	      " (const %s *)x,"
+	      " l);\n"
+	      "}\n\n",
+	      ann->prefix,
+	      ann->prefix,
+	      input(ann)) ||
+	    P(file,
+	      "size_t %s_layer_size(int l) {\n"
+	      "  return %s_layer_size_(l);\n"
+	      "}\n\n",
+	      ann->prefix,
+	      ann->prefix) ||
+	    P(file,
+	      "void %s_export(const void *m, void *x) {\n"
+	      "  %s_export_((const char *)m, (%s *)x);\n"
+	      "}\n\n",
+	      ann->prefix,
+	      ann->prefix,
+	      precision(inst1)) ||
+	    P(file,
+	      "void %s_import(void *m, const void *x) {\n"
+	      "  %s_import_((char *)m, (const %s *)x);\n"
+	      "}\n\n",
+	      ann->prefix,
+	      ann->prefix,
+	      precision(inst1)) ||
+	    P(file,
+	      "void %s_train(void *m, const void *x, const void *y) {\n"
+	      "  %s_train_((char *)m, (const %s *)x, (const %s *)y);\n"
+	      "}\n\n",
+	      ann->prefix,
+	      ann->prefix,
+	      input(ann),
+	      precision(inst2)) ||
+	    P(file,
+	      "void %s_train_labels(void *m, const void *x, const void *y) {\n"
+	      "  %s_train_labels_((char *)m,"
+	      " (const %s *)x,"
+	      " (const int32_t *)y);\n"
+	      "}\n\n",
+	      ann->prefix,
+	      ann->prefix,
+	      input(ann)) ||
+	    P(file,
+	      "void %s_train_gather(void *m,"
+	      " const void *x,"
+	      " const void *y,"
+	      " const void *i,"
+	      " size_t xs,"
+	      " size_t ys) {\n"
+	      "  %s_train_gather_((char *)m,"
+	      " (const char *)x,"
+	      " (const char *)y,"
+	      " (const uint32_t *)i,"
+	      " xs,"
+	      " ys);\n"
+	      "}\n\n",
+	      ann->prefix,
+	      ann->prefix) ||
+	    P(file,
+	      "void %s_train_shard(const void *m,"
+	      " void *p,"
+	      " const void *x,"
+	      " const void *y,"
+	      " size_t lo,"
+	      " size_t hi) {\n"
+	      "  %s_train_shard_((const char *)m,"
+	      " (char *)p,"
+	      " (const %s *)x,"
+	      " (const %s *)y,"
+	      " lo,"
+	      " hi);\n"
+	      "}\n\n",
+	      ann->prefix,
+	      ann->prefix,
+	      input(ann),
+	      precision(inst2)) ||
+	    P(file,
+	      "void %s_train_shard_labels(const void *m,"
+	      " void *p,"
+	      " const void *x,"
+	      " const void *y,"
+	      " size_t lo,"
+	      " size_t hi) {\n"
+	      "  %s_train_shard_labels_((const char *)m,"
+	      " (char *)p,"
+	      " (const %s *)x,"
+	      " (const int32_t *)y,"
+	      " lo,"
+	      " hi);\n"
+	      "}\n\n",
+	      ann->prefix,
+	      ann->prefix,
+	      input(ann)) ||
+	    P(file,
+	      "void %s_reduce(void *p, const void *q, int id, int n) {\n"
+	      "  %s_reduce_((%s *)p, (const %s *)q, id, n);\n"
+	      "}\n\n",
+	      ann->prefix,
+	      ann->prefix,
+	      precision(inst2),
+	      precision(inst2)) ||
+	    P(file,
+	      "void %s_update(void *m,"
+	      " const void *s,"
+	      " const void *p,"
+	      " size_t n) {\n"
+	      "  %s_update_((char *)m, (const char *)s, (const char *)p, n);\n"
+	      "}\n\n",
+	      ann->prefix,
+	      ann->prefix) ||
+	    P(file,
+	      "void %s_train_hogwild(void *m,"
+	      " void *p,"
+	      " const void *x,"
+	      " const void *y,"
+	      " size_t lo,"
+	      " size_t hi) {\n"
+	      "  %s_train_hogwild_((char *)m,"
+	      " (char *)p,"
+	      " (const %s *)x,"
+	      " (const %s *)y,"
+	      " lo,"
+	      " hi);\n"
+	      "}\n\n",
+	      ann->prefix,
+	      ann->prefix,
+	      input(ann),
+	      precision(inst2))) {
+		G__DEBUG(0);
+		return -1;
+	}
+	if ((1 < strategy->threads) &&
+	    P(file,
+	      "void %s_thread_pool(void (*run)(void *,"
+	      " void (*)(void *, int, int),"
+	      " void *),"
+	      " void *pool) {\n"
+	      "  %s_run_ = run;\n"
+	      "  %s_pool_ = pool;\n"
+	      "}\n\n",
+	      ann->prefix,
+	      ann->prefix,
+	      ann->prefix)) {
+		G__DEBUG(0);
+		return -1;
+	}
+	return 0;
+}
+
+static int
+export_h(const struct g__ann *ann,
+	 const struct g__emitc_strategy *strategy,
+	 FILE *file)
+{
+	if ((1 < strategy->threads) &&
+	    P(file,
+	      "void %s_thread_pool(void (*run)(void *,"
+	      " void (*)(void *, int, int),"
+	      " void *),"
+	      " void *pool);\n",
+	      ann->prefix)) {
+		G__DEBUG(0);
+		return -1;
+	}
+	if (P(file, "int %s_version(void);\n", ann->prefix) ||
+	    P(file, "size_t %s_memory_size(void);\n", ann->prefix) ||
+	    P(file, "size_t %s_memory_hard(void);\n", ann->prefix) ||
+	    P(file, "size_t %s_memory_unit(void);\n", ann->prefix) ||
+	    P(file, "size_t %s_input_unit(void);\n", ann->prefix) ||
+	    P(file, "int %s_batch(void);\n", ann->prefix) ||
+	    P(file, "int %s_schedule(void);\n", ann->prefix) ||
+	    P(file, "void %s_initialize(void *m);\n", ann->prefix) ||
+	    P(file,
+	      "void *%s_activate(void *m, const void *x);\n",
+	      ann->prefix) ||
+	    P(file,
+	      "void %s_activate_into(void *m, const void *x, void *y);\n",
+	      ann->prefix) ||
+	    P(file, "size_t %s_memory_context(void);\n", ann->prefix) ||
+	    P(file, "size_t %s_memory_batch(void);\n", ann->prefix) ||
+	    P(file,
+	      "void %s_activate_batch(const void *m,"
+	      " void *t,"
+	      " const void *x,"
+	      " size_t n,"
+	      " void *y);\n",
+	      ann->prefix) ||
+	    P(file,
+	      "void *%s_activate_ctx(const void *m, void *t, const void *x);\n",
+	      ann->prefix) ||
+	    P(file,
+	      "void *%s_activate_layer(const void *m,"
+	      " void *t,"
+	      " const void *x,"
+	      " int l);\n",
+	      ann->prefix) ||
+	    P(file, "size_t %s_layer_size(int l);\n", ann->prefix) ||
+	    P(file, "void %s_export(const void *m, void *x);\n", ann->prefix) ||
+	    P(file, "void %s_import(void *m, const void *x);\n", ann->prefix) ||
+	    P(file,
+	      "void %s_train(void *m, const void *x, const void *y);\n",
+	      ann->prefix) ||
+	    P(file,
+	      "void %s_train_labels(void *m, const void *x, const void *y);\n",
+	      ann->prefix) ||
+	    P(file,
+	      "void %s_train_gather(void *m,"
+	      " const void *x,"
+	      " const void *y,"
+	      " const void *i,"
+	      " size_t xs,"
+	      " size_t ys);\n",
+	      ann->prefix) ||
+	    P(file,
+	      "void %s_train_shard(const void *m,"
+	      " void *p,"
+	      " const void *x,"
+	      " const void *y,"
+	      " size_t lo,"
+	      " size_t hi);\n",
+	      ann->prefix) ||
+	    P(file,
+	      "void %s_train_shard_labels(const void *m,"
+	      " void *p,"
+	      " const void *x,"
+	      " const void *y,"
+	      " size_t lo,"
+	      " size_t hi);\n",
+	      ann->prefix) ||
+	    P(file,
+	      "void %s_reduce(void *p, const void *q, int id, int n);\n",
+	      ann->prefix) ||
+	    P(file,
+	      "void %s_update(void *m,"
+	      " const void *s,"
+	      " const void *p,"
+	      " size_t n);\n",
+	      ann->prefix) ||
+	    P(file,
+	      "void %s_train_hogwild(void *m,"
+	      " void *p,"
+	      " const void *x,"
+	      " const void *y,"
+	      " size_t lo,"
+	      " size_t hi);\n\n",
+	      ann->prefix)) {
+		G__DEBUG(0);
+		return -1;
+	}
+	return 0;
+}
+
+static int
+guard(const char *module, FILE *file, int end)
+{
+	const char *s;
+	int e;
+
+	s = capitalize(module);
+	if (!s) {
+		G__DEBUG(0);
+		return -1;
+	}
+	if (!end) {
+		e = P(file,
+		      "#ifndef _%s_H_\n"
+		      "#define _%s_H_\n\n"
+		      "#include <stddef.h>\n\n"
+		      "#ifdef __cplusplus\n"
+		      "extern \"C\" {\n"
+		      "#endif /* __cplusplus */\n\n",
+		      s,
+		      s);
+	}
+	else {
+		e = P(file,
+		      "#ifdef __cplusplus\n"
+		      "}\n"
+		      "#endif /* __cplusplus */\n\n"
+		      "#endif /* _%s_H_ */\n",
+		      s);
+	}
+	G__FREE(s);
+	if (e) {
+		G__DEBUG(0);
+		return -1;
+	}
+	return 0;
+}
+
+int
+g__emitc(const struct g__ann *ann,
+	 const char *tmp,
+	 const struct g__emitc_strategy *strategy)
+{
+	assert( ann );
+
+	return g__emitc_many(&ann, 1, tmp, strategy);
+}
+
+int
+g__emitc_many(const struct g__ann *const *ann,
+	      int k,
+	      const char *tmp,
+	      const struct g__emitc_strategy *strategy_)
+{
+	struct g__emitc_strategy strategy;
+	const char *module;
+	FILE *file1, *file2;
+	size_t n;
+	char *s;
+	int i;
+
+	assert( ann && (0 < k) );
+
+	memset(&strategy, 0, sizeof (strategy));
+	if (strategy_) {
+		strategy = (*strategy_);
+	}
+	module = ann[0]->module;
+
+	n = g__strlen(module) + g__strlen(tmp) + 32;
+	s = g__malloc(n);
+	if (!s) {
+		G__DEBUG(0);
+		return -1;
+	}
+	if (!ann[0]->cuda) {
+		g__sprintf(s,
+			n,
+			"%s%s%s.c",
+			g__strlen(tmp) ? tmp : "",
+			g__strlen(tmp) ? "/" : "",
+			module);
+	} else {
+		g__sprintf(s,
 			n,
 			"%s%s%s.cu",
 			g__strlen(tmp) ? tmp : "",
 			g__strlen(tmp) ? "/" : "",
-			ann->module);
+			module);
 	}
 	file1 = fopen(s, "w");
 	g__sprintf(s,
@@ -920,20 +3243,52 @@ g__emitc(const struct g__ann *ann, const char *tmp)
 		   "%s%s%s.h",
 		   g__strlen(tmp) ? tmp : "",
 		   g__strlen(tmp) ? "/" : "",
-		   ann->module);
+		   module);
 	file2 = fopen(s, "w");
 	G__FREE(s);
 	if (!file1 || !file2) {
+		if (file1) {
+			fclose(file1);
+		}
+		if (file2) {
+			fclose(file2);
+		}
 		G__DEBUG(G__ERR_FILE);
 		return -1;
 	}
-	if (header(ann, file1, 1) ||
-	    header(ann, file2, 0) ||
-	    initialize(ann, file1) ||
-	    activate(ann, file1) ||
-	    backprop(ann, file1) ||
-	    train(ann, file1) ||
-	    export(ann, file1, file2)) {
+	if (header(module, file1, 1) ||
+	    header(module, file2, 0) ||
+	    guard(module, file2, 0)) {
+		fclose(file1);
+		fclose(file2);
+		G__DEBUG(0);
+		return -1;
+	}
+
+	/* models share the translation unit, apart by prefix */
+
+	for (i=0; i<k; ++i) {
+		assert( !strcmp(module, ann[i]->module) );
+		if (workers(ann[i], &strategy, file1) ||
+		    initialize(ann[i], &strategy, file1) ||
+		    activate(ann[i], &strategy, file1) ||
+		    activate_batch(ann[i], &strategy, file1) ||
+		    activate_context(ann[i], &strategy, file1) ||
+		    activate_layer(ann[i], &strategy, file1) ||
+		    weights(ann[i], 0, file1) ||
+		    weights(ann[i], 1, file1) ||
+		    backprop(ann[i], &strategy, file1) ||
+		    train(ann[i], &strategy, file1) ||
+		    train_parallel(ann[i], &strategy, file1) ||
+		    export_c(ann[i], &strategy, file1) ||
+		    export_h(ann[i], &strategy, file2)) {
+			fclose(file1);
+			fclose(file2);
+			G__DEBUG(0);
+			return -1;
+		}
+	}
+	if (guard(module, file2, 1)) {
 		fclose(file1);
 		fclose(file2);
 		G__DEBUG(0);
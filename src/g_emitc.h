@@ -20,6 +20,37 @@
 
 #include "g_ann.h"
 
-int g__emitc(const struct g__ann *ann, const char *tmp);
+/**
+ * Code generation choices, zero for defaults.
+ *
+ * unroll     : MAC1 partial sums per row (inner loop unroll depth)
+ * tile       : MAC1 rows computed per pass over the input vector
+ * interchange: MAC2 walks the weights row-wise instead of column-wise
+ * fuse       : fold the bias ADD into the preceding MAC1
+ * threads    : split wide MAC1-MAC4 loops across this many threads of the
+ *              pool handed in through <prefix>_thread_pool (0, 1: off)
+ */
+
+struct g__emitc_strategy {
+	int unroll;
+	int tile;
+	int interchange;
+	int fuse;
+	int threads;
+};
+
+int g__emitc(const struct g__ann *ann,
+	     const char *tmp,
+	     const struct g__emitc_strategy *strategy);
+
+/*
+ * Emits k models into one C/H pair, all ann[] must share the module name
+ * and use distinct prefixes.
+ */
+
+int g__emitc_many(const struct g__ann *const *ann,
+		  int k,
+		  const char *tmp,
+		  const struct g__emitc_strategy *strategy);
 
 #endif /* _G_EMITC_H_ */
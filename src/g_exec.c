@@ -0,0 +1,682 @@
+/**
+ * g_exec.c
+ * Copyright (C) Tony Givargis, 2019-2020
+ *
+ * This file is part of The Gravity Compiler.
+ *
+ * The Gravity Compiler is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version. The Gravity Compiler is distributed in
+ * the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE. See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with Foobar.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "g_exec.h"
+
+#if defined(__GNUC__) && defined(__x86_64__) && defined(__linux__)
+#define G__KERNEL_CLONES \
+	__attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define G__KERNEL_CLONES
+#endif
+
+/*
+ * Model memory as seen by the kernels, with a context the activations
+ * (offsets from base on) are redirected to the context's own buffer.
+ */
+
+struct memory {
+	char *m;
+	char *t;
+	uint64_t base;
+	const char *x; /* G__ANN_ADDRESS_X */
+	char *y; /* G__ANN_ADDRESS_Y */
+};
+
+static char *
+at(const struct memory *memory, uint64_t offset)
+{
+	if (G__ANN_ADDRESS_X == offset) {
+		return (char *)memory->x;
+	}
+	if (G__ANN_ADDRESS_Y == offset) {
+		return memory->y;
+	}
+	if (memory->t && (offset >= memory->base)) {
+		return memory->t + (offset - memory->base);
+	}
+	return memory->m + offset;
+}
+
+#define T float
+#define K(name) name##_f
+#include "g_kernel.h"
+#undef K
+#undef T
+
+#define T double
+#define K(name) name##_d
+#include "g_kernel.h"
+#undef K
+#undef T
+
+struct g__exec {
+	struct g__ann *ann;
+	int refs;
+};
+
+static size_t
+real(const struct g__ann_program_inst *inst)
+{
+	switch (inst->precision) {
+	case G__ANN_PRECISION_FLOAT : return sizeof (float);
+	case G__ANN_PRECISION_DOUBLE: return sizeof (double);
+	case G__ANN_PRECISION_FIXED : break; /* FIX : not implemented */
+	default /*---------------*/ : break;
+	}
+	G__DEBUG(G__ERR_SOFTWARE);
+	assert( 0 );
+	exit(-1);
+	return 0;
+}
+
+/* bytes per value of x */
+
+static size_t
+input(const struct g__exec *exec)
+{
+	if (G__ANN_INPUT_UINT8 == exec->ann->input) {
+		return sizeof (uint8_t);
+	}
+	return real(&exec->ann->program[G__ANN_PROGRAM_ACTIVATE].inst[0]);
+}
+
+/* bytes per y value of the program a BATCHLOOP runs */
+
+static size_t
+target(const struct g__exec *exec, const struct g__ann_program_inst *inst)
+{
+	if (G__ANN_PROGRAM_LABELS == inst->arg[3].i) {
+		return sizeof (int32_t);
+	}
+	return real(&exec->ann->program[G__ANN_PROGRAM_TRAIN].inst[0]);
+}
+
+/* x_ of TRAIN_GATHER, whose BATCHLOOP finds sample i by index or stride */
+
+struct gather {
+	const char *x;
+	const char *y;
+	const uint32_t *index;
+	size_t xs;
+	size_t ys;
+};
+
+static void *
+run(const struct g__exec *exec,
+    int program,
+    const struct memory *m,
+    const char *x_,
+    const char *y_)
+{
+	const struct g__ann_program *prog;
+	const struct g__ann_program_inst *inst, *next;
+	const struct gather *gather;
+	size_t size;
+	uint64_t i, k;
+	int j;
+
+	/* inst[0] is the return, executed last as in the emitted code */
+
+	prog = &exec->ann->program[program];
+	for (j=1; j<prog->size; ) {
+		inst = &prog->inst[j];
+		next = ((j + 1) < prog->size) ? &prog->inst[j + 1] : 0;
+		if ((G__ANN_PROGRAM_INST_BATCHLOOP == inst->opc) &&
+		    inst->arg[4].i) {
+			gather = (const struct gather *)x_;
+			for (i=0; i<inst->arg[0].i; ++i) {
+				k = gather->index ? gather->index[i] : i;
+				run(exec,
+				    G__ANN_PROGRAM_ACTIVATE,
+				    m,
+				    gather->x + k * gather->xs,
+				    0);
+				run(exec,
+				    (int)inst->arg[3].i,
+				    m,
+				    0,
+				    gather->y + k * gather->ys);
+			}
+			++j;
+		}
+		else if (G__ANN_PROGRAM_INST_BATCHLOOP == inst->opc) {
+			size = inst->arg[2].i * target(exec, inst);
+			for (i=0; i<inst->arg[0].i; ++i) {
+				run(exec,
+				    G__ANN_PROGRAM_ACTIVATE,
+				    m,
+				    x_ + i * inst->arg[1].i * input(exec),
+				    0);
+				run(exec,
+				    (int)inst->arg[3].i,
+				    m,
+				    0,
+				    y_ + i * size);
+			}
+			++j;
+		}
+		else if (G__ANN_PRECISION_FLOAT == inst->precision) {
+			j += step_f(m, inst, next, x_, y_);
+		}
+		else {
+			j += step_d(m, inst, next, x_, y_);
+		}
+	}
+	inst = &prog->inst[0];
+	if (G__ANN_PROGRAM_INST_RETARG == inst->opc) {
+		return at(m, inst->arg[0].i);
+	}
+	assert( G__ANN_PROGRAM_INST_RET == inst->opc );
+	return 0;
+}
+
+g__exec_t
+g__exec_open(struct g__ann *ann)
+{
+	struct g__exec *exec;
+
+	assert( ann );
+
+	if (ann->cuda) {
+		g__ann_close(ann);
+		G__DEBUG(G__ERR_ARGUMENT);
+		return 0;
+	}
+	exec = g__malloc(sizeof (struct g__exec));
+	if (!exec) {
+		g__ann_close(ann);
+		G__DEBUG(0);
+		return 0;
+	}
+	memset(exec, 0, sizeof (struct g__exec));
+	exec->ann = ann;
+	exec->refs = 1;
+	return exec;
+}
+
+g__exec_t
+g__exec_retain(g__exec_t exec)
+{
+	assert( exec && (0 < exec->refs) );
+
+	__atomic_add_fetch(&exec->refs, 1, __ATOMIC_RELAXED);
+	return exec;
+}
+
+void
+g__exec_close(g__exec_t exec)
+{
+	if (exec && __atomic_sub_fetch(&exec->refs, 1, __ATOMIC_ACQ_REL)) {
+		return;
+	}
+	if (exec) {
+		g__ann_close(exec->ann);
+		memset(exec, 0, sizeof (struct g__exec));
+	}
+	G__FREE(exec);
+}
+
+size_t
+g__exec_memory_size(g__exec_t exec)
+{
+	assert( exec );
+
+	return (size_t)exec->ann->precision.size;
+}
+
+size_t
+g__exec_memory_hard(g__exec_t exec)
+{
+	assert( exec );
+
+	return (size_t)exec->ann->precision.hard;
+}
+
+size_t
+g__exec_memory_context(g__exec_t exec)
+{
+	const struct g__ann *ann;
+
+	assert( exec );
+
+	ann = exec->ann;
+	return (size_t)ann->precision.context;
+}
+
+size_t
+g__exec_memory_unit(g__exec_t exec)
+{
+	assert( exec );
+
+	return real(&exec->ann->program[G__ANN_PROGRAM_TRAIN].inst[0]);
+}
+
+size_t
+g__exec_input_unit(g__exec_t exec)
+{
+	assert( exec );
+
+	return input(exec);
+}
+
+int
+g__exec_batch(g__exec_t exec)
+{
+	assert( exec );
+
+	return exec->ann->batch;
+}
+
+int
+g__exec_schedule(g__exec_t exec)
+{
+	assert( exec );
+
+	return exec->ann->schedule;
+}
+
+static void
+memory(struct memory *memory, const void *m, void *t, uint64_t base)
+{
+	memory->m = (char *)m;
+	memory->t = (char *)t;
+	memory->base = base;
+	memory->x = 0;
+	memory->y = 0;
+}
+
+void
+g__exec_initialize(g__exec_t exec, void *m_)
+{
+	struct memory m;
+
+	assert( exec && m_ );
+
+	memory(&m, m_, 0, 0);
+	run(exec, G__ANN_PROGRAM_INITIALIZE, &m, 0, 0);
+}
+
+void *
+g__exec_activate(g__exec_t exec, void *m_, const void *x)
+{
+	struct memory m;
+
+	assert( exec && m_ && x );
+
+	memory(&m, m_, 0, 0);
+	return run(exec, G__ANN_PROGRAM_ACTIVATE, &m, x, 0);
+}
+
+void
+g__exec_activate_into(g__exec_t exec, void *m_, const void *x, void *y)
+{
+	struct memory m;
+
+	assert( exec && m_ && x && y );
+
+	memory(&m, m_, 0, 0);
+	m.x = (const char *)x;
+	m.y = (char *)y;
+	run(exec, G__ANN_PROGRAM_ACTIVATE_INTO, &m, x, 0);
+}
+
+void
+g__exec_activate_batch(g__exec_t exec,
+		       void *m_,
+		       const void *x,
+		       size_t n,
+		       void *y)
+{
+	const struct g__ann_program_inst *inst;
+	struct memory m;
+	size_t a, b, i;
+
+	assert( exec && m_ && x && y );
+
+	/* kernels are per sample, step through the batch */
+
+	memory(&m, m_, 0, 0);
+	inst = &exec->ann->program[G__ANN_PROGRAM_ACTIVATE].inst[0];
+	a = exec->ann->nodes[0] * input(exec);
+	b = exec->ann->nodes[exec->ann->layers - 1] * real(inst);
+	for (i=0; i<n; ++i) {
+		memcpy((char *)y + i * b,
+		       run(exec,
+			   G__ANN_PROGRAM_ACTIVATE,
+			   &m,
+			   (const char *)x + i * a,
+			   0),
+		       b);
+	}
+}
+
+void *
+g__exec_activate_context(g__exec_t exec,
+			 const void *m_,
+			 void *t,
+			 const void *x)
+{
+	struct memory m;
+
+	assert( exec && m_ && t && x );
+
+	memory(&m, m_, t, exec->ann->precision.scratch);
+	return run(exec, G__ANN_PROGRAM_INFER, &m, x, 0);
+}
+
+void *
+g__exec_activate_layer(g__exec_t exec,
+		       const void *m_,
+		       void *t,
+		       const void *x,
+		       int l)
+{
+	const struct g__ann_program *prog;
+	const struct g__ann_program_inst *inst, *next;
+	const struct g__ann *ann;
+	struct memory m;
+	uint64_t o;
+	int j, k;
+
+	assert( exec && m_ && t && x );
+	assert( (0 <= l) && (l < exec->ann->layers) );
+
+	/* layer 0 is the copy of x, layer l from its MAC1 up to the next */
+
+	ann = exec->ann;
+	memory(&m, m_, t, ann->precision.scratch);
+	prog = &ann->program[G__ANN_PROGRAM_INFER];
+	o = 0;
+	for (j=1, k=0; j<prog->size; ) {
+		inst = &prog->inst[j];
+		k += (G__ANN_PROGRAM_INST_MAC1 == inst->opc) ? 1 : 0;
+		if (k != l) {
+			++j;
+			continue;
+		}
+		o = inst->arg[0].i;
+		next = ((j + 1) < prog->size) ? &prog->inst[j + 1] : 0;
+		if (G__ANN_PRECISION_FLOAT == inst->precision) {
+			j += step_f(&m, inst, next, x, 0);
+		}
+		else {
+			j += step_d(&m, inst, next, x, 0);
+		}
+	}
+	return at(&m, o);
+}
+
+size_t
+g__exec_layer_size(g__exec_t exec, int l)
+{
+	assert( exec );
+
+	if ((0 <= l) && (l < exec->ann->layers)) {
+		return (size_t)exec->ann->nodes[l];
+	}
+	return 0;
+}
+
+/* the layers taken from their MAC1 and the ADD after, see g_export() */
+
+static void
+weights(g__exec_t exec, char *m_, char *x, int import)
+{
+	const struct g__ann_program_inst *inst;
+	const struct g__ann_program *prog;
+	uint64_t i, j, k, n, u;
+	int l;
+
+	prog = &exec->ann->program[G__ANN_PROGRAM_ACTIVATE];
+	u = real(&prog->inst[0]);
+	for (l=1; l<prog->size; ++l) {
+		inst = &prog->inst[l];
+		if (G__ANN_PROGRAM_INST_MAC1 != inst->opc) {
+			continue;
+		}
+		assert( G__ANN_PROGRAM_INST_ADD == inst[1].opc );
+		n = inst->arg[3].i;
+		for (i=0; i<n; ++i) {
+			for (j=0; j<inst->arg[4].i; ++j) {
+				k = (G__ANN_LAYOUT_BLOCKED == inst->layout) ?
+					(i / G__ANN_PANEL * G__ANN_PANEL *
+					 inst->arg[4].i +
+					 j * G__ANN_PANEL +
+					 i % G__ANN_PANEL) :
+					(i * inst->arg[5].i + j);
+				k = inst->arg[1].i + k * u;
+				memcpy(import ? (m_ + k) : x,
+				       import ? x : (m_ + k),
+				       u);
+				x += u;
+			}
+		}
+		k = inst[1].arg[1].i;
+		memcpy(import ? (m_ + k) : x, import ? x : (m_ + k), n * u);
+		x += n * u;
+	}
+}
+
+void
+g__exec_export(g__exec_t exec, const void *m_, void *x)
+{
+	assert( exec && m_ && x );
+
+	weights(exec, (char *)m_, (char *)x, 0);
+}
+
+void
+g__exec_import(g__exec_t exec, void *m_, const void *x)
+{
+	assert( exec && m_ && x );
+
+	weights(exec, (char *)m_, (char *)x, 1);
+}
+
+void
+g__exec_train(g__exec_t exec, void *m_, const void *x, const void *y)
+{
+	struct memory m;
+
+	assert( exec && m_ && x && y );
+
+	memory(&m, m_, 0, 0);
+	run(exec, G__ANN_PROGRAM_TRAIN, &m, x, y);
+}
+
+void
+g__exec_train_labels(g__exec_t exec, void *m_, const void *x, const void *y)
+{
+	struct memory m;
+
+	assert( exec && m_ && x && y );
+
+	memory(&m, m_, 0, 0);
+	run(exec, G__ANN_PROGRAM_TRAIN_LABELS, &m, x, y);
+}
+
+void
+g__exec_train_gather(g__exec_t exec,
+		     void *m_,
+		     const void *x,
+		     const void *y,
+		     const uint32_t *index,
+		     size_t xs,
+		     size_t ys)
+{
+	struct gather gather;
+	struct memory m;
+
+	assert( exec && m_ && x && y );
+
+	gather.x = (const char *)x;
+	gather.y = (const char *)y;
+	gather.index = index;
+	gather.xs = xs;
+	gather.ys = ys;
+	memory(&m, m_, 0, 0);
+	run(exec, G__ANN_PROGRAM_TRAIN_GATHER, &m, (const char *)&gather, 0);
+}
+
+/* the shard of TRAIN or TRAIN_LABELS, by the program its BATCHLOOP runs */
+
+static void
+shard(const struct g__exec *exec,
+      int program,
+      const void *m_,
+      void *p,
+      const void *x,
+      const void *y,
+      size_t lo,
+      size_t hi)
+{
+	const struct g__ann_program_inst *inst;
+	struct memory m;
+	size_t a, b, i;
+
+	memory(&m, m_, p, exec->ann->precision.hard);
+	inst = &exec->ann->program[program].inst[2];
+	assert( G__ANN_PROGRAM_INST_BATCHLOOP == inst->opc );
+	a = inst->arg[1].i * input(exec);
+	b = inst->arg[2].i * target(exec, inst);
+	program = (int)inst->arg[3].i;
+	inst = &exec->ann->program[G__ANN_PROGRAM_TRAIN].inst[1];
+	assert( G__ANN_PROGRAM_INST_CLEAR == inst->opc );
+	memset(at(&m, inst->arg[0].i), 0, inst->arg[1].i * real(inst));
+	for (i=lo; i<hi; ++i) {
+		run(exec,
+		    G__ANN_PROGRAM_ACTIVATE,
+		    &m,
+		    (const char *)x + i * a,
+		    0);
+		run(exec,
+		    program,
+		    &m,
+		    0,
+		    (const char *)y + i * b);
+	}
+}
+
+void
+g__exec_train_shard(g__exec_t exec,
+		    const void *m_,
+		    void *p,
+		    const void *x,
+		    const void *y,
+		    size_t lo,
+		    size_t hi)
+{
+	assert( exec && m_ && p && x && y );
+
+	shard(exec, G__ANN_PROGRAM_TRAIN, m_, p, x, y, lo, hi);
+}
+
+void
+g__exec_train_shard_labels(g__exec_t exec,
+			   const void *m_,
+			   void *p,
+			   const void *x,
+			   const void *y,
+			   size_t lo,
+			   size_t hi)
+{
+	assert( exec && m_ && p && x && y );
+
+	shard(exec, G__ANN_PROGRAM_TRAIN_LABELS, m_, p, x, y, lo, hi);
+}
+
+void
+g__exec_reduce(g__exec_t exec, void *p, const void *q, int id, int n)
+{
+	const struct g__ann_program_inst *inst;
+	uint64_t lo, hi;
+
+	assert( exec && p && q && (0 <= id) && (id < n) );
+
+	/* the gradients, w_ and b_, lead the non-hard part */
+
+	inst = &exec->ann->program[G__ANN_PROGRAM_TRAIN].inst[1];
+	lo = inst->arg[1].i * id / n;
+	hi = inst->arg[1].i * (id + 1) / n;
+	if (G__ANN_PRECISION_FLOAT == inst->precision) {
+		reduce_f((float *)p + lo, (const float *)q + lo, hi - lo);
+	}
+	else {
+		reduce_d((double *)p + lo, (const double *)q + lo, hi - lo);
+	}
+}
+
+void
+g__exec_update(g__exec_t exec,
+	       void *m_,
+	       const void *s,
+	       const void *p,
+	       size_t n)
+{
+	const struct g__ann_program *prog;
+	struct g__ann_program_inst inst;
+	struct memory m;
+	int j;
+
+	assert( exec && m_ && s && p && n );
+
+	/*
+	 * The train program's MAC4s, -lr / batch rescaled to -lr / n, each
+	 * region they update first brought over from s
+	 */
+
+	memory(&m, m_, (void *)p, exec->ann->precision.hard);
+	prog = &exec->ann->program[G__ANN_PROGRAM_TRAIN];
+	for (j=3; j<prog->size; ++j) {
+		inst = prog->inst[j];
+		assert( G__ANN_PROGRAM_INST_MAC4 == inst.opc );
+		if (s != m_) {
+			memcpy(at(&m, inst.arg[0].i),
+			       (const char *)s + inst.arg[0].i,
+			       inst.arg[3].i * real(&inst));
+		}
+		inst.arg[2].r = inst.arg[2].r * exec->ann->batch / (double)n;
+		if (G__ANN_PRECISION_FLOAT == inst.precision) {
+			step_f(&m, &inst, 0, 0, 0);
+		}
+		else {
+			step_d(&m, &inst, 0, 0, 0);
+		}
+	}
+}
+
+void
+g__exec_train_hogwild(g__exec_t exec,
+		      void *m,
+		      void *p,
+		      const void *x,
+		      const void *y,
+		      size_t lo,
+		      size_t hi)
+{
+	size_t s, e, batch;
+
+	assert( exec && m && p && x && y );
+
+	batch = (size_t)exec->ann->batch;
+	for (s=lo; s<hi; s=e) {
+		e = ((hi - s) < batch) ? hi : (s + batch);
+		g__exec_train_shard(exec, m, p, x, y, s, e);
+		g__exec_update(exec, m, m, p, e - s);
+	}
+}
@@ -0,0 +1,164 @@
+/**
+ * g_exec.h
+ * Copyright (C) Tony Givargis, 2019-2020
+ *
+ * This file is part of The Gravity Compiler.
+ *
+ * The Gravity Compiler is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version. The Gravity Compiler is distributed in
+ * the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE. See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with Foobar.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _G_EXEC_H_
+#define _G_EXEC_H_
+
+#include "g_ann.h"
+
+/*
+ * Runs the ann programs directly on shape-generic kernels compiled into
+ * libgravity, no code is emitted and no C compiler is involved. The memory
+ * layout is the one of the emitted code.
+ */
+
+typedef struct g__exec *g__exec_t;
+
+/* takes ownership of ann */
+
+g__exec_t g__exec_open(struct g__ann *ann);
+
+/* adds a reference, balanced by g__exec_close() */
+
+g__exec_t g__exec_retain(g__exec_t exec);
+
+void g__exec_close(g__exec_t exec);
+
+size_t g__exec_memory_size(g__exec_t exec);
+
+size_t g__exec_memory_hard(g__exec_t exec);
+
+size_t g__exec_memory_context(g__exec_t exec);
+
+/* bytes per real */
+
+size_t g__exec_memory_unit(g__exec_t exec);
+
+/* bytes per input value */
+
+size_t g__exec_input_unit(g__exec_t exec);
+
+int g__exec_batch(g__exec_t exec);
+
+/* G__ANN_SCHEDULE_* */
+
+int g__exec_schedule(g__exec_t exec);
+
+void g__exec_initialize(g__exec_t exec, void *m);
+
+void *g__exec_activate(g__exec_t exec, void *m, const void *x);
+
+/* x read and the outputs written to y in place, see g_activate_into() */
+
+void g__exec_activate_into(g__exec_t exec, void *m, const void *x, void *y);
+
+void g__exec_activate_batch(g__exec_t exec,
+			    void *m,
+			    const void *x,
+			    size_t n,
+			    void *y);
+
+/* activations go to t (g__exec_memory_context() bytes), m is only read */
+
+void *g__exec_activate_context(g__exec_t exec,
+			       const void *m,
+			       void *t,
+			       const void *x);
+
+/* layer l alone, as g__exec_activate_context(), see g_activate_pipeline() */
+
+void *g__exec_activate_layer(g__exec_t exec,
+			     const void *m,
+			     void *t,
+			     const void *x,
+			     int l);
+
+/* units of layer l, zero past the last */
+
+size_t g__exec_layer_size(g__exec_t exec, int l);
+
+/* the weights to/from the portable form of g_export() */
+
+void g__exec_export(g__exec_t exec, const void *m, void *x);
+
+void g__exec_import(g__exec_t exec, void *m, const void *x);
+
+void g__exec_train(g__exec_t exec, void *m, const void *x, const void *y);
+
+/* y one int32_t class index per sample, see g_train_labels() */
+
+void g__exec_train_labels(g__exec_t exec,
+			  void *m,
+			  const void *x,
+			  const void *y);
+
+/*
+ * TRAIN with sample i at index[i] (i if index is null) times the byte
+ * strides xs and ys of x and y, see g_train_gather()
+ */
+
+void g__exec_train_gather(g__exec_t exec,
+			  void *m,
+			  const void *x,
+			  const void *y,
+			  const uint32_t *index,
+			  size_t xs,
+			  size_t ys);
+
+/*
+ * Data-parallel training, see g_train_parallel(): samples [lo, hi) train
+ * into p (g__exec_memory_size() - g__exec_memory_hard() bytes), m is only
+ * read. reduce adds q to p over part id of n of the gradients, update
+ * applies the gradients in p, summed over n samples, to the weights of s
+ * and stores the result in m, s being m or another copy of the model.
+ */
+
+void g__exec_train_shard(g__exec_t exec,
+			 const void *m,
+			 void *p,
+			 const void *x,
+			 const void *y,
+			 size_t lo,
+			 size_t hi);
+
+void g__exec_train_shard_labels(g__exec_t exec,
+				const void *m,
+				void *p,
+				const void *x,
+				const void *y,
+				size_t lo,
+				size_t hi);
+
+void g__exec_reduce(g__exec_t exec, void *p, const void *q, int id, int n);
+
+void g__exec_update(g__exec_t exec,
+		    void *m,
+		    const void *s,
+		    const void *p,
+		    size_t n);
+
+/* shard and update per batch of samples [lo, hi), see g_train_hogwild() */
+
+void g__exec_train_hogwild(g__exec_t exec,
+			   void *m,
+			   void *p,
+			   const void *x,
+			   const void *y,
+			   size_t lo,
+			   size_t hi);
+
+#endif /* _G_EXEC_H_ */
@@ -31,14 +31,18 @@
 #define MARK_OUTPUT    7
 #define MARK_HIDDEN    8
 #define MARK_CUDA	   9
-#define MARK_END       10
+#define MARK_SCHEDULE  10
+#define MARK_LAYOUT    11
+#define MARK_END       12
 
 #define NODE_TYPE_INPUT  0
 #define NODE_TYPE_OUTPUT 1
 #define NODE_TYPE_HIDDEN 2
 
-static struct {
+struct g__ir_state {
 	void *_mem_;
+	void *scanner;
+	int verbose;
 	struct g__ir *ir;
 	int mark[MARK_END];
 	struct node {
@@ -47,7 +51,7 @@ static struct {
 		int activation;
 		struct node *link;
 	} *root;
-} state;
+};
 
 static int
 validc(const char *s)
@@ -66,151 +70,200 @@ validc(const char *s)
 	return 0;
 }
 
+static void
+destroy(void *_mem_)
+{
+	void **link;
+
+	while (_mem_) {
+		link = _mem_;
+		_mem_ = (*link);
+		G__FREE(link);
+	}
+}
+
 const struct g__ir *
-g__ir_parse(const char *pathname)
+g__ir_parse(const char *pathname, int verbose)
 {
+	struct g__ir_state *state;
+	struct g__ir *ir;
 	FILE *file;
 
-	assert( !state._mem_ && g__strlen(pathname) );
+	assert( g__strlen(pathname) );
 
+	state = g__malloc(sizeof (struct g__ir_state));
+	if (!state) {
+		G__DEBUG(0);
+		return 0;
+	}
+	memset(state, 0, sizeof (struct g__ir_state));
+	state->verbose = verbose;
 	file = fopen(pathname, "r");
 	if (!file) {
-		yyerror("unable to open '%s' for reading", pathname);
-		g__ir_destroy();
+		g__ir_error(state, "unable to open '%s' for reading", pathname);
+		G__FREE(state);
 		G__DEBUG(G__ERR_FILE);
 		return 0;
 	}
-	state.ir = g__ir_malloc(sizeof (struct g__ir));
-	if (!state.ir) {
-		yyerror("out of memory");
+	if (yylex_init(&state->scanner)) {
+		g__ir_error(state, "out of memory");
 		fclose(file);
-		g__ir_destroy();
-		G__DEBUG(0);
+		G__FREE(state);
+		G__DEBUG(G__ERR_MEMORY);
 		return 0;
 	}
-	yyrestart(file);
-	if (yyparse()) {
+	yyset_in(file, state->scanner);
+	state->ir = g__ir_malloc(state, sizeof (struct g__ir));
+	if (!state->ir || yyparse(state->scanner, state)) {
+		if (!state->ir) {
+			g__ir_error(state, "out of memory");
+		}
+		yylex_destroy(state->scanner);
 		fclose(file);
-		g__ir_destroy();
+		destroy(state->_mem_);
+		G__FREE(state);
 		G__DEBUG(0);
 		return 0;
 	}
+	yylex_destroy(state->scanner);
 	fclose(file);
-	return state.ir;
+	ir = state->ir;
+	ir->_mem_ = state->_mem_;
+	G__FREE(state);
+	return ir;
 }
 
 void
-g__ir_destroy(void)
+g__ir_destroy(const struct g__ir *ir)
 {
-	void **link;
-
-	link = state._mem_;
-	while (state._mem_) {
-		link = state._mem_;
-		state._mem_ = (*link);
-		G__FREE(link);
+	if (ir) {
+		destroy(ir->_mem_);
 	}
-	yylex_destroy();
-	memset(&state, 0, sizeof (state));
 }
 
 /*-----------------------------------------------------------------------------
  * Lexer/Parser Backend
  *---------------------------------------------------------------------------*/
 
+void
+g__ir_error(struct g__ir_state *state, const char *format, ...)
+{
+	va_list va;
+
+	if (state->verbose) {
+		fprintf(stderr, "error: ");
+		va_start(va, format);
+		vfprintf(stderr, format ? format : "syntax error", va);
+		va_end(va);
+		if (state->scanner) {
+			fprintf(stderr,
+				" near line %d",
+				yyget_lineno(state->scanner));
+		}
+		fprintf(stderr, "\n");
+	}
+}
+
 int
-g__ir_top(void)
+g__ir_top(struct g__ir_state *state)
 {
 	struct node *node;
 	int i, n;
 	int start, end, temp_size, temp_act;
 
-	if (!state.mark[MARK_MODULE]) {
-		yyerror("missing .module sepcification");
+	if (!state->mark[MARK_MODULE]) {
+		g__ir_error(state, "missing .module sepcification");
 		G__DEBUG(G__ERR_SYNTAX);
 		return -1;
 	}
-	if (!state.mark[MARK_PREFIX]) {
-		state.ir->prefix = "g";
+	if (!state->mark[MARK_PREFIX]) {
+		state->ir->prefix = "g";
 	}
-	if (!state.mark[MARK_OPTIMIZER]) {
-		state.ir->optimizer.optimizer = G__IR_OPTIMIZER_SGD;
-		state.ir->optimizer.learning_rate = 0.1;
+	if (!state->mark[MARK_OPTIMIZER]) {
+		state->ir->optimizer.optimizer = G__IR_OPTIMIZER_SGD;
+		state->ir->optimizer.learning_rate = 0.1;
 	}
-	if (!state.mark[MARK_PRECISION]) {
-		state.ir->precision.whole = 0;
-		state.ir->precision.fraction = 0;
-		state.ir->precision.precision = G__IR_PRECISION_FLOAT;
+	if (!state->mark[MARK_PRECISION]) {
+		state->ir->precision.whole = 0;
+		state->ir->precision.fraction = 0;
+		state->ir->precision.precision = G__IR_PRECISION_FLOAT;
 	}
-	if (!state.mark[MARK_COSTFNC]) {
-		state.ir->costfnc = G__IR_COSTFNC_CROSS_ENTROPY;
+	if (!state->mark[MARK_COSTFNC]) {
+		state->ir->costfnc = G__IR_COSTFNC_CROSS_ENTROPY;
 	}
-	if (!state.mark[MARK_BATCH]) {
-		state.ir->batch = 1;
+	if (!state->mark[MARK_BATCH]) {
+		state->ir->batch = 1;
 	}
-	if (!state.mark[MARK_INPUT]) {
-		yyerror("missing .input specification");
+	if (!state->mark[MARK_INPUT]) {
+		g__ir_error(state, "missing .input specification");
 		G__DEBUG(G__ERR_SYNTAX);
 		return -1;
 	}
-	if (!state.mark[MARK_OUTPUT]) {
-		yyerror("missing .output specification");
+	if (!state->mark[MARK_OUTPUT]) {
+		g__ir_error(state, "missing .output specification");
 		G__DEBUG(G__ERR_SYNTAX);
 		return -1;
 	}
-	if (!state.mark[MARK_HIDDEN]) {
-		yyerror("missing .hidden specification");
+	if (!state->mark[MARK_HIDDEN]) {
+		g__ir_error(state, "missing .hidden specification");
 		G__DEBUG(G__ERR_SYNTAX);
 		return -1;
 	}
-	if (!state.mark[MARK_CUDA]) {
-		state.ir->cuda = 0;
+	if (!state->mark[MARK_CUDA]) {
+		state->ir->cuda = 0;
 	}
-	n = 2 + state.mark[MARK_HIDDEN];
-	state.ir->layers = n;
-	state.ir->nodes = g__ir_malloc(n * sizeof (state.ir->nodes[0]));
-	if (!state.ir->nodes) {
-		yyerror("out of memory");
+	if (!state->mark[MARK_SCHEDULE]) {
+		state->ir->schedule = G__IR_SCHEDULE_SERIAL;
+	}
+	if (!state->mark[MARK_LAYOUT]) {
+		state->ir->layout = G__IR_LAYOUT_PACKED;
+	}
+	n = 2 + state->mark[MARK_HIDDEN];
+	state->ir->layers = n;
+	state->ir->nodes = g__ir_malloc(state,
+					n * sizeof (state->ir->nodes[0]));
+	if (!state->ir->nodes) {
+		g__ir_error(state, "out of memory");
 		G__DEBUG(0);
 		return -1;
 	}
 	i = 0;
-	node = state.root;
+	node = state->root;
 	while (node) {
 		if (NODE_TYPE_INPUT == node->type) {
-			state.ir->nodes[i].size = node->size;
-			state.ir->nodes[i].activation = node->activation;
+			state->ir->nodes[i].size = node->size;
+			state->ir->nodes[i].activation = node->activation;
 			++i;
 		}
 		node = node->link;
 	}
-	node = state.root;
+	node = state->root;
 	while (node) {
 		if (NODE_TYPE_HIDDEN == node->type) {
-			state.ir->nodes[i].size = node->size;
-			state.ir->nodes[i].activation = node->activation;
+			state->ir->nodes[i].size = node->size;
+			state->ir->nodes[i].activation = node->activation;
 			++i;
 		}
 		node = node->link;
 	}
 
 	start = 1;
-	end = state.mark[MARK_HIDDEN];
+	end = state->mark[MARK_HIDDEN];
 	while (start < end) {
-		temp_size = state.ir->nodes[start].size;
-		temp_act = state.ir->nodes[start].activation;
-		state.ir->nodes[start] = state.ir->nodes[end];
-		state.ir->nodes[end].size = temp_size;
-		state.ir->nodes[end].activation = temp_act;
+		temp_size = state->ir->nodes[start].size;
+		temp_act = state->ir->nodes[start].activation;
+		state->ir->nodes[start] = state->ir->nodes[end];
+		state->ir->nodes[end].size = temp_size;
+		state->ir->nodes[end].activation = temp_act;
 		++start;
 		--end;
 	}
 
-	node = state.root;
+	node = state->root;
 	while (node) {
 		if (NODE_TYPE_OUTPUT == node->type) {
-			state.ir->nodes[i].size = node->size;
-			state.ir->nodes[i].activation = node->activation;
+			state->ir->nodes[i].size = node->size;
+			state->ir->nodes[i].activation = node->activation;
 			++i;
 		}
 		node = node->link;
@@ -219,220 +272,256 @@ g__ir_top(void)
 }
 
 int
-g__ir_module(const char *s)
+g__ir_module(struct g__ir_state *state, const char *s)
 {
-	if (state.mark[MARK_MODULE]) {
-		yyerror("duplicate .module specification");
+	if (state->mark[MARK_MODULE]) {
+		g__ir_error(state, "duplicate .module specification");
 		G__DEBUG(G__ERR_SYNTAX);
 		return -1;
 	}
 	if (!g__strlen(s) || validc(s)) {
-		yyerror("invalid .module specification '%s' ", s);
+		g__ir_error(state, "invalid .module specification '%s' ", s);
 		G__DEBUG(G__ERR_SYNTAX);
 		return -1;
 	}
-	state.ir->module = s;
-	state.mark[MARK_MODULE] += 1;
+	state->ir->module = s;
+	state->mark[MARK_MODULE] += 1;
 	return 0;
 }
 
 int
-g__ir_prefix(const char *s)
+g__ir_prefix(struct g__ir_state *state, const char *s)
 {
-	if (state.mark[MARK_PREFIX]) {
-		yyerror("duplicate .prefix specification");
+	if (state->mark[MARK_PREFIX]) {
+		g__ir_error(state, "duplicate .prefix specification");
 		G__DEBUG(G__ERR_SYNTAX);
 		return -1;
 	}
 	if (validc(s)) {
-		yyerror("invalid .prefix specification '%s' ", s);
+		g__ir_error(state, "invalid .prefix specification '%s' ", s);
 		G__DEBUG(G__ERR_SYNTAX);
 		return -1;
 	}
-	state.ir->prefix = s;
-	state.mark[MARK_PREFIX] += 1;
+	state->ir->prefix = s;
+	state->mark[MARK_PREFIX] += 1;
 	return 0;
 }
 
 int
-g__ir_optimizer(long optimizer, double learning_rate)
+g__ir_optimizer(struct g__ir_state *state, long optimizer, double learning_rate)
 {
-	if (state.mark[MARK_OPTIMIZER]) {
-		yyerror("duplicate .optimizer specification");
+	if (state->mark[MARK_OPTIMIZER]) {
+		g__ir_error(state, "duplicate .optimizer specification");
 		G__DEBUG(G__ERR_SYNTAX);
 		return -1;
 	}
 	if ((0.0 >= learning_rate) || (1.0 < learning_rate)) {
-		yyerror("invalid .optimizer specification '%f'",
+		g__ir_error(state, "invalid .optimizer specification '%f'",
 			learning_rate);
 		G__DEBUG(G__ERR_SYNTAX);
 		return -1;
 	}
-	state.ir->optimizer.optimizer = (int)optimizer;
-	state.ir->optimizer.learning_rate = learning_rate;
-	state.mark[MARK_OPTIMIZER] += 1;
+	state->ir->optimizer.optimizer = (int)optimizer;
+	state->ir->optimizer.learning_rate = learning_rate;
+	state->mark[MARK_OPTIMIZER] += 1;
 	return 0;
 }
 
 int
-g__ir_precision(long whole, long fraction, long precision)
+g__ir_precision(struct g__ir_state *state,
+		long whole,
+		long fraction,
+		long precision)
 {
-	if (state.mark[MARK_PRECISION]) {
-		yyerror("duplicate .precision specification");
+	if (state->mark[MARK_PRECISION]) {
+		g__ir_error(state, "duplicate .precision specification");
 		G__DEBUG(G__ERR_SYNTAX);
 		return -1;
 	}
 	if ((G__IR_PRECISION_FIXED == precision) &&
 	    ((1 > whole) || (0 > fraction) ||
 	     (64 < (whole + fraction)))) {
-		yyerror("invalid .precision 'FIXED [%ld, %ld]' ",
+		g__ir_error(state, "invalid .precision 'FIXED [%ld, %ld]' ",
 			whole,
 			fraction);
 		G__DEBUG(G__ERR_SYNTAX);
 		return -1;
 	}
-	state.ir->precision.whole = (int)whole;
-	state.ir->precision.fraction = (int)fraction;
-	state.ir->precision.precision = (int)precision;
-	state.mark[MARK_PRECISION] += 1;
+	state->ir->precision.whole = (int)whole;
+	state->ir->precision.fraction = (int)fraction;
+	state->ir->precision.precision = (int)precision;
+	state->mark[MARK_PRECISION] += 1;
 	return 0;
 }
 
 int
-g__ir_costfnc(long costfnc)
+g__ir_costfnc(struct g__ir_state *state, long costfnc)
 {
-	if (state.mark[MARK_COSTFNC]) {
-		yyerror("duplicate .costfnc specification");
+	if (state->mark[MARK_COSTFNC]) {
+		g__ir_error(state, "duplicate .costfnc specification");
 		G__DEBUG(G__ERR_SYNTAX);
 		return -1;
 	}
-	state.ir->costfnc = (int)costfnc;
-	state.mark[MARK_COSTFNC] += 1;
+	state->ir->costfnc = (int)costfnc;
+	state->mark[MARK_COSTFNC] += 1;
 	return 0;
 }
 
 int
-g__ir_batch(long batch)
+g__ir_batch(struct g__ir_state *state, long batch)
 {
-	if (state.mark[MARK_BATCH]) {
-		yyerror("duplicate .batch specification");
+	if (state->mark[MARK_BATCH]) {
+		g__ir_error(state, "duplicate .batch specification");
 		G__DEBUG(G__ERR_SYNTAX);
 		return -1;
 	}
 	if (MAX_BATCH < batch) {
-		yyerror("invalid .batch specification '%ld'", batch);
+		g__ir_error(state, "invalid .batch specification '%ld'", batch);
 		G__DEBUG(G__ERR_SYNTAX);
 		return -1;
 	}
-	state.ir->batch = (int)batch;
-	state.mark[MARK_BATCH] += 1;
+	state->ir->batch = (int)batch;
+	state->mark[MARK_BATCH] += 1;
 	return 0;
 }
 
 int
-g__ir_input(long size)
+g__ir_input(struct g__ir_state *state, long size, long input, double scale)
 {
 	struct node *node;
 
-	if (state.mark[MARK_INPUT]) {
-		yyerror("duplicate .input specification");
+	if (state->mark[MARK_INPUT]) {
+		g__ir_error(state, "duplicate .input specification");
 		G__DEBUG(G__ERR_SYNTAX);
 		return -1;
 	}
 	if (MAX_SIZE < size) {
-		yyerror("invalid .input specification '%ld'", size);
+		g__ir_error(state, "invalid .input specification '%ld'", size);
+		G__DEBUG(G__ERR_SYNTAX);
+		return -1;
+	}
+	if (!(0.0 < scale)) {
+		g__ir_error(state, "invalid .input scale '%g'", scale);
 		G__DEBUG(G__ERR_SYNTAX);
 		return -1;
 	}
-	node = g__ir_malloc(sizeof (struct node));
+	node = g__ir_malloc(state, sizeof (struct node));
 	if (!node) {
-		yyerror("out of memory");
+		g__ir_error(state, "out of memory");
 		G__DEBUG(G__ERR_SYNTAX);
 		return -1;
 	}
 	node->type = NODE_TYPE_INPUT;
 	node->size = (int)size;
-	node->link = state.root;
-	state.root = node;
-	state.mark[MARK_INPUT] += 1;
+	node->link = state->root;
+	state->root = node;
+	state->ir->input = (int)input;
+	state->ir->scale = scale;
+	state->mark[MARK_INPUT] += 1;
 	return 0;
 }
 
 int
-g__ir_output(long size, long activation)
+g__ir_output(struct g__ir_state *state, long size, long activation)
 {
 	struct node *node;
 
-	if (state.mark[MARK_OUTPUT]) {
-		yyerror("duplicate .output specification");
+	if (state->mark[MARK_OUTPUT]) {
+		g__ir_error(state, "duplicate .output specification");
 		G__DEBUG(G__ERR_SYNTAX);
 		return -1;
 	}
 	if (MAX_SIZE < size) {
-		yyerror("invalid .output specification '%ld'", size);
+		g__ir_error(state, "invalid .output specification '%ld'", size);
 		G__DEBUG(G__ERR_SYNTAX);
 		return -1;
 	}
-	node = g__ir_malloc(sizeof (struct node));
+	node = g__ir_malloc(state, sizeof (struct node));
 	if (!node) {
-		yyerror("out of memory");
+		g__ir_error(state, "out of memory");
 		G__DEBUG(G__ERR_SYNTAX);
 		return -1;
 	}
 	node->type = NODE_TYPE_OUTPUT;
 	node->size = (int)size;
 	node->activation = (int)activation;
-	node->link = state.root;
-	state.root = node;
-	state.mark[MARK_OUTPUT] += 1;
+	node->link = state->root;
+	state->root = node;
+	state->mark[MARK_OUTPUT] += 1;
 	return 0;
 }
 
 int
-g__ir_hidden(long size, long activation)
+g__ir_hidden(struct g__ir_state *state, long size, long activation)
 {
 	struct node *node;
 
 	if (MAX_SIZE < size) {
-		yyerror("invalid .hidden specification '%ld'", size);
+		g__ir_error(state, "invalid .hidden specification '%ld'", size);
 		G__DEBUG(G__ERR_SYNTAX);
 		return -1;
 	}
-	node = g__ir_malloc(sizeof (struct node));
+	node = g__ir_malloc(state, sizeof (struct node));
 	if (!node) {
-		yyerror("out of memory");
+		g__ir_error(state, "out of memory");
 		G__DEBUG(G__ERR_SYNTAX);
 		return -1;
 	}
 	node->type = NODE_TYPE_HIDDEN;
 	node->size = (int)size;
 	node->activation = (int)activation;
-	node->link = state.root;
-	state.root = node;
-	state.mark[MARK_HIDDEN] += 1;
+	node->link = state->root;
+	state->root = node;
+	state->mark[MARK_HIDDEN] += 1;
 	return 0;
 }
 
 int
-g__ir_cuda(long cuda)
+g__ir_cuda(struct g__ir_state *state, long cuda)
 {
-	if (state.mark[MARK_CUDA]) {
-		yyerror("duplicate .CUDA specification");
+	if (state->mark[MARK_CUDA]) {
+		g__ir_error(state, "duplicate .CUDA specification");
 		G__DEBUG(G__ERR_SYNTAX);
 		return -1;
 	}
 	if (MAX_CUDA < cuda) {
-		yyerror("invalid .CUDA specification '%ld'", cuda);
+		g__ir_error(state, "invalid .CUDA specification '%ld'", cuda);
+		G__DEBUG(G__ERR_SYNTAX);
+		return -1;
+	}
+	state->ir->cuda = (int)cuda;
+	state->mark[MARK_CUDA] += 1;
+	return 0;
+}
+
+int
+g__ir_schedule(struct g__ir_state *state, long schedule)
+{
+	if (state->mark[MARK_SCHEDULE]) {
+		g__ir_error(state, "duplicate .schedule specification");
+		G__DEBUG(G__ERR_SYNTAX);
+		return -1;
+	}
+	state->ir->schedule = (int)schedule;
+	state->mark[MARK_SCHEDULE] += 1;
+	return 0;
+}
+
+int
+g__ir_layout(struct g__ir_state *state, long layout)
+{
+	if (state->mark[MARK_LAYOUT]) {
+		g__ir_error(state, "duplicate .layout specification");
 		G__DEBUG(G__ERR_SYNTAX);
 		return -1;
 	}
-	state.ir->cuda = (int)cuda;
-	state.mark[MARK_CUDA] += 1;
+	state->ir->layout = (int)layout;
+	state->mark[MARK_LAYOUT] += 1;
 	return 0;
 }
 
 void *
-g__ir_malloc(size_t n)
+g__ir_malloc(struct g__ir_state *state, size_t n)
 {
 	void **link;
 
@@ -444,19 +533,19 @@ g__ir_malloc(size_t n)
 		return 0;
 	}
 	memset(link, 0, n);
-	(*link) = state._mem_;
-	state._mem_ = link;
+	(*link) = state->_mem_;
+	state->_mem_ = link;
 	return (link + 1);
 }
 
 char *
-g__ir_strdup(const char *s_)
+g__ir_strdup(struct g__ir_state *state, const char *s_)
 {
 	char *s;
 
 	assert( s_ );
 
-	if (!(s = g__ir_malloc(g__strlen(s_) + 1))) {
+	if (!(s = g__ir_malloc(state, g__strlen(s_) + 1))) {
 		G__DEBUG(0);
 		return 0;
 	}
@@ -39,11 +39,25 @@
 #define G__IR_ACTIVATION_SOFTMAX 3
 #define G__IR_ACTIVATION_SIGMOID 4
 
+#define G__IR_SCHEDULE_SERIAL 0
+#define G__IR_SCHEDULE_STALE  1
+
+#define G__IR_LAYOUT_PACKED  0
+#define G__IR_LAYOUT_ALIGNED 1
+#define G__IR_LAYOUT_BLOCKED 2
+
+#define G__IR_INPUT_REAL  0
+#define G__IR_INPUT_UINT8 1
+
 struct g__ir {
 	int batch;
 	int layers;
 	int costfnc;
 	int cuda;
+	int schedule;
+	int layout;
+	int input;    /* G__IR_INPUT_* */
+	double scale; /* of the input values */
 	const char *module;
 	const char *prefix;
 	struct {
@@ -59,36 +73,51 @@ struct g__ir {
 		int size;
 		int activation;
 	} *nodes;
+	void *_mem_; /* arena owning this IR */
 };
 
-const struct g__ir *g__ir_parse(const char *pathname);
+/*
+ * Each parse owns its state and scanner, so g__ir_parse() may run
+ * concurrently on different threads.
+ */
 
-void g__ir_destroy(void);
+const struct g__ir *g__ir_parse(const char *pathname, int verbose);
+
+void g__ir_destroy(const struct g__ir *ir);
 
 /*-----------------------------------------------------------------------------
  * Lexer/Parser Backend
  *---------------------------------------------------------------------------*/
 
-extern int yylineno;
-extern int yyerroron;
-extern int yylex(void);
-extern int yyparse(void);
-extern int yylex_destroy(void);
-extern void yyrestart(FILE *file);
-extern void yyerror(const char *format, ...);
-
-int g__ir_top(void);
-int g__ir_precision(long whole, long fraction, long precision);
-int g__ir_module(const char *s);
-int g__ir_prefix(const char *s);
-int g__ir_optimizer(long optimizer, double eta);
-int g__ir_costfnc(long costfnc);
-int g__ir_batch(long batch);
-int g__ir_input(long size);
-int g__ir_output(long size, long activation);
-int g__ir_hidden(long size, long activation);
-int g__ir_cuda(long cuda);
-void *g__ir_malloc(size_t n);
-char *g__ir_strdup(const char *s_);
+struct g__ir_state;
+
+extern int yylex_init(void **scanner);
+extern int yylex_destroy(void *scanner);
+extern int yyget_lineno(void *scanner);
+extern void yyset_in(FILE *file, void *scanner);
+extern int yyparse(void *scanner, struct g__ir_state *state);
+
+void g__ir_error(struct g__ir_state *state, const char *format, ...);
+int g__ir_top(struct g__ir_state *state);
+int g__ir_precision(struct g__ir_state *state,
+		    long whole,
+		    long fraction,
+		    long precision);
+int g__ir_module(struct g__ir_state *state, const char *s);
+int g__ir_prefix(struct g__ir_state *state, const char *s);
+int g__ir_optimizer(struct g__ir_state *state, long optimizer, double eta);
+int g__ir_costfnc(struct g__ir_state *state, long costfnc);
+int g__ir_batch(struct g__ir_state *state, long batch);
+int g__ir_input(struct g__ir_state *state,
+		long size,
+		long input,
+		double scale);
+int g__ir_output(struct g__ir_state *state, long size, long activation);
+int g__ir_hidden(struct g__ir_state *state, long size, long activation);
+int g__ir_cuda(struct g__ir_state *state, long cuda);
+int g__ir_schedule(struct g__ir_state *state, long schedule);
+int g__ir_layout(struct g__ir_state *state, long layout);
+void *g__ir_malloc(struct g__ir_state *state, size_t n);
+char *g__ir_strdup(struct g__ir_state *state, const char *s_);
 
 #endif /* _G_IR_H_ */
@@ -0,0 +1,456 @@
+/**
+ * g_kernel.h
+ * Copyright (C) Tony Givargis, 2019-2020
+ *
+ * This file is part of The Gravity Compiler.
+ *
+ * The Gravity Compiler is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version. The Gravity Compiler is distributed in
+ * the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE. See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with Foobar.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Shape-generic kernels, one per opcode, included by g_exec.c once per
+ * precision with T (the real type) and K(name) (the kernel name) defined.
+ * The hot loops are cloned per ISA where the toolchain allows it and the
+ * best clone is picked when libgravity is loaded.
+ */
+
+static void
+K(random)(const struct memory *m,
+	  const struct g__ann_program_inst *inst)
+{
+	T r, *z = (T *)at(m, inst->arg[0].i);
+	uint64_t n, i, j, k;
+
+	/* rows of arg[4] values arg[5] apart, or panels of rows */
+
+	n = inst->arg[3].i / inst->arg[5].i;
+	for (i=0; i<n; ++i) {
+		for (j=0; j<inst->arg[4].i; ++j) {
+			r = (T)rand() / RAND_MAX;
+			k = (G__ANN_LAYOUT_BLOCKED == inst->layout) ?
+				(i / G__ANN_PANEL * inst->arg[4].i +
+				 j) * G__ANN_PANEL + i % G__ANN_PANEL :
+				i * inst->arg[5].i + j;
+			z[k] = inst->arg[1].r + r * inst->arg[2].r;
+		}
+	}
+}
+
+static void
+K(copyx)(const struct memory *m,
+	 const struct g__ann_program_inst *inst,
+	 const void *x_)
+{
+	T s, *z = (T *)at(m, inst->arg[0].i);
+	const uint8_t *u = (const uint8_t *)x_;
+	uint64_t i;
+
+	if (G__ANN_INPUT_UINT8 != inst->arg[2].i) {
+		memcpy(z, x_, inst->arg[1].i * sizeof (T));
+		return;
+	}
+	s = (T)inst->arg[3].r;
+	for (i=0; i<inst->arg[1].i; ++i) {
+		z[i] = (T)u[i] * s;
+	}
+}
+
+G__KERNEL_CLONES
+static void
+K(mac1)(const struct memory *m,
+	const struct g__ann_program_inst *inst,
+	const struct g__ann_program_inst *bias)
+{
+	T *z = (T *)at(m, inst->arg[0].i);
+	const T *A = (const T *)at(m, inst->arg[1].i);
+	const T *B = (const T *)at(m, inst->arg[2].i);
+	const T *b = bias ? (const T *)at(m, bias->arg[1].i) : 0;
+	uint64_t n, i, j, k;
+	T s[8], sum;
+
+	/* eight partial sums per row keep the dot product vectorizable */
+
+	n = inst->arg[4].i;
+	for (i=0; i<inst->arg[3].i; ++i) {
+		for (k=0; k<8; ++k) {
+			s[k] = 0.0;
+		}
+		for (j=0; (j + 8)<=n; j+=8) {
+			for (k=0; k<8; ++k) {
+				s[k] += A[j + k] * B[j + k];
+			}
+		}
+		sum = b ? b[i] : 0.0;
+		for (k=0; k<8; ++k) {
+			sum += s[k];
+		}
+		for (; j<n; ++j) {
+			sum += A[j] * B[j];
+		}
+		z[i] = sum;
+		A += inst->arg[5].i;
+	}
+}
+
+G__KERNEL_CLONES
+static void
+K(mac2)(const struct memory *m,
+	const struct g__ann_program_inst *inst)
+{
+	T *z = (T *)at(m, inst->arg[0].i);
+	const T *A = (const T *)at(m, inst->arg[1].i);
+	const T *B = (const T *)at(m, inst->arg[2].i);
+	uint64_t n, i, j;
+
+	n = inst->arg[4].i;
+	for (i=0; i<n; ++i) {
+		z[i] = 0.0;
+	}
+	for (j=0; j<inst->arg[3].i; ++j) {
+		for (i=0; i<n; ++i) {
+			z[i] += A[i] * B[j];
+		}
+		A += inst->arg[5].i;
+	}
+}
+
+G__KERNEL_CLONES
+static void
+K(mac3)(const struct memory *m,
+	const struct g__ann_program_inst *inst)
+{
+	T *za = (T *)at(m, inst->arg[0].i);
+	const T *B = (const T *)at(m, inst->arg[1].i);
+	const T *C = (const T *)at(m, inst->arg[2].i);
+	uint64_t n, i, j;
+
+	n = inst->arg[4].i;
+	for (i=0; i<inst->arg[3].i; ++i) {
+		for (j=0; j<n; ++j) {
+			za[j] += B[i] * C[j];
+		}
+		za += inst->arg[5].i;
+	}
+}
+
+/*
+ * MAC1-3 on weights in panels of G__ANN_PANEL rows (G__ANN_LAYOUT_BLOCKED):
+ * the rows of a panel are the vector lanes, A read with unit stride. MAC1
+ * keeps the lane loop outermost, which compilers vectorize across the
+ * panel rather than along the row. The rows past n of the last panel are
+ * zero and never read against a vector element nor written out.
+ */
+
+G__KERNEL_CLONES
+static void
+K(panel1)(const struct memory *m,
+	  const struct g__ann_program_inst *inst,
+	  const struct g__ann_program_inst *bias)
+{
+	T *z = (T *)at(m, inst->arg[0].i);
+	const T *A = (const T *)at(m, inst->arg[1].i);
+	const T *B = (const T *)at(m, inst->arg[2].i);
+	const T *b = bias ? (const T *)at(m, bias->arg[1].i) : 0;
+	uint64_t n, i, j, k, h;
+	T s[G__ANN_PANEL];
+
+	n = inst->arg[4].i;
+	for (i=0; i<inst->arg[3].i; i+=G__ANN_PANEL) {
+		for (k=0; k<G__ANN_PANEL; ++k) {
+			s[k] = 0.0;
+			for (j=0; j<n; ++j) {
+				s[k] += A[j * G__ANN_PANEL + k] * B[j];
+			}
+		}
+		h = G__MIN(G__ANN_PANEL, inst->arg[3].i - i);
+		for (k=0; k<h; ++k) {
+			z[i + k] = (b ? b[i + k] : 0.0) + s[k];
+		}
+		A += G__ANN_PANEL * n;
+	}
+}
+
+G__KERNEL_CLONES
+static void
+K(panel2)(const struct memory *m,
+	  const struct g__ann_program_inst *inst)
+{
+	T *z = (T *)at(m, inst->arg[0].i);
+	const T *A = (const T *)at(m, inst->arg[1].i);
+	const T *B = (const T *)at(m, inst->arg[2].i);
+	uint64_t n, i, j, k, h;
+	T s;
+
+	n = inst->arg[4].i;
+	for (j=0; j<n; ++j) {
+		z[j] = 0.0;
+	}
+	for (i=0; i<inst->arg[3].i; i+=G__ANN_PANEL) {
+		h = G__MIN(G__ANN_PANEL, inst->arg[3].i - i);
+		for (j=0; j<n; ++j) {
+			s = 0.0;
+			for (k=0; k<h; ++k) {
+				s += A[j * G__ANN_PANEL + k] * B[i + k];
+			}
+			z[j] += s;
+		}
+		A += G__ANN_PANEL * n;
+	}
+}
+
+G__KERNEL_CLONES
+static void
+K(panel3)(const struct memory *m,
+	  const struct g__ann_program_inst *inst)
+{
+	T *za = (T *)at(m, inst->arg[0].i);
+	const T *B = (const T *)at(m, inst->arg[1].i);
+	const T *C = (const T *)at(m, inst->arg[2].i);
+	uint64_t n, i, j, k, h;
+
+	n = inst->arg[4].i;
+	for (i=0; i<inst->arg[3].i; i+=G__ANN_PANEL) {
+		h = G__MIN(G__ANN_PANEL, inst->arg[3].i - i);
+		for (j=0; j<n; ++j) {
+			for (k=0; k<h; ++k) {
+				za[j * G__ANN_PANEL + k] += B[i + k] * C[j];
+			}
+		}
+		za += G__ANN_PANEL * n;
+	}
+}
+
+G__KERNEL_CLONES
+static void
+K(mac4)(const struct memory *m,
+	const struct g__ann_program_inst *inst)
+{
+	T *za = (T *)at(m, inst->arg[0].i);
+	const T *B = (const T *)at(m, inst->arg[1].i);
+	T r = inst->arg[2].r;
+	uint64_t i;
+
+	for (i=0; i<inst->arg[3].i; ++i) {
+		za[i] += B[i] * r;
+	}
+}
+
+static void
+K(add)(const struct memory *m,
+       const struct g__ann_program_inst *inst)
+{
+	T *za = (T *)at(m, inst->arg[0].i);
+	const T *B = (const T *)at(m, inst->arg[1].i);
+	uint64_t i;
+
+	for (i=0; i<inst->arg[2].i; ++i) {
+		za[i] += B[i];
+	}
+}
+
+G__KERNEL_CLONES
+static void
+K(reduce)(T *z, const T *b, uint64_t n)
+{
+	uint64_t i;
+
+	for (i=0; i<n; ++i) {
+		z[i] += b[i];
+	}
+}
+
+static void
+K(suby)(const struct memory *m,
+	const struct g__ann_program_inst *inst,
+	const T *y_)
+{
+	T *z = (T *)at(m, inst->arg[0].i);
+	const T *A = (const T *)at(m, inst->arg[1].i);
+	uint64_t i;
+
+	for (i=0; i<inst->arg[2].i; ++i) {
+		z[i] = A[i] - y_[i];
+	}
+}
+
+static void
+K(suby_index)(const struct memory *m,
+	      const struct g__ann_program_inst *inst,
+	      const int32_t *y_)
+{
+	T *z = (T *)at(m, inst->arg[0].i);
+	const T *A = (const T *)at(m, inst->arg[1].i);
+
+	memcpy(z, A, inst->arg[2].i * sizeof (T));
+	z[*y_] -= (T)1;
+}
+
+static void
+K(relu)(const struct memory *m,
+	const struct g__ann_program_inst *inst)
+{
+	T *za = (T *)at(m, inst->arg[0].i);
+	uint64_t i;
+
+	for (i=0; i<inst->arg[1].i; ++i) {
+		if (0.0 >= za[i]) {
+			za[i] = 0.0;
+		}
+	}
+}
+
+static void
+K(softmax)(const struct memory *m,
+	   const struct g__ann_program_inst *inst)
+{
+	T *za = (T *)at(m, inst->arg[0].i);
+	T max = za[0], sum = 0.0;
+	uint64_t i;
+
+	for (i=1; i<inst->arg[1].i; ++i) {
+		if (max < za[i]) {
+			max = za[i];
+		}
+	}
+	for (i=0; i<inst->arg[1].i; ++i) {
+		za[i] -= max;
+		sum += (T)exp(za[i]);
+	}
+	for (i=0; i<inst->arg[1].i; ++i) {
+		za[i] = (T)exp(za[i]) / sum;
+	}
+}
+
+static void
+K(sigmoid)(const struct memory *m,
+	   const struct g__ann_program_inst *inst)
+{
+	T *za = (T *)at(m, inst->arg[0].i);
+	uint64_t i;
+	T zee;
+
+	for (i=0; i<inst->arg[1].i; ++i) {
+		if (0.0 <= za[i]) {
+			zee = (T)exp(-za[i]);
+			za[i] = 1.0 / (1.0 + zee);
+		}
+		else {
+			zee = (T)exp(za[i]);
+			za[i] = zee / (1.0 + zee);
+		}
+	}
+}
+
+static void
+K(relud)(const struct memory *m,
+	 const struct g__ann_program_inst *inst)
+{
+	T *za = (T *)at(m, inst->arg[0].i);
+	const T *B = (const T *)at(m, inst->arg[1].i);
+	uint64_t i;
+
+	for (i=0; i<inst->arg[2].i; ++i) {
+		if (0.0 >= B[i]) {
+			za[i] = 0.0;
+		}
+	}
+}
+
+/*
+ * Executes inst (and, when fused, the one following), returns the number
+ * of instructions consumed.
+ */
+
+static int
+K(step)(const struct memory *m,
+	const struct g__ann_program_inst *inst,
+	const struct g__ann_program_inst *next,
+	const void *x_,
+	const void *y_)
+{
+	switch (inst->opc) {
+	case G__ANN_PROGRAM_INST_RANDOM:
+		K(random)(m, inst);
+		break;
+	case G__ANN_PROGRAM_INST_CLEAR:
+		memset(at(m, inst->arg[0].i), 0, inst->arg[1].i * sizeof (T));
+		break;
+	case G__ANN_PROGRAM_INST_COPYX:
+		K(copyx)(m, inst, x_);
+		break;
+	case G__ANN_PROGRAM_INST_MAC1:
+		if (next &&
+		    (G__ANN_PROGRAM_INST_ADD == next->opc) &&
+		    (next->arg[0].i == inst->arg[0].i)) {
+			if (G__ANN_LAYOUT_BLOCKED == inst->layout) {
+				K(panel1)(m, inst, next);
+			}
+			else {
+				K(mac1)(m, inst, next);
+			}
+			return 2;
+		}
+		if (G__ANN_LAYOUT_BLOCKED == inst->layout) {
+			K(panel1)(m, inst, 0);
+		}
+		else {
+			K(mac1)(m, inst, 0);
+		}
+		break;
+	case G__ANN_PROGRAM_INST_MAC2:
+		if (G__ANN_LAYOUT_BLOCKED == inst->layout) {
+			K(panel2)(m, inst);
+		}
+		else {
+			K(mac2)(m, inst);
+		}
+		break;
+	case G__ANN_PROGRAM_INST_MAC3:
+		if (G__ANN_LAYOUT_BLOCKED == inst->layout) {
+			K(panel3)(m, inst);
+		}
+		else {
+			K(mac3)(m, inst);
+		}
+		break;
+	case G__ANN_PROGRAM_INST_MAC4:
+		K(mac4)(m, inst);
+		break;
+	case G__ANN_PROGRAM_INST_ADD:
+		K(add)(m, inst);
+		break;
+	case G__ANN_PROGRAM_INST_SUBY:
+		K(suby)(m, inst, (const T *)y_);
+		break;
+	case G__ANN_PROGRAM_INST_SUBY_INDEX:
+		K(suby_index)(m, inst, (const int32_t *)y_);
+		break;
+	case G__ANN_PROGRAM_INST_RELU:
+		K(relu)(m, inst);
+		break;
+	case G__ANN_PROGRAM_INST_LINEAR:
+		break;
+	case G__ANN_PROGRAM_INST_SOFTMAX:
+		K(softmax)(m, inst);
+		break;
+	case G__ANN_PROGRAM_INST_SIGMOID:
+		K(sigmoid)(m, inst);
+		break;
+	case G__ANN_PROGRAM_INST_RELUD:
+		K(relud)(m, inst);
+		break;
+	default: /* FIX : LINEARD, SOFTMAXD, SIGMOIDD not implemented */
+		G__DEBUG(G__ERR_SOFTWARE);
+		assert( 0 );
+		exit(-1);
+	}
+	return 1;
+}
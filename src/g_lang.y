@@ -20,6 +20,10 @@
   #include "g_ir.h"
 %}
 
+%define api.pure full
+%lex-param { void *scanner }
+%parse-param { void *scanner } { struct g__ir_state *state }
+
 %union {
   long l;
   double d;
@@ -41,6 +45,8 @@
 %token G__OUTPUT
 %token G__HIDDEN
 %token G__CUDA
+%token G__SCHEDULE
+%token G__LAYOUT
 %token G__SGD
 %token G__FLOAT
 %token G__DOUBLE
@@ -52,6 +58,13 @@
 %token G__LINEAR
 %token G__SOFTMAX
 %token G__SIGMOID
+%token G__SERIAL
+%token G__STALE
+%token G__PACKED
+%token G__ALIGNED
+%token G__BLOCKED
+%token G__UINT8
+%token G__SCALE
 %token <s> G__LONG
 %token <s> G__REAL
 %token <s> G__STRING
@@ -60,16 +73,25 @@
 %type <t> _precision1_
 %type <l> _costfnc1_
 %type <l> _activation_
+%type <l> _schedule1_
+%type <l> _layout1_
 %type <l> _expr_
 %type <l> _long_
+%type <d> _scale_
+%type <d> _number_
 %type <d> _real_
 %type <s> _string_
 
+%code {
+  int yylex(YYSTYPE *yylval, void *scanner);
+  void yyerror(void *scanner, struct g__ir_state *state, const char *s);
+}
+
 %%
 
 top
-  : _phrase_ { if (g__ir_top()) YYABORT; }
-  | G__ERROR { yyerror(0); YYABORT;      }
+  : _phrase_ { if (g__ir_top(state)) YYABORT;      }
+  | G__ERROR { g__ir_error(state, 0); YYABORT;    }
   ;
 
 _phrase_
@@ -88,25 +110,27 @@ _phrase1_
   | _output_ ';'
   | _hidden_ ';'
   | _cuda_ ';'
+  | _schedule_ ';'
+  | _layout_ ';'
   | ';'
   ;
 
 /*---------------------------------------------------------------------------------------------------------------------------------------*/
 
 _module_
-  : G__MODULE _string_ { if (g__ir_module($2)) YYABORT; }
+  : G__MODULE _string_ { if (g__ir_module(state, $2)) YYABORT; }
   ;
 
 _prefix_
-  : G__PREFIX _string_ { if (g__ir_prefix($2)) YYABORT; }
+  : G__PREFIX _string_ { if (g__ir_prefix(state, $2)) YYABORT; }
   ;
 
 _optimizer_
-  : G__OPTIMIZER G__SGD _real_ { if (g__ir_optimizer(G__IR_OPTIMIZER_SGD, $3)) YYABORT; }
+  : G__OPTIMIZER G__SGD _real_ { if (g__ir_optimizer(state, G__IR_OPTIMIZER_SGD, $3)) YYABORT; }
   ;
 
 _precision_
-  : G__PRECISION _precision1_ { if (g__ir_precision($2.a, $2.b, $2.c)) YYABORT; }
+  : G__PRECISION _precision1_ { if (g__ir_precision(state, $2.a, $2.b, $2.c)) YYABORT; }
   ;
 
 _precision1_
@@ -116,7 +140,7 @@ _precision1_
   ;
 
 _costfnc_
-  : G__COSTFNC _costfnc1_ { if (g__ir_costfnc($2)) YYABORT; }
+  : G__COSTFNC _costfnc1_ { if (g__ir_costfnc(state, $2)) YYABORT; }
   ;
 
 _costfnc1_
@@ -126,23 +150,57 @@ _costfnc1_
   ;
 
 _batch_
-  : G__BATCH _expr_ { if (g__ir_batch($2)) YYABORT; }
+  : G__BATCH _expr_ { if (g__ir_batch(state, $2)) YYABORT; }
   ;
 
 _input_
-  : G__INPUT _expr_ { if (g__ir_input($2)) YYABORT; }
+  : G__INPUT _expr_                  { if (g__ir_input(state, $2, G__IR_INPUT_REAL, 1.0)) YYABORT;  }
+  | G__INPUT _expr_ G__UINT8 _scale_ { if (g__ir_input(state, $2, G__IR_INPUT_UINT8, $4)) YYABORT; }
+  ;
+
+_scale_
+  :                           { $$ = 1.0; }
+  | G__SCALE '(' _number_ ')' { $$ = $3;  }
+  | G__SCALE '(' _number_ '/' _number_ ')'
+  {
+    if (!$5) {
+      g__ir_error(state, "divide by zero");
+      G__DEBUG(G__ERR_SYNTAX);
+      YYABORT;
+    }
+    $$ = $3 / $5;
+  }
   ;
 
 _output_
-  : G__OUTPUT _expr_ _activation_ { if (g__ir_output($2, $3)) YYABORT; }
+  : G__OUTPUT _expr_ _activation_ { if (g__ir_output(state, $2, $3)) YYABORT; }
   ;
 
 _hidden_
-  : G__HIDDEN _expr_ _activation_ { if (g__ir_hidden($2, $3)) YYABORT; }
+  : G__HIDDEN _expr_ _activation_ { if (g__ir_hidden(state, $2, $3)) YYABORT; }
   ;
 
 _cuda_
-  : G__CUDA _expr_ { if (g__ir_cuda($2)) YYABORT; }
+  : G__CUDA _expr_ { if (g__ir_cuda(state, $2)) YYABORT; }
+  ;
+
+_schedule_
+  : G__SCHEDULE _schedule1_ { if (g__ir_schedule(state, $2)) YYABORT; }
+  ;
+
+_schedule1_
+  : G__SERIAL { $$ = G__IR_SCHEDULE_SERIAL; }
+  | G__STALE  { $$ = G__IR_SCHEDULE_STALE;  }
+  ;
+
+_layout_
+  : G__LAYOUT _layout1_ { if (g__ir_layout(state, $2)) YYABORT; }
+  ;
+
+_layout1_
+  : G__PACKED  { $$ = G__IR_LAYOUT_PACKED;  }
+  | G__ALIGNED { $$ = G__IR_LAYOUT_ALIGNED; }
+  | G__BLOCKED { $$ = G__IR_LAYOUT_BLOCKED; }
   ;
 
 _activation_
@@ -161,8 +219,8 @@ _expr_
   | _expr_ '+' _expr_  { $$ = $1 + $3; }
   | _expr_ '-' _expr_  { $$ = $1 - $3; }
   | _expr_ '*' _expr_  { $$ = $1 * $3; }
-  | _expr_ '/' _expr_  { if(!$3) { yyerror("divide by zero near line %d", yylineno); G__DEBUG(G__ERR_SYNTAX); YYABORT; } $$ = $1 / $3; }
-  | _expr_ '%' _expr_  { if(!$3) { yyerror("divide by zero near line %d", yylineno); G__DEBUG(G__ERR_SYNTAX); YYABORT; } $$ = $1 % $3; }
+  | _expr_ '/' _expr_  { if(!$3) { g__ir_error(state, "divide by zero"); G__DEBUG(G__ERR_SYNTAX); YYABORT; } $$ = $1 / $3; }
+  | _expr_ '%' _expr_  { if(!$3) { g__ir_error(state, "divide by zero"); G__DEBUG(G__ERR_SYNTAX); YYABORT; } $$ = $1 % $3; }
   ;
 
 _long_
@@ -171,20 +229,25 @@ _long_
     char *e = 0;
     $$ = strtol($1, &e, 10);
     if ((e == $1) || (*e)) {
-      yyerror("invalid numeric value '%s' near line %d", $1, yylineno);
+      g__ir_error(state, "invalid numeric value '%s'", $1);
       G__DEBUG(G__ERR_SYNTAX);
       YYABORT;
     }
   }
   ;
 
+_number_
+  : _long_ { $$ = (double)$1; }
+  | _real_ { $$ = $1;         }
+  ;
+
 _real_
   : G__REAL
   {
     char *e = 0;
     $$ = strtod($1, &e);
     if ((e == $1) || (*e)) {
-      yyerror("invalid numeric value '%s' near line %d", $1, yylineno);
+      g__ir_error(state, "invalid numeric value '%s'", $1);
       G__DEBUG(G__ERR_SYNTAX);
       YYABORT;
     }
@@ -194,8 +257,8 @@ _real_
 _string_
   : G__STRING
   {
-    if (!($$ = g__ir_strdup($1 + 1))) {
-      yyerror("out of memory");
+    if (!($$ = g__ir_strdup(state, $1 + 1))) {
+      g__ir_error(state, "out of memory");
       G__DEBUG(0);
       YYABORT;
     }
@@ -204,3 +267,10 @@ _string_
   ;
 
 %%
+
+void
+yyerror(void *scanner, struct g__ir_state *state, const char *s)
+{
+  G__UNUSED(scanner);
+  g__ir_error(state, "%s", s);
+}
@@ -0,0 +1,109 @@
+/**
+ * g_memory.c
+ * Copyright (C) Tony Givargis, 2019-2020
+ *
+ * This file is part of The Gravity Compiler.
+ *
+ * The Gravity Compiler is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version. The Gravity Compiler is distributed in
+ * the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE. See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with Foobar.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#define _DEFAULT_SOURCE
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include "g_memory.h"
+
+#define ALIGN 64
+#define HUGE_PAGE  (2UL * 1024 * 1024) /* mapping granule with G__MEMORY_HUGE */
+
+static size_t
+length(size_t n)
+{
+	return (n + HUGE_PAGE - 1) / HUGE_PAGE * HUGE_PAGE;
+}
+
+static void *
+huge(size_t n)
+{
+	void *p;
+
+	/* reserved huge pages first, else ordinary ones the kernel may merge */
+
+#ifdef MAP_HUGETLB
+	p = mmap(0,
+		 length(n),
+		 PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
+		 -1,
+		 0);
+	if (MAP_FAILED != p) {
+		return p;
+	}
+#endif
+	p = mmap(0,
+		 length(n),
+		 PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS,
+		 -1,
+		 0);
+	if (MAP_FAILED == p) {
+		G__DEBUG(G__ERR_MEMORY);
+		return 0;
+	}
+#ifdef MADV_HUGEPAGE
+	madvise(p, length(n), MADV_HUGEPAGE);
+#endif
+	return p;
+}
+
+void *
+g__memory_alloc(size_t n, int flags)
+{
+	void *p;
+
+	assert( n );
+
+	if (G__MEMORY_HUGE & flags) {
+		p = huge(n);
+		if (!p) {
+			G__DEBUG(0);
+			return 0;
+		}
+	}
+	else if (posix_memalign(&p, ALIGN, n)) {
+		G__DEBUG(G__ERR_MEMORY);
+		return 0;
+	}
+	memset(p, 0, n);
+	if ((G__MEMORY_LOCK & flags) && mlock(p, n)) {
+		g__memory_free(p, n, flags & ~G__MEMORY_LOCK);
+		G__DEBUG(G__ERR_SYSTEM);
+		return 0;
+	}
+	return p;
+}
+
+void
+g__memory_free(void *p, size_t n, int flags)
+{
+	if (p) {
+		if (G__MEMORY_LOCK & flags) {
+			munlock(p, n);
+		}
+		if (G__MEMORY_HUGE & flags) {
+			munmap(p, length(n));
+		}
+		else {
+			free(p);
+		}
+	}
+}
@@ -0,0 +1,37 @@
+/**
+ * g_memory.h
+ * Copyright (C) Tony Givargis, 2019-2020
+ *
+ * This file is part of The Gravity Compiler.
+ *
+ * The Gravity Compiler is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version. The Gravity Compiler is distributed in
+ * the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE. See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with Foobar.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef _G_MEMORY_H_
+#define _G_MEMORY_H_
+
+#include "g_common.h"
+
+#define G__MEMORY_HUGE 1 /* huge pages, hugetlbfs if reserved else THP */
+#define G__MEMORY_LOCK 2 /* locked in RAM */
+
+/*
+ * Model memory: n bytes, 64-byte aligned and zeroed (every page touched
+ * once here rather than on first use), to be released by g__memory_free()
+ * with the same n and flags.
+ */
+
+void *g__memory_alloc(size_t n, int flags);
+
+void g__memory_free(void *p, size_t n, int flags);
+
+#endif /* _G_MEMORY_H_ */
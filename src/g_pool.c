@@ -0,0 +1,227 @@
+/**
+ * g_pool.c
+ * Copyright (C) Tony Givargis, 2019-2020
+ *
+ * This file is part of The Gravity Compiler.
+ *
+ * The Gravity Compiler is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version. The Gravity Compiler is distributed in
+ * the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE. See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with Foobar.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+#include "g_pool.h"
+
+#define SPIN 4096 /* polls before sleeping */
+
+struct g__pool {
+	int n;
+	int refs;
+	pthread_t *threads;
+	pthread_mutex_t busy; /* one caller at a time */
+	pthread_mutex_t mutex;
+	pthread_cond_t wake;
+	pthread_cond_t done;
+	g__pool_fnc_t fnc;
+	void *arg;
+	unsigned generation; /* bumped per run */
+	int pending;         /* threads yet to finish the run */
+	int sleepers;        /* threads waiting on wake */
+	int waiting;         /* caller waiting on done */
+	int quit;
+};
+
+struct worker {
+	struct g__pool *pool;
+	int id;
+};
+
+static int
+load(int *p)
+{
+	return __atomic_load_n(p, __ATOMIC_SEQ_CST);
+}
+
+static void *
+worker(void *arg)
+{
+	struct g__pool *pool;
+	unsigned generation;
+	int id, i;
+
+	pool = ((struct worker *)arg)->pool;
+	id = ((struct worker *)arg)->id;
+	G__FREE(arg);
+	generation = 0;
+	for (;;) {
+
+		/* wait for the next run */
+
+		for (i=0; i<SPIN; ++i) {
+			if ((generation != __atomic_load_n(&pool->generation,
+							   __ATOMIC_SEQ_CST)) ||
+			    load(&pool->quit)) {
+				break;
+			}
+		}
+		if (SPIN == i) {
+			pthread_mutex_lock(&pool->mutex);
+			__atomic_add_fetch(&pool->sleepers, 1, __ATOMIC_SEQ_CST);
+			while ((generation ==
+				__atomic_load_n(&pool->generation,
+						__ATOMIC_SEQ_CST)) &&
+			       !load(&pool->quit)) {
+				pthread_cond_wait(&pool->wake, &pool->mutex);
+			}
+			__atomic_sub_fetch(&pool->sleepers, 1, __ATOMIC_SEQ_CST);
+			pthread_mutex_unlock(&pool->mutex);
+		}
+		if (load(&pool->quit)) {
+			break;
+		}
+		generation = __atomic_load_n(&pool->generation,
+					     __ATOMIC_SEQ_CST);
+
+		/* run, the last one to finish wakes a sleeping caller */
+
+		pool->fnc(pool->arg, id, pool->n);
+		if (!__atomic_sub_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST) &&
+		    load(&pool->waiting)) {
+			pthread_mutex_lock(&pool->mutex);
+			pthread_cond_signal(&pool->done);
+			pthread_mutex_unlock(&pool->mutex);
+		}
+	}
+	return 0;
+}
+
+static void
+destroy(struct g__pool *pool, int started)
+{
+	int i;
+
+	pthread_mutex_lock(&pool->mutex);
+	__atomic_store_n(&pool->quit, 1, __ATOMIC_SEQ_CST);
+	pthread_cond_broadcast(&pool->wake);
+	pthread_mutex_unlock(&pool->mutex);
+	for (i=0; i<started; ++i) {
+		pthread_join(pool->threads[i], 0);
+	}
+	pthread_cond_destroy(&pool->done);
+	pthread_cond_destroy(&pool->wake);
+	pthread_mutex_destroy(&pool->mutex);
+	pthread_mutex_destroy(&pool->busy);
+	G__FREE(pool->threads);
+	memset(pool, 0, sizeof (struct g__pool));
+	G__FREE(pool);
+}
+
+g__pool_t
+g__pool_open(int n)
+{
+	struct g__pool *pool;
+	struct worker *worker_;
+	int i;
+
+	assert( 1 < n );
+
+	pool = g__malloc(sizeof (struct g__pool));
+	if (!pool) {
+		G__DEBUG(0);
+		return 0;
+	}
+	memset(pool, 0, sizeof (struct g__pool));
+	pool->n = n;
+	pool->refs = 1;
+	pool->threads = g__malloc((n - 1) * sizeof (pool->threads[0]));
+	if (!pool->threads) {
+		G__FREE(pool);
+		G__DEBUG(0);
+		return 0;
+	}
+	pthread_mutex_init(&pool->busy, 0);
+	pthread_mutex_init(&pool->mutex, 0);
+	pthread_cond_init(&pool->wake, 0);
+	pthread_cond_init(&pool->done, 0);
+
+	/* the caller is thread 0 */
+
+	for (i=0; i<(n - 1); ++i) {
+		worker_ = g__malloc(sizeof (struct worker));
+		if (!worker_) {
+			destroy(pool, i);
+			G__DEBUG(0);
+			return 0;
+		}
+		worker_->pool = pool;
+		worker_->id = i + 1;
+		if (pthread_create(&pool->threads[i], 0, worker, worker_)) {
+			G__FREE(worker_);
+			destroy(pool, i);
+			G__DEBUG(G__ERR_SYSTEM);
+			return 0;
+		}
+	}
+	return pool;
+}
+
+g__pool_t
+g__pool_retain(g__pool_t pool)
+{
+	assert( pool && (0 < pool->refs) );
+
+	__atomic_add_fetch(&pool->refs, 1, __ATOMIC_RELAXED);
+	return pool;
+}
+
+void
+g__pool_close(g__pool_t pool)
+{
+	if (pool && !__atomic_sub_fetch(&pool->refs, 1, __ATOMIC_ACQ_REL)) {
+		destroy(pool, pool->n - 1);
+	}
+}
+
+void
+g__pool_run(void *pool_, g__pool_fnc_t fnc, void *arg)
+{
+	struct g__pool *pool;
+	int i;
+
+	pool = (struct g__pool *)pool_;
+	if (pthread_mutex_trylock(&pool->busy)) {
+		fnc(arg, 0, 1);
+		return;
+	}
+	pool->fnc = fnc;
+	pool->arg = arg;
+	__atomic_store_n(&pool->pending, pool->n - 1, __ATOMIC_SEQ_CST);
+	__atomic_add_fetch(&pool->generation, 1, __ATOMIC_SEQ_CST);
+	if (load(&pool->sleepers)) {
+		pthread_mutex_lock(&pool->mutex);
+		pthread_cond_broadcast(&pool->wake);
+		pthread_mutex_unlock(&pool->mutex);
+	}
+	fnc(arg, 0, pool->n);
+
+	/* barrier */
+
+	for (i=0; (i<SPIN) && load(&pool->pending); ++i) {
+	}
+	if (load(&pool->pending)) {
+		pthread_mutex_lock(&pool->mutex);
+		__atomic_store_n(&pool->waiting, 1, __ATOMIC_SEQ_CST);
+		while (load(&pool->pending)) {
+			pthread_cond_wait(&pool->done, &pool->mutex);
+		}
+		__atomic_store_n(&pool->waiting, 0, __ATOMIC_SEQ_CST);
+		pthread_mutex_unlock(&pool->mutex);
+	}
+	pthread_mutex_unlock(&pool->busy);
+}
@@ -0,0 +1,49 @@
+/**
+ * g_pool.h
+ * Copyright (C) Tony Givargis, 2019-2020
+ *
+ * This file is part of The Gravity Compiler.
+ *
+ * The Gravity Compiler is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version. The Gravity Compiler is distributed in
+ * the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE. See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with Foobar.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _G_POOL_H_
+#define _G_POOL_H_
+
+#include "g_common.h"
+
+/*
+ * A small persistent thread pool for intra-operator parallelism. The
+ * caller of g__pool_run() takes part as thread 0 and returns once every
+ * thread finished, so consecutive runs are separated by a barrier. Idle
+ * threads spin briefly before sleeping, keeping per-layer dispatch cheap.
+ */
+
+typedef struct g__pool *g__pool_t;
+
+typedef void (*g__pool_fnc_t)(void *arg, int id, int n);
+
+g__pool_t g__pool_open(int n);
+
+/* adds a reference, balanced by g__pool_close() */
+
+g__pool_t g__pool_retain(g__pool_t pool);
+
+void g__pool_close(g__pool_t pool);
+
+/*
+ * Runs fnc(arg, id, n) for id in [0, n), runs fnc(arg, 0, 1) in the
+ * calling thread when the pool is busy with another caller.
+ */
+
+void g__pool_run(void *pool, g__pool_fnc_t fnc, void *arg);
+
+#endif /* _G_POOL_H_ */
@@ -0,0 +1,390 @@
+/**
+ * g_ring.c
+ * Copyright (C) Tony Givargis, 2019-2020
+ *
+ * This file is part of The Gravity Compiler.
+ *
+ * The Gravity Compiler is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version. The Gravity Compiler is distributed in
+ * the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE. See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with Foobar.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include "g_ring.h"
+
+#define CONNECT_TRIES 6000 /* 10ms apart, for the neighbor to come up */
+
+struct g__ring {
+	int rank;
+	int size;
+	int left;  /* from rank - 1 */
+	int right; /* to rank + 1 */
+	char *buf; /* outgoing and incoming chunk */
+	uint64_t n;
+};
+
+static void
+address(struct sockaddr_un *addr, const char *path, int rank)
+{
+	memset(addr, 0, sizeof (struct sockaddr_un));
+	addr->sun_family = AF_UNIX;
+	g__sprintf(addr->sun_path,
+		   sizeof (addr->sun_path),
+		   "%s.%d",
+		   path,
+		   rank);
+}
+
+static int
+nonblock(int fd)
+{
+	int flags;
+
+	flags = fcntl(fd, F_GETFL, 0);
+	if ((0 > flags) || (0 > fcntl(fd, F_SETFL, flags | O_NONBLOCK))) {
+		G__DEBUG(G__ERR_SYSTEM);
+		return -1;
+	}
+	return 0;
+}
+
+g__ring_t
+g__ring_open(const char *path, int rank, int size)
+{
+	struct sockaddr_un addr;
+	struct g__ring *ring;
+	struct timespec ts;
+	int listener, i;
+
+	if (!g__strlen(path) ||
+	    (0 >= size) ||
+	    (0 > rank) ||
+	    (rank >= size) ||
+	    ((g__strlen(path) + 16) > sizeof (addr.sun_path))) {
+		G__DEBUG(G__ERR_ARGUMENT);
+		return 0;
+	}
+	ring = g__malloc(sizeof (struct g__ring));
+	if (!ring) {
+		G__DEBUG(0);
+		return 0;
+	}
+	memset(ring, 0, sizeof (struct g__ring));
+	ring->rank = rank;
+	ring->size = size;
+	ring->left = -1;
+	ring->right = -1;
+	if (1 == size) {
+		return ring;
+	}
+
+	/*
+	 * Listen first, so the left neighbor's connect completes while this
+	 * rank is still connecting to its right.
+	 */
+
+	address(&addr, path, rank);
+	unlink(addr.sun_path);
+	listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if ((0 > listener) ||
+	    bind(listener, (struct sockaddr *)&addr, sizeof (addr)) ||
+	    listen(listener, 1)) {
+		if (0 <= listener) {
+			close(listener);
+		}
+		unlink(addr.sun_path);
+		g__ring_close(ring);
+		G__DEBUG(G__ERR_SYSTEM);
+		return 0;
+	}
+	address(&addr, path, (rank + 1) % size);
+	for (i=0; i<CONNECT_TRIES; ++i) {
+		ring->right = socket(AF_UNIX, SOCK_STREAM, 0);
+		if ((0 > ring->right) ||
+		    !connect(ring->right,
+			     (struct sockaddr *)&addr,
+			     sizeof (addr))) {
+			break;
+		}
+		close(ring->right);
+		ring->right = -1;
+		ts.tv_sec = 0;
+		ts.tv_nsec = 10000000;
+		nanosleep(&ts, 0);
+	}
+	ring->left = (0 <= ring->right) ? accept(listener, 0, 0) : -1;
+	close(listener);
+	address(&addr, path, rank);
+	unlink(addr.sun_path);
+	if ((0 > ring->right) ||
+	    (0 > ring->left) ||
+	    nonblock(ring->right) ||
+	    nonblock(ring->left)) {
+		g__ring_close(ring);
+		G__DEBUG(G__ERR_SYSTEM);
+		return 0;
+	}
+	return ring;
+}
+
+void
+g__ring_close(g__ring_t ring)
+{
+	if (ring) {
+		if (0 <= ring->left) {
+			close(ring->left);
+		}
+		if (0 <= ring->right) {
+			close(ring->right);
+		}
+		G__FREE(ring->buf);
+		memset(ring, 0, sizeof (struct g__ring));
+	}
+	G__FREE(ring);
+}
+
+static int
+exchange(g__ring_t ring,
+	 const char *out,
+	 uint64_t nout,
+	 char *in,
+	 uint64_t nin)
+{
+	struct pollfd fds[2];
+	uint64_t a, b;
+	ssize_t k;
+
+	/* send right and receive left at once, neither side can stall */
+
+	a = b = 0;
+	while ((a < nout) || (b < nin)) {
+		fds[0].fd = (a < nout) ? ring->right : -1;
+		fds[0].events = POLLOUT;
+		fds[0].revents = 0;
+		fds[1].fd = (b < nin) ? ring->left : -1;
+		fds[1].events = POLLIN;
+		fds[1].revents = 0;
+		if (0 > poll(fds, 2, -1)) {
+			if (EINTR == errno) {
+				continue;
+			}
+			G__DEBUG(G__ERR_SYSTEM);
+			return -1;
+		}
+		if (fds[0].revents) {
+			k = send(ring->right, out + a, nout - a, MSG_NOSIGNAL);
+			if ((0 > k) && (EAGAIN != errno) && (EINTR != errno)) {
+				G__DEBUG(G__ERR_SYSTEM);
+				return -1;
+			}
+			a += (0 < k) ? (uint64_t)k : 0;
+		}
+		if (fds[1].revents) {
+			k = recv(ring->left, in + b, nin - b, 0);
+			if (!k) {
+				G__DEBUG(G__ERR_SYSTEM); /* left rank gone */
+				return -1;
+			}
+			if ((0 > k) && (EAGAIN != errno) && (EINTR != errno)) {
+				G__DEBUG(G__ERR_SYSTEM);
+				return -1;
+			}
+			b += (0 < k) ? (uint64_t)k : 0;
+		}
+	}
+	return 0;
+}
+
+static double
+load(const char *s, uint64_t i, int unit, int compress)
+{
+	uint32_t u;
+	uint16_t h;
+	double d;
+	float f;
+
+	if ((4 == unit) && compress) {
+		memcpy(&h, s + i * 2, 2);
+		u = (uint32_t)h << 16;
+		memcpy(&f, &u, 4);
+		return f;
+	}
+	if ((4 == unit) || compress) {
+		memcpy(&f, s + i * 4, 4);
+		return f;
+	}
+	memcpy(&d, s + i * 8, 8);
+	return d;
+}
+
+static void
+save(char *s, uint64_t i, int unit, int compress, double v)
+{
+	uint32_t u;
+	uint16_t h;
+	float f;
+
+	if ((4 == unit) && compress) {
+		f = (float)v;
+		memcpy(&u, &f, 4);
+		u += 0x7fff + ((u >> 16) & 1); /* round to nearest even */
+		h = (uint16_t)(u >> 16);
+		memcpy(s + i * 2, &h, 2);
+	}
+	else if ((4 == unit) || compress) {
+		f = (float)v;
+		memcpy(s + i * 4, &f, 4);
+	}
+	else {
+		memcpy(s + i * 8, &v, 8);
+	}
+}
+
+static uint64_t
+chunk(g__ring_t ring, uint64_t count, int c)
+{
+	return count * (uint64_t)c / (uint64_t)ring->size;
+}
+
+static int
+step(g__ring_t ring,
+     char *p,
+     uint64_t count,
+     int unit,
+     int compress,
+     int c, /* sent */
+     int d, /* received */
+     int add)
+{
+	uint64_t i, lo, hi, w;
+	double v;
+
+	w = compress ? (uint64_t)unit / 2 : (uint64_t)unit;
+	lo = chunk(ring, count, c);
+	hi = chunk(ring, count, c + 1);
+	for (i=lo; i<hi; ++i) {
+		save(ring->buf, i - lo, unit, compress, load(p, i, unit, 0));
+	}
+	if (exchange(ring,
+		     ring->buf,
+		     (hi - lo) * w,
+		     ring->buf + ring->n * w,
+		     (chunk(ring, count, d + 1) - chunk(ring, count, d)) * w)) {
+		G__DEBUG(0);
+		return -1;
+	}
+	lo = chunk(ring, count, d);
+	hi = chunk(ring, count, d + 1);
+	for (i=lo; i<hi; ++i) {
+		v = load(ring->buf + ring->n * w, i - lo, unit, compress);
+		save(p, i, unit, 0, add ? (load(p, i, unit, 0) + v) : v);
+	}
+	return 0;
+}
+
+int
+g__ring_allreduce(g__ring_t ring,
+		  void *p,
+		  uint64_t count,
+		  int unit,
+		  int compress)
+{
+	uint64_t i, lo, hi;
+	int r, n, s;
+	char t[8];
+
+	assert( ring && p && ((4 == unit) || (8 == unit)) );
+
+	r = ring->rank;
+	n = ring->size;
+	if (1 == n) {
+		return 0;
+	}
+	if (ring->n < (count / n + 1)) {
+		G__FREE(ring->buf);
+		ring->n = count / n + 1;
+		ring->buf = g__malloc(2 * ring->n * unit);
+		if (!ring->buf) {
+			ring->n = 0;
+			G__DEBUG(0);
+			return -1;
+		}
+	}
+
+	/*
+	 * Reduce-scatter, after which rank r holds the sum of chunk r + 1,
+	 * then all-gather of the sums. Each chunk is summed in ring order
+	 * once and copied everywhere, so all ranks agree to the bit.
+	 */
+
+	for (s=0; s<(n-1); ++s) {
+		if (step(ring,
+			 (char *)p,
+			 count,
+			 unit,
+			 compress,
+			 (r - s + n) % n,
+			 (r - s - 1 + n) % n,
+			 1)) {
+			G__DEBUG(0);
+			return -1;
+		}
+	}
+	if (compress) {
+
+		/* the owner keeps what the others will receive */
+
+		lo = chunk(ring, count, (r + 1) % n);
+		hi = chunk(ring, count, (r + 1) % n + 1);
+		for (i=lo; i<hi; ++i) {
+			save(t, 0, unit, 1, load((char *)p, i, unit, 0));
+			save((char *)p, i, unit, 0, load(t, 0, unit, 1));
+		}
+	}
+	for (s=0; s<(n-1); ++s) {
+		if (step(ring,
+			 (char *)p,
+			 count,
+			 unit,
+			 compress,
+			 (r + 1 - s + n) % n,
+			 (r - s + n) % n,
+			 0)) {
+			G__DEBUG(0);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int
+g__ring_broadcast(g__ring_t ring, void *p, uint64_t n)
+{
+	assert( ring && p );
+
+	/* down the ring, rank 0 to size - 1 */
+
+	if (ring->rank && exchange(ring, 0, 0, (char *)p, n)) {
+		G__DEBUG(0);
+		return -1;
+	}
+	if (((ring->rank + 1) < ring->size) &&
+	    exchange(ring, (const char *)p, n, 0, 0)) {
+		G__DEBUG(0);
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,51 @@
+/**
+ * g_ring.h
+ * Copyright (C) Tony Givargis, 2019-2020
+ *
+ * This file is part of The Gravity Compiler.
+ *
+ * The Gravity Compiler is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version. The Gravity Compiler is distributed in
+ * the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE. See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with Foobar.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _G_RING_H_
+#define _G_RING_H_
+
+#include "g_common.h"
+
+/*
+ * size processes on one host joined in a ring over Unix-domain sockets,
+ * rank r listening on <path>.<r> and connected to rank r + 1. All ranks
+ * must make the same sequence of calls.
+ */
+
+typedef struct g__ring *g__ring_t;
+
+g__ring_t g__ring_open(const char *path, int rank, int size);
+
+void g__ring_close(g__ring_t ring);
+
+/*
+ * Sums the count reals (unit bytes each, 4: float, 8: double) in p across
+ * all ranks, every rank ends with the same sum. With compress the reals
+ * travel at half width (bfloat16, float) and the sum is rounded to it.
+ */
+
+int g__ring_allreduce(g__ring_t ring,
+		      void *p,
+		      uint64_t count,
+		      int unit,
+		      int compress);
+
+/* copies n bytes at p from rank 0 to all other ranks */
+
+int g__ring_broadcast(g__ring_t ring, void *p, uint64_t n);
+
+#endif /* _G_RING_H_ */
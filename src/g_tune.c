@@ -0,0 +1,311 @@
+/**
+ * g_tune.c
+ * Copyright (C) Tony Givargis, 2019-2020
+ *
+ * This file is part of The Gravity Compiler.
+ *
+ * The Gravity Compiler is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version. The Gravity Compiler is distributed in
+ * the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE. See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with Foobar.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include "g_vcm.h"
+#include "g_tune.h"
+
+#define MIN_TIME 0.05 /* seconds per measurement */
+
+#define FNV_PRIME (((uint64_t)0x00000100 << 32) | 0x000001b3)
+
+typedef size_t (*memory_size_fnc_t) (void);
+typedef void  *(*activate_fnc_t)    (void *, const void *);
+typedef void   (*train_fnc_t)       (void *, const void *, const void *);
+
+/*
+ * { unroll, tile, interchange, fuse, threads }
+ */
+
+static const struct g__emitc_strategy CANDIDATES[] = {
+	{ 1, 1, 0, 0, 0 }, { 1, 1, 0, 1, 0 },
+	{ 1, 1, 1, 0, 0 }, { 1, 1, 1, 1, 0 },
+	{ 4, 1, 0, 0, 0 }, { 4, 1, 0, 1, 0 },
+	{ 4, 1, 1, 0, 0 }, { 4, 1, 1, 1, 0 },
+	{ 1, 4, 0, 0, 0 }, { 1, 4, 0, 1, 0 },
+	{ 1, 4, 1, 0, 0 }, { 1, 4, 1, 1, 0 },
+	{ 4, 4, 0, 0, 0 }, { 4, 4, 0, 1, 0 },
+	{ 4, 4, 1, 0, 0 }, { 4, 4, 1, 1, 0 }
+};
+
+static void
+cpu_model(char *s, size_t n)
+{
+	char line[256], *p;
+	FILE *file;
+
+	g__sprintf(s, n, "unknown");
+	file = fopen("/proc/cpuinfo", "r");
+	if (!file) {
+		return;
+	}
+	while (fgets(line, sizeof (line), file)) {
+		if (!strncmp(line, "model name", 10) ||
+		    !strncmp(line, "Model", 5) ||
+		    !strncmp(line, "Hardware", 8)) {
+			p = strchr(line, ':');
+			if (p) {
+				g__sprintf(s, n, "%s", p + 1);
+				break;
+			}
+		}
+	}
+	fclose(file);
+}
+
+void
+g__tune_fill(void *p, uint64_t n, int precision, double scale)
+{
+	uint32_t seed;
+	uint64_t i;
+	double r;
+
+	/*
+	 * private LCG, the search and profile builds must not disturb the
+	 * rand() sequence the model initialization draws from
+	 */
+
+	seed = 1;
+	for (i=0; i<n; ++i) {
+		seed = seed * 1103515245 + 12345;
+		r = scale * ((double)((seed >> 8) & 0xffff) / 0xffff);
+		if (G__ANN_PRECISION_DOUBLE == precision) {
+			((double *)p)[i] = r;
+		}
+		else {
+			((float *)p)[i] = (float)r;
+		}
+	}
+}
+
+static void *
+synthesize(const struct g__ann *ann, uint64_t n, int onehot)
+{
+	uint64_t i, unit;
+	char *p;
+
+	unit = (G__ANN_PRECISION_DOUBLE == ann->precision.precision) ? 8 : 4;
+	p = g__malloc(ann->batch * n * unit);
+	if (!p) {
+		G__DEBUG(0);
+		return 0;
+	}
+	memset(p, 0, ann->batch * n * unit);
+	if (!onehot) {
+		g__tune_fill(p, ann->batch * n, ann->precision.precision, 1.0);
+	}
+	for (i=0; onehot && (i<(uint64_t)ann->batch); ++i) {
+		if (8 == unit) {
+			((double *)p)[i * n + i % n] = 1.0;
+		}
+		else {
+			((float *)p)[i * n + i % n] = 1.0;
+		}
+	}
+	return p;
+}
+
+/* wall time, clock() would also count other threads of the process */
+
+static double
+now(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (double)t.tv_sec + (double)t.tv_nsec * 1e-9;
+}
+
+static double
+measure(g__vcm_t vcm, const struct g__ann *ann, const void *x, const void *y)
+{
+	memory_size_fnc_t memory_size;
+	activate_fnc_t activate;
+	train_fnc_t train;
+	double t, score;
+	void *memory;
+	long i;
+
+	memory_size = (memory_size_fnc_t)(long)
+		g__vcm_lookup(vcm, "_memory_size");
+	activate = (activate_fnc_t)(long)
+		g__vcm_lookup(vcm, "_activate");
+	train = (train_fnc_t)(long)
+		g__vcm_lookup(vcm, "_train");
+	assert( memory_size && activate && train );
+	memory = g__malloc(memory_size());
+	if (!memory) {
+		G__DEBUG(0);
+		return -1.0;
+	}
+	memset(memory, 0, memory_size());
+	g__tune_fill(memory,
+	     ann->precision.hard / ((G__ANN_PRECISION_DOUBLE ==
+				     ann->precision.precision) ? 8 : 4),
+	     ann->precision.precision,
+	     0.01);
+
+	/* per sample train time + per sample activate time */
+
+	t = now();
+	for (i=0; MIN_TIME > (now() - t); ++i) {
+		train(memory, x, y);
+	}
+	score = (now() - t) / ((double)i * ann->batch);
+	t = now();
+	for (i=0; MIN_TIME > (now() - t); ++i) {
+		activate(memory, x);
+	}
+	score += (now() - t) / (double)i;
+	G__FREE(memory);
+	return score;
+}
+
+uint64_t
+g__tune_hash(uint64_t h, const char *s)
+{
+	while (s && *s) {
+		h ^= (uint64_t)(unsigned char)(*s++);
+		h *= FNV_PRIME;
+	}
+	return h;
+}
+
+uint64_t
+g__tune_key(uint64_t topology)
+{
+	char s[256];
+
+	cpu_model(s, sizeof (s));
+	return g__tune_hash(topology, s);
+}
+
+int
+g__tune_load(const char *pathname,
+	     uint64_t key,
+	     struct g__emitc_strategy *strategy)
+{
+	struct g__emitc_strategy strategy_;
+	unsigned long hi, lo;
+	char line[256];
+	FILE *file;
+	int found;
+
+	assert( g__strlen(pathname) && strategy );
+
+	file = fopen(pathname, "r");
+	if (!file) {
+		return -1;
+	}
+	found = 0;
+	while (fgets(line, sizeof (line), file)) {
+		if ((6 == sscanf(line,
+				 "%8lx%8lx %d %d %d %d",
+				 &hi,
+				 &lo,
+				 &strategy_.unroll,
+				 &strategy_.tile,
+				 &strategy_.interchange,
+				 &strategy_.fuse)) &&
+		    (key == (((uint64_t)hi << 32) | (uint64_t)lo))) {
+			(*strategy) = strategy_; /* last entry wins */
+			found = 1;
+		}
+	}
+	fclose(file);
+	return found ? 0 : -1;
+}
+
+int
+g__tune_store(const char *pathname,
+	      uint64_t key,
+	      const struct g__emitc_strategy *strategy)
+{
+	FILE *file;
+
+	assert( g__strlen(pathname) && strategy );
+
+	file = fopen(pathname, "a");
+	if (!file) {
+		G__DEBUG(G__ERR_FILE);
+		return -1;
+	}
+	if (0 > fprintf(file,
+			"%08lx%08lx %d %d %d %d\n",
+			(unsigned long)(key >> 32),
+			(unsigned long)(key & 0xffffffff),
+			strategy->unroll,
+			strategy->tile,
+			strategy->interchange,
+			strategy->fuse)) {
+		fclose(file);
+		G__DEBUG(G__ERR_FILE);
+		return -1;
+	}
+	fclose(file);
+	return 0;
+}
+
+int
+g__tune_search(const struct g__ann *ann,
+	       const char *tmp,
+	       const char *pathname,
+	       int level,
+	       struct g__emitc_strategy *strategy)
+{
+	double score, best;
+	g__vcm_t vcm;
+	void *x, *y;
+	size_t i;
+
+	assert( ann && g__strlen(pathname) && strategy );
+
+	x = synthesize(ann, ann->nodes[0], 0);
+	y = synthesize(ann, ann->nodes[ann->layers - 1], 1);
+	if (!x || !y) {
+		G__FREE(x);
+		G__FREE(y);
+		G__DEBUG(0);
+		return -1;
+	}
+	best = -1.0;
+	for (i=0; i<(sizeof (CANDIDATES) / sizeof (CANDIDATES[0])); ++i) {
+		if (g__emitc(ann, tmp, &CANDIDATES[i])) {
+			G__DEBUG(0);
+			continue;
+		}
+		vcm = g__vcm_open(pathname, level);
+		if (!vcm) {
+			G__DEBUG(0);
+			continue;
+		}
+		score = measure(vcm, ann, x, y);
+		g__vcm_close(vcm);
+		if ((0.0 <= score) && ((0.0 > best) || (score < best))) {
+			(*strategy) = CANDIDATES[i];
+			best = score;
+		}
+	}
+	G__FREE(x);
+	G__FREE(y);
+	if (0.0 > best) {
+		G__DEBUG(G__ERR_JITC);
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,49 @@
+/**
+ * g_tune.h
+ * Copyright (C) Tony Givargis, 2019-2020
+ *
+ * This file is part of The Gravity Compiler.
+ *
+ * The Gravity Compiler is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version. The Gravity Compiler is distributed in
+ * the hope that it will be useful, but WITHOUT ANY WARRANTY; without even
+ * the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE. See the GNU General Public License for more details. You should
+ * have received a copy of the GNU General Public License along with Foobar.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _G_TUNE_H_
+#define _G_TUNE_H_
+
+#include "g_emitc.h"
+
+/* FNV-1a, a chain of calls starts from G__TUNE_SEED */
+
+#define G__TUNE_SEED (((uint64_t)0xcbf29ce4 << 32) | 0x84222325)
+
+uint64_t g__tune_hash(uint64_t h, const char *s);
+
+uint64_t g__tune_key(uint64_t topology);
+
+/* n reals of precision G__ANN_PRECISION_* at p, in [0, scale], rand() kept */
+
+void g__tune_fill(void *p, uint64_t n, int precision, double scale);
+
+int g__tune_load(const char *pathname,
+		 uint64_t key,
+		 struct g__emitc_strategy *strategy);
+
+int g__tune_store(const char *pathname,
+		  uint64_t key,
+		  const struct g__emitc_strategy *strategy);
+
+int g__tune_search(const struct g__ann *ann,
+		   const char *tmp,
+		   const char *pathname,
+		   int level,
+		   struct g__emitc_strategy *strategy);
+
+#endif /* _G_TUNE_H_ */
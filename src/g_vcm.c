@@ -24,13 +24,14 @@
 
 struct g__vcm {
 	void *handle;
+	int refs;
 };
 
 static int
-compile(const char *input, const char *output)
+compile(const char *input, const char *output, int level)
 {
-	char *file, *argv[15];
-	int status;
+	char *file, *argv[20];
+	int status, i;
 	pid_t pid;
 
 	pid = fork();
@@ -40,25 +41,40 @@ compile(const char *input, const char *output)
 	}
 	if (!pid) {
 		file = g__strlen(getenv("CC")) ? getenv("CC") : "/usr/bin/cc";
-		argv[ 0] = "cc";
-		argv[ 1] = "-ansi";
-		argv[ 2] = "-pedantic";
-		argv[ 3] = "-Wshadow";
-		argv[ 4] = "-Wall";
-		argv[ 5] = "-Wextra";
-		argv[ 6] = "-Werror";
-		argv[ 7] = "-Wfatal-errors";
-		argv[ 8] = "-fPIC";
-		argv[ 9] = "-O3";
-		argv[10] = "-shared";
-		argv[11] = (char *)input;
-		argv[12] = "-o";
-		argv[13] = (char *)output;
-		argv[14] = 0;
-		if (0 > execvp(file, argv)) {
-			G__DEBUG(G__ERR_SYSTEM);
-			return -1;
+		i = 0;
+		argv[i++] = "cc";
+		argv[i++] = "-ansi";
+		argv[i++] = "-pedantic";
+		argv[i++] = "-Wshadow";
+		argv[i++] = "-Wall";
+		argv[i++] = "-Wextra";
+		argv[i++] = "-Werror";
+		argv[i++] = "-Wfatal-errors";
+		argv[i++] = "-fPIC";
+		if (G__VCM_LEVEL_FAST == level) {
+			argv[i++] = "-O1";
+		}
+		else {
+			argv[i++] = "-O3";
+		}
+		if (G__VCM_LEVEL_NATIVE == level) {
+			argv[i++] = "-march=native";
+			argv[i++] = "-mtune=native";
+		}
+		if (G__VCM_LEVEL_PGO_GENERATE == level) {
+			argv[i++] = "-fprofile-generate";
 		}
+		if (G__VCM_LEVEL_PGO_USE == level) {
+			argv[i++] = "-fprofile-use";
+		}
+		argv[i++] = "-shared";
+		argv[i++] = (char *)input;
+		argv[i++] = "-o";
+		argv[i++] = (char *)output;
+		argv[i++] = 0;
+		execvp(file, argv);
+		G__DEBUG(G__ERR_SYSTEM);
+		_exit(-1); /* the child must not return into g_open() */
 	}
 	else {
 		status = 0;
@@ -71,32 +87,68 @@ compile(const char *input, const char *output)
 	return 0;
 }
 
+static void
+unlink_profile(const char *pathname, const char *output)
+{
+	const char *base;
+	size_t n, k;
+	char *s;
+
+	/*
+	 * gcc names the profile of a single step compile/link after the
+	 * output and the input base name: <output>-<base>.gcda
+	 */
+
+	base = strrchr(pathname, '/');
+	base = base ? (base + 1) : pathname;
+	k = strrchr(base, '.') ? (size_t)(strrchr(base, '.') - base) : 0;
+	k = k ? k : g__strlen(base);
+	n = g__strlen(output) + k + 8;
+	s = g__malloc(n);
+	if (!s) {
+		G__DEBUG(0);
+		return;
+	}
+	g__sprintf(s, n, "%s-%.*s.gcda", output, (int)k, base);
+	g__unlink(s);
+	G__FREE(s);
+}
+
 g__vcm_t
-g__vcm_open(const char *pathname)
+g__vcm_open(const char *pathname, int level)
 {
+	static const char *SUFFIX[] = { "O1", "O3", "native", "pgo", "pgo" };
 	struct g__vcm *vcm;
-	const char *tmp;
 	size_t n;
 	char *s;
 
 	assert( g__strlen(pathname) );
+	assert( (0 <= level) && (G__VCM_LEVEL_PGO_USE >= level) );
 
-	tmp = getenv("TMPDIR");
-	tmp = tmp ? tmp : getenv("TMP");
-	tmp = tmp ? tmp : getenv("TEMP");
-	tmp = tmp ? tmp : ".";
-	n = g__strlen(tmp) + 32;
+	/*
+	 * The shared object is named after the source and the level: the
+	 * two PGO steps must agree on it (it names the profile data) while
+	 * tiers loaded side by side must not (dlopen matches by name).
+	 */
+
+	n = g__strlen(pathname) + 16;
 	s = g__malloc(n);
 	if (!s) {
 		G__DEBUG(0);
 		return 0;
 	}
-	g__sprintf(s, n, "%s/_%x_.so", tmp, rand());
-	if (compile(pathname, s)) {
+	g__sprintf(s, n, "%s.%s.so", pathname, SUFFIX[level]);
+	if (compile(pathname, s, level)) {
+		if (G__VCM_LEVEL_PGO_USE == level) {
+			unlink_profile(pathname, s);
+		}
 		G__FREE(s);
 		G__DEBUG(0);
 		return 0;
 	}
+	if (G__VCM_LEVEL_PGO_USE == level) {
+		unlink_profile(pathname, s);
+	}
 	vcm = g__malloc(sizeof (struct g__vcm));
 	if (!vcm) {
 		g__unlink(s);
@@ -105,6 +157,7 @@ g__vcm_open(const char *pathname)
 		return 0;
 	}
 	memset(vcm, 0, sizeof (struct g__vcm));
+	vcm->refs = 1;
 	vcm->handle = dlopen(s, RTLD_LAZY | RTLD_LOCAL);
 	g__unlink(s);
 	G__FREE(s);
@@ -116,9 +169,21 @@ g__vcm_open(const char *pathname)
 	return vcm;
 }
 
+g__vcm_t
+g__vcm_retain(g__vcm_t vcm)
+{
+	assert( vcm && (0 < vcm->refs) );
+
+	__atomic_add_fetch(&vcm->refs, 1, __ATOMIC_RELAXED);
+	return vcm;
+}
+
 void
 g__vcm_close(g__vcm_t vcm)
 {
+	if (vcm && __atomic_sub_fetch(&vcm->refs, 1, __ATOMIC_ACQ_REL)) {
+		return;
+	}
 	if (vcm && vcm->handle) {
 		dlclose(vcm->handle);
 	}
@@ -18,9 +18,27 @@
 #ifndef _G_VCM_H_
 #define _G_VCM_H_
 
+#define G__VCM_LEVEL_FAST         0 /* -O1, quick to compile */
+#define G__VCM_LEVEL_PORTABLE     1 /* -O3 */
+#define G__VCM_LEVEL_NATIVE       2 /* -O3 -march=native -mtune=native */
+#define G__VCM_LEVEL_PGO_GENERATE 3 /* -O3, instrumented */
+#define G__VCM_LEVEL_PGO_USE      4 /* -O3, using the instrumented run */
+
+/*
+ * A G__VCM_LEVEL_PGO_GENERATE module writes its profile when closed, the
+ * next G__VCM_LEVEL_PGO_USE open of the same pathname consumes it.
+ */
+
 typedef struct g__vcm *g__vcm_t;
 
-g__vcm_t g__vcm_open(const char *pathname);
+g__vcm_t g__vcm_open(const char *pathname, int level);
+
+/*
+ * Adds a reference, every g__vcm_open() and g__vcm_retain() is balanced by
+ * one g__vcm_close(), the module is unloaded by the last.
+ */
+
+g__vcm_t g__vcm_retain(g__vcm_t vcm);
 
 void g__vcm_close(g__vcm_t vcm);
 
@@ -26,7 +26,6 @@ main(int argc, char *argv[])
 	int i;
 
 	pathname = 0;
-	yyerroron = 1;
 	g__debug_enabled = 0;
 	for (i=1; i<argc; ++i) {
 		if (!strcmp("--version", argv[i])) {
@@ -52,14 +51,14 @@ main(int argc, char *argv[])
 
 	/* g compile */
 
-	ir = g__ir_parse(pathname);
+	ir = g__ir_parse(pathname, 1);
 	if (!ir) {
 		G__DEBUG(0);
 		return -1;
 	}
 	ann = g__ann_open(ir);
-	g__ir_destroy();
-	if (!ann || g__emitc(ann, 0)) {
+	g__ir_destroy(ir);
+	if (!ann || g__emitc(ann, 0, 0)) {
 		g__ann_close(ann);
 		fprintf(stderr, "gravity compiler error (run with --debug)\n");
 		G__DEBUG(0);